@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+
+"""Benchmark of the download fragment size on simulated LTE links.
+
+A local HTTP server serves a file with a delay per request, a limited
+bandwidth and connections that drop after a random number of bytes. A client
+fetches the file the way download_client does over HTTPS: one range request
+per fragment on a kept-alive connection, reconnecting after a drop and
+requesting the whole fragment again. Each link is downloaded with fixed
+fragment sizes and with the size the download module chooses from the RSRP.
+With --write-ms, storing takes that long per KiB, and each download is run
+once storing in the download thread and once through a queue of
+--pipeline-buf bytes to a storage thread, as with CONFIG_DOWNLOAD_PIPELINE.
+All delays are divided by --time-scale, the printed times are scaled back.
+"""
+
+import argparse
+import collections
+import http.client
+import http.server
+import random
+import socket
+import statistics
+import threading
+import time
+
+# RSRP in dBm, round trip time in s, bandwidth in B/s and mean bytes between
+# connection drops. Roughly LTE-M from good coverage to the cell edge.
+LINKS = {
+    "strong": (-85, 0.08, 40000, 4 << 20),
+    "fair": (-100, 0.2, 15000, 256 << 10),
+    "weak": (-112, 0.5, 5000, 16 << 10),
+    "edge": (-120, 0.9, 2000, 3 << 10),
+}
+
+# Round trips for a new connection: TCP, then the TLS handshake
+CONNECT_RTTS = 3
+# Time the client waits before it notices a dropped connection
+DROP_DETECT_S = 2.0
+SEND_CHUNK = 256
+
+
+def choose_frag_size(rsrp, block, frag_min, frag_max, strong, weak):
+    """Same policy as choose_frag_size() in download_module.c."""
+    if rsrp == 0:
+        return 0
+    if rsrp >= strong:
+        size = frag_max
+    elif rsrp <= weak:
+        size = frag_min
+    else:
+        size = frag_min + (frag_max - frag_min) * (rsrp - weak) // (strong - weak)
+    if size >= block:
+        size -= size % block
+    return size
+
+
+class Link:
+    """Simulated link shared by the server threads. Drops are drawn from the
+    seed, so every fragment size sees them at the same byte counts."""
+
+    def __init__(self, rtt, bandwidth, drop_mean, scale, seed):
+        self.rtt = rtt / scale
+        self.byte_time = 1 / bandwidth / scale
+        self.drop_detect = DROP_DETECT_S / scale
+        self.drop_mean = drop_mean
+        self.rand = random.Random(seed)
+        self.until_drop = self.next_drop()
+        self.sent = 0
+
+    def next_drop(self):
+        return max(1, int(self.rand.expovariate(1 / self.drop_mean)))
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def setup(self):
+        super().setup()
+        self.connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        data = self.server.data
+        link = self.server.link
+        first, last = 0, len(data) - 1
+        ranged = self.headers.get("Range", "")
+        if ranged.startswith("bytes="):
+            start, _, end = ranged[6:].partition("-")
+            first = int(start)
+            last = min(int(end), last) if end else last
+        body = data[first:last + 1]
+        time.sleep(link.rtt)
+        self.send_response(206 if ranged else 200)
+        self.send_header("Content-Length", str(len(body)))
+        if ranged:
+            self.send_header("Content-Range", f"bytes {first}-{last}/{len(data)}")
+        self.end_headers()
+        pos = 0
+        while pos < len(body):
+            chunk = body[pos:pos + SEND_CHUNK]
+            if len(chunk) >= link.until_drop:
+                self.wfile.write(chunk[:link.until_drop])
+                link.sent += link.until_drop
+                link.until_drop = link.next_drop()
+                self.wfile.flush()
+                self.connection.shutdown(socket.SHUT_RDWR)
+                self.close_connection = True
+                return
+            link.until_drop -= len(chunk)
+            link.sent += len(chunk)
+            self.wfile.write(chunk)
+            time.sleep(len(chunk) * link.byte_time)
+            pos += len(chunk)
+
+
+class Storage:
+    """Flash that takes write_s per KiB. With a buf_size, bytes are queued for
+    a storage thread and store() only waits while the queue is full."""
+
+    def __init__(self, write_s, buf_size):
+        self.write_s = write_s
+        self.buf_size = buf_size
+        self.queued = 0
+        self.pending = collections.deque()
+        self.cond = threading.Condition()
+        if buf_size:
+            threading.Thread(target=self.worker, daemon=True).start()
+
+    def store(self, n):
+        if not self.buf_size:
+            time.sleep(n / 1024 * self.write_s)
+            return
+        with self.cond:
+            while self.queued and self.queued + n > self.buf_size:
+                self.cond.wait()
+            self.queued += n
+            self.pending.append(n)
+            self.cond.notify_all()
+
+    def worker(self):
+        while True:
+            with self.cond:
+                while not self.pending:
+                    self.cond.wait()
+                n = self.pending[0]
+            time.sleep(n / 1024 * self.write_s)
+            with self.cond:
+                self.pending.popleft()
+                self.queued -= n
+                self.cond.notify_all()
+
+    def drain(self):
+        with self.cond:
+            while self.queued:
+                self.cond.wait()
+
+
+def download(port, size, frag_size, link, storage):
+    """Fetch the file in fragments of frag_size bytes, frag_size 0 meaning one
+    request, and store them. Returns the number of reconnects."""
+    conn = None
+    offset = 0
+    reconnects = 0
+    while offset < size:
+        if conn is None:
+            conn = http.client.HTTPConnection("127.0.0.1", port, timeout=30)
+            conn.connect()
+            conn.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            time.sleep(CONNECT_RTTS * link.rtt)
+        end = size - 1 if frag_size == 0 else min(offset + frag_size, size) - 1
+        try:
+            conn.request("GET", "/vault", headers={"Range": f"bytes={offset}-{end}"})
+            body = conn.getresponse().read()
+            if len(body) != end - offset + 1:
+                raise ConnectionError("short fragment")
+            offset += len(body)
+            storage.store(len(body))
+        except (ConnectionError, http.client.HTTPException):
+            # The incomplete fragment is thrown away and requested again
+            conn.close()
+            conn = None
+            reconnects += 1
+            time.sleep(link.drop_detect)
+    if conn is not None:
+        conn.close()
+    storage.drain()
+    return reconnects
+
+
+def run(args, data, rsrp, rtt, bandwidth, drop_mean, frag_size, buf_size, seed):
+    link = Link(rtt, bandwidth, drop_mean, args.time_scale, seed)
+    storage = Storage(args.write_ms / 1000 / args.time_scale, buf_size)
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+    server.data = data
+    server.link = link
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    try:
+        start = time.perf_counter()
+        reconnects = download(server.server_address[1], len(data), frag_size, link, storage)
+        elapsed = (time.perf_counter() - start) * args.time_scale
+    finally:
+        server.shutdown()
+        server.server_close()
+    return elapsed, reconnects, link.sent
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--size", type=int, default=64 << 10, help="file size in bytes")
+    parser.add_argument("--frag", type=int, nargs="+", default=[256, 512, 1024, 2048],
+                        help="fixed fragment sizes to compare")
+    parser.add_argument("--link", nargs="+", default=list(LINKS), choices=list(LINKS),
+                        help="simulated links")
+    parser.add_argument("--block", type=int, default=512,
+                        help="storage write block, CONFIG_FILE_UTIL_WRITE_BUF_SIZE")
+    parser.add_argument("--frag-min", type=int, default=1024, help="CONFIG_DOWNLOAD_FRAG_SIZE_MIN")
+    parser.add_argument("--frag-max", type=int, default=2048, help="CONFIG_DOWNLOAD_FRAG_SIZE_MAX")
+    parser.add_argument("--rsrp-strong", type=int, default=-112, help="CONFIG_DOWNLOAD_FRAG_RSRP_STRONG")
+    parser.add_argument("--rsrp-weak", type=int, default=-120, help="CONFIG_DOWNLOAD_FRAG_RSRP_WEAK")
+    parser.add_argument("--write-ms", type=float, default=0.0,
+                        help="flash write time per KiB; compares storing with and without the pipeline")
+    parser.add_argument("--pipeline-buf", type=int, default=4096, help="CONFIG_DOWNLOAD_PIPELINE_BUF_SIZE")
+    parser.add_argument("--runs", type=int, default=3, help="runs per link and fragment size")
+    parser.add_argument("--time-scale", type=float, default=20.0,
+                        help="divide all simulated delays by this")
+    parser.add_argument("--seed", type=int, default=0, help="seed of the first run")
+    args = parser.parse_args()
+
+    data = random.Random(args.seed).randbytes(args.size)
+    stores = [("", 0)]
+    if args.write_ms:
+        stores = [(" sync", 0), (" pipe", args.pipeline_buf)]
+    print(f"{'link':>7} {'rsrp':>5} {'frag':>14} {'time s':>8} {'stdev':>6} {'reconnects':>10} {'sent':>8}")
+    for name in args.link:
+        rsrp, rtt, bandwidth, drop_mean = LINKS[name]
+        adaptive = choose_frag_size(rsrp, args.block, args.frag_min, args.frag_max,
+                                    args.rsrp_strong, args.rsrp_weak)
+        policies = [(str(frag), frag) for frag in args.frag] + [(f"rsrp {adaptive}", adaptive)]
+        for label, frag_size in policies:
+            for store_label, buf_size in stores:
+                results = [run(args, data, rsrp, rtt, bandwidth, drop_mean, frag_size, buf_size,
+                               args.seed + i)
+                           for i in range(args.runs)]
+                times = [r[0] for r in results]
+                print(f"{name:>7} {rsrp:>5} {label + store_label:>14} {statistics.mean(times):>8.1f} "
+                      f"{statistics.pstdev(times):>6.1f} {statistics.mean(r[1] for r in results):>10.1f} "
+                      f"{statistics.mean(r[2] for r in results):>8.0f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,489 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+
+"""Host-side tool for building Skykey password vaults.
+
+Input is the tab separated text format read by the firmware: one record per
+line with the fields account, login name and password.
+"""
+
+import argparse
+import os
+import random
+import string
+import struct
+import sys
+import time
+import zlib
+
+VAULT_MAGIC = b"SKYV"
+VAULT_VERSION = 1
+VAULT_HEADER = struct.Struct("<4sBBHI")
+VAULT_FOLDERS_HEADER = struct.Struct("<II")
+VAULT_FLAG_FOLDERS = 0x01
+FOLDER_SEPARATOR = b"/"
+
+CRYPTO_MAGIC = b"SKYE"
+CRYPTO_VERSION = 1
+CRYPTO_VERSION_SPLIT = 2
+CRYPTO_NONCE_LEN = 12
+CRYPTO_TAG_LEN = 16
+CRYPTO_LOCATOR = struct.Struct("<IH")
+COMPRESS_MAGIC = b"SKYZ"
+COMPRESS_VERSION = 1
+COMPRESS_HEADER = struct.Struct("<4sBBHII")
+COMPRESS_MATCH_MIN = 3
+COMPRESS_MATCH_MAX = 18
+COMPRESS_DIST_MAX = 4096
+# Matches the default CONFIG_COMPRESS_UTIL_BLOCK_MAX_LEN
+COMPRESS_BLOCK_SHIFT = 10
+PATCH_MAGIC = b"SKYD"
+PATCH_VERSION = 1
+PATCH_HEADER = struct.Struct("<4sB3xIIII")
+PATCH_OP_COPY = 1
+PATCH_OP_INSERT = 2
+PATCH_BLOCK_LEN = 16
+
+# Matches the default CONFIG_CRYPTO_UTIL_VAULT_KEY, for development only
+DEFAULT_KEY = "000102030405060708090a0b0c0d0e0f"
+
+
+def read_tsv(path):
+    """Return a list of (account, login, password) tuples of bytes."""
+    with open(path, "rb") as f:
+        return parse_tsv(f.read(), path)
+
+
+def parse_tsv(data, path):
+    """Parse TSV data read from `path`, skipping malformed lines."""
+    records = []
+    for lineno, line in enumerate(data.splitlines(), 1):
+        if not line:
+            continue
+        fields = line.split(b"\t")
+        if len(fields) < 3 or not fields[0]:
+            print(f"{path}:{lineno}: skipping malformed record", file=sys.stderr)
+            continue
+        record = tuple(fields[:3])
+        for field in record:
+            if len(field) > 255:
+                sys.exit(f"{path}:{lineno}: fields are limited to 255 bytes")
+        records.append(record)
+    return records
+
+
+def folder_of(account):
+    return account.split(FOLDER_SEPARATOR, 1)[0] if FOLDER_SEPARATOR in account else None
+
+
+def encode_binary(records):
+    """Encode records in the binary vault format described in parse_util.h.
+
+    Accounts named "folder/name" are grouped into folders. Either every
+    account or none must have a folder.
+    """
+    records = sorted(records, key=lambda r: r[0])
+    for prev, cur in zip(records, records[1:]):
+        if prev[0] == cur[0]:
+            sys.exit(f"duplicate account: {cur[0].decode(errors='replace')}")
+
+    folders = {}
+    for i, record in enumerate(records):
+        folder = folder_of(record[0])
+        if folder is not None:
+            first, count = folders.get(folder, (i, 0))
+            folders[folder] = (first, count + 1)
+    if folders and sum(count for _, count in folders.values()) != len(records):
+        sys.exit("when folders are used, every account must be named folder/name")
+    for folder in folders:
+        if not folder or len(folder) > 255:
+            sys.exit(f"invalid folder name: {folder.decode(errors='replace')}")
+
+    flags = VAULT_FLAG_FOLDERS if folders else 0
+    header_len = VAULT_HEADER.size + (VAULT_FOLDERS_HEADER.size if folders else 0)
+    folder_entries = []
+    for name in sorted(folders):
+        first, count = folders[name]
+        folder_entries.append(struct.pack("<IIB", first, count, len(name)) + name)
+
+    pos = header_len + 4 * (len(records) + len(folder_entries))
+    folder_offsets = []
+    for entry in folder_entries:
+        folder_offsets.append(pos)
+        pos += len(entry)
+    records_start = pos
+
+    offsets = []
+    body = bytearray()
+    for record in records:
+        offsets.append(records_start + len(body))
+        for field in record:
+            body.append(len(field))
+            body += field
+
+    out = bytearray(VAULT_HEADER.pack(VAULT_MAGIC, VAULT_VERSION, flags, header_len, len(records)))
+    if folders:
+        out += VAULT_FOLDERS_HEADER.pack(len(folder_entries), records_start)
+    out += struct.pack(f"<{len(offsets)}I", *offsets)
+    out += struct.pack(f"<{len(folder_offsets)}I", *folder_offsets)
+    out += b"".join(folder_entries)
+    out += body
+    return bytes(out)
+
+
+def encrypt(data, key):
+    """Wrap a vault in the encrypted container described in crypto_util.h."""
+    from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+
+    nonce = os.urandom(CRYPTO_NONCE_LEN)
+    header = CRYPTO_MAGIC + bytes([CRYPTO_VERSION, 0, 0, 0]) + nonce
+    # AESGCM appends the tag to the ciphertext
+    return header + AESGCM(key).encrypt(nonce, data, None)
+
+
+def encrypt_split(records, key):
+    """Encrypt the account index and every password separately, as version 2
+    of the container described in crypto_util.h."""
+    from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+
+    aes = AESGCM(key)
+    records = sorted(records, key=lambda r: r[0])
+    # Locators have a fixed size, so the index length does not depend on them
+    index_len = len(encode_binary([(a, l, bytes(CRYPTO_LOCATOR.size)) for a, l, _ in records]))
+    header_len = 4 + 4 + CRYPTO_NONCE_LEN + 4
+    pos = header_len + index_len + CRYPTO_TAG_LEN
+
+    index = []
+    passwords = bytearray()
+    for account, login, password in records:
+        nonce = os.urandom(CRYPTO_NONCE_LEN)
+        rec = nonce + aes.encrypt(nonce, password, account)
+        index.append((account, login, CRYPTO_LOCATOR.pack(pos + len(passwords), len(rec))))
+        passwords += rec
+
+    nonce = os.urandom(CRYPTO_NONCE_LEN)
+    header = CRYPTO_MAGIC + bytes([CRYPTO_VERSION_SPLIT, 0, 0, 0]) + nonce + struct.pack("<I", index_len)
+    return header + aes.encrypt(nonce, encode_binary(index), None) + bytes(passwords)
+
+
+def lzss_compress(block):
+    """Compress one block into the LZSS stream described in compress_util.h,
+    greedily taking the longest match among recent candidates."""
+    out = bytearray()
+    heads = {}
+    i = 0
+    n = len(block)
+
+    def remember(pos):
+        if pos + COMPRESS_MATCH_MIN <= n:
+            heads.setdefault(block[pos:pos + COMPRESS_MATCH_MIN], []).append(pos)
+
+    while i < n:
+        flags_pos = len(out)
+        out.append(0)
+        for bit in range(8):
+            if i >= n:
+                break
+            best_len, best_dist = 0, 0
+            for j in reversed(heads.get(block[i:i + COMPRESS_MATCH_MIN], [])[-32:]):
+                dist = i - j
+                if dist > COMPRESS_DIST_MAX:
+                    break
+                length = 0
+                while length < COMPRESS_MATCH_MAX and i + length < n and block[j + length] == block[i + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, dist
+                if length == COMPRESS_MATCH_MAX:
+                    break
+            if best_len >= COMPRESS_MATCH_MIN:
+                out += bytes([(best_dist - 1) & 0xFF,
+                              ((best_dist - 1) >> 8) | ((best_len - COMPRESS_MATCH_MIN) << 4)])
+                for k in range(best_len):
+                    remember(i + k)
+                i += best_len
+            else:
+                out[flags_pos] |= 1 << bit
+                out.append(block[i])
+                remember(i)
+                i += 1
+    return bytes(out)
+
+
+def lzss_decompress(data, length):
+    """Decompress one LZSS block, as the firmware does."""
+    out = bytearray()
+    pos = 0
+    while len(out) < length:
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if len(out) >= length:
+                break
+            if flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+            else:
+                dist = (data[pos] | (data[pos + 1] & 0x0F) << 8) + 1
+                count = (data[pos + 1] >> 4) + COMPRESS_MATCH_MIN
+                pos += 2
+                for _ in range(count):
+                    out.append(out[-dist])
+    return bytes(out)
+
+
+def compress(data, block_shift=COMPRESS_BLOCK_SHIFT):
+    """Wrap a vault in the compressed container described in compress_util.h."""
+    block_len = 1 << block_shift
+    blocks = [lzss_compress(data[i:i + block_len]) for i in range(0, len(data), block_len)]
+    pos = COMPRESS_HEADER.size + 4 * (len(blocks) + 1)
+    offsets = []
+    for block in blocks:
+        offsets.append(pos)
+        pos += len(block)
+    offsets.append(pos)
+    header = COMPRESS_HEADER.pack(COMPRESS_MAGIC, COMPRESS_VERSION, block_shift, 0, len(data), len(blocks))
+    return header + struct.pack(f"<{len(offsets)}I", *offsets) + b"".join(blocks)
+
+
+def decompress(container):
+    """Return the vault held in a compressed container."""
+    _, _, block_shift, _, plain_len, count = COMPRESS_HEADER.unpack_from(container)
+    offsets = struct.unpack_from(f"<{count + 1}I", container, COMPRESS_HEADER.size)
+    block_len = 1 << block_shift
+    out = bytearray()
+    for i in range(count):
+        out += lzss_decompress(container[offsets[i]:offsets[i + 1]], min(block_len, plain_len - i * block_len))
+    return bytes(out)
+
+
+def make_patch(old, new, block_len=PATCH_BLOCK_LEN):
+    """Build a patch, as described in patch_util.h, turning old into new.
+
+    Blocks of old are indexed by content, and every block found in new is
+    grown as far as it matches and copied. Everything else is inserted.
+    """
+    index = {}
+    for pos in range(0, len(old) - block_len + 1, block_len):
+        index.setdefault(old[pos:pos + block_len], pos)
+    ops = []
+    insert = bytearray()
+    pos = 0
+    while pos < len(new):
+        start = index.get(new[pos:pos + block_len]) if pos + block_len <= len(new) else None
+        if start is None:
+            insert.append(new[pos])
+            pos += 1
+            continue
+        length = block_len
+        while start + length < len(old) and pos + length < len(new) and old[start + length] == new[pos + length]:
+            length += 1
+        if insert:
+            ops.append(struct.pack("<BI", PATCH_OP_INSERT, len(insert)) + insert)
+            insert = bytearray()
+        ops.append(struct.pack("<BII", PATCH_OP_COPY, start, length))
+        pos += length
+    if insert:
+        ops.append(struct.pack("<BI", PATCH_OP_INSERT, len(insert)) + insert)
+    header = PATCH_HEADER.pack(PATCH_MAGIC, PATCH_VERSION, len(old), zlib.crc32(old), len(new), zlib.crc32(new))
+    return header + b"".join(ops)
+
+
+def apply_patch(old, patch):
+    """Apply a patch the way the firmware does, checking both CRCs."""
+    _, _, base_len, base_crc, target_len, target_crc = PATCH_HEADER.unpack_from(patch)
+    if len(old) != base_len or zlib.crc32(old) != base_crc:
+        raise ValueError("patch is for another file")
+    out = bytearray()
+    pos = PATCH_HEADER.size
+    while pos < len(patch):
+        op = patch[pos]
+        if op == PATCH_OP_COPY:
+            start, length = struct.unpack_from("<II", patch, pos + 1)
+            out += old[start:start + length]
+            pos += 9
+        else:
+            (length,) = struct.unpack_from("<I", patch, pos + 1)
+            out += patch[pos + 5:pos + 5 + length]
+            pos += 5 + length
+    if len(out) != target_len or zlib.crc32(out) != target_crc:
+        raise ValueError("patched file does not match")
+    return bytes(out)
+
+
+def parse_key(text):
+    try:
+        key = bytes.fromhex(text)
+    except ValueError:
+        key = b""
+    if len(key) != 16:
+        sys.exit("the key must be 32 hex characters")
+    return key
+
+
+def generate_tsv(count, name_len, malformed, folders, seed):
+    """Return a synthetic TSV vault as bytes, for measuring the parser on
+    devices. Names are unique and have random lengths up to name_len.
+    A `malformed` fraction of the lines miss fields or have empty names."""
+    rng = random.Random(seed)
+    alphabet = string.ascii_lowercase + string.digits
+    folder_names = [f"f{i}" for i in range(folders)]
+    names = set()
+    lines = []
+    while len(names) < count:
+        name = "".join(rng.choice(alphabet) for _ in range(rng.randint(1, name_len)))
+        if folder_names:
+            name = f"{rng.choice(folder_names)}/{name}"
+        if name in names:
+            continue
+        names.add(name)
+        login = f"user{len(names)}@example.com"
+        password = "".join(rng.choice(alphabet) for _ in range(rng.randint(8, 32)))
+        if rng.random() < malformed:
+            # Dropped by read_tsv, so these only ever reach the device as TSV
+            lines.append(rng.choice([f"{name}\t{login}", f"\t{login}\t{password}", name, ""]))
+        lines.append(f"{name}\t{login}\t{password}")
+    return ("\n".join(lines) + "\n").encode()
+
+
+def cmd_compress(args):
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if data.startswith(CRYPTO_MAGIC):
+        sys.exit(f"{args.input} is encrypted; compress before encrypting")
+    out = compress(data, args.block_shift)
+    if decompress(out) != data:
+        sys.exit("compression round trip failed")
+    with open(args.output, "wb") as f:
+        f.write(out)
+    print(f"Wrote {len(out)} bytes to {args.output}, {100 * len(out) / max(len(data), 1):.1f}% of {len(data)}")
+
+
+def cmd_delta(args):
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+    if new.startswith(CRYPTO_MAGIC):
+        print("warning: encrypted vaults change completely on every encryption, "
+              "patch the plain or compressed vault", file=sys.stderr)
+    patch = make_patch(old, new, args.block_len)
+    if apply_patch(old, patch) != new:
+        sys.exit("patch round trip failed")
+    with open(args.output, "wb") as f:
+        f.write(patch)
+    print(f"Wrote {len(patch)} bytes to {args.output}, {100 * len(patch) / max(len(new), 1):.1f}% of {len(new)}")
+
+
+def cmd_bench(args):
+    """Compare the compression ratio and decode speed of the container with
+    zlib, on synthetic vaults of a few sizes."""
+    print(f"{'records':>8} {'format':>6} {'bytes':>8} {'block':>6} {'ratio':>6} {'zlib':>6} {'decode MB/s':>12}")
+    for count in args.count:
+        tsv = generate_tsv(count, args.name_len, 0.0, args.folders, args.seed)
+        for name, data in (("tsv", tsv), ("bin", encode_binary(parse_tsv(tsv, "<generated>")))):
+            for shift in args.block_shift:
+                out = compress(data, shift)
+                start = time.perf_counter()
+                plain = decompress(out)
+                elapsed = time.perf_counter() - start
+                assert plain == data
+                print(f"{count:>8} {name:>6} {len(data):>8} {1 << shift:>6} "
+                      f"{len(out) / len(data):>6.3f} {len(zlib.compress(data, 9)) / len(data):>6.3f} "
+                      f"{len(data) / elapsed / 1e6:>12.2f}")
+
+
+def cmd_generate(args):
+    data = generate_tsv(args.count, args.name_len, args.malformed, args.folders, args.seed)
+    if args.binary:
+        data = encode_binary(parse_tsv(data, "<generated>"))
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"Wrote {args.count} records, {len(data)} bytes to {args.output}")
+
+
+def cmd_convert(args):
+    records = read_tsv(args.input)
+    data = encode_binary(records)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"Wrote {len(records)} records, {len(data)} bytes to {args.output}")
+
+
+def cmd_encrypt(args):
+    key = parse_key(args.key)
+    if args.per_record:
+        data = encrypt_split(read_tsv(args.input), key)
+    else:
+        with open(args.input, "rb") as f:
+            data = f.read()
+        if data.startswith(CRYPTO_MAGIC):
+            sys.exit(f"{args.input} is already encrypted")
+        data = encrypt(data, key)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"Wrote {len(data)} bytes to {args.output}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    convert = sub.add_parser("convert", help="convert a TSV vault to the binary format")
+    convert.add_argument("input", help="tab separated input file")
+    convert.add_argument("output", help="binary vault to write")
+    convert.set_defaults(func=cmd_convert)
+
+    enc = sub.add_parser("encrypt", help="encrypt a TSV or binary vault with AES-128-GCM")
+    enc.add_argument("input", help="vault to encrypt")
+    enc.add_argument("output", help="encrypted vault to write")
+    enc.add_argument("--key", default=DEFAULT_KEY,
+                     help="key as 32 hex characters, must match CONFIG_CRYPTO_UTIL_VAULT_KEY")
+    enc.add_argument("--per-record", action="store_true",
+                     help="encrypt each password separately; the input must be a TSV file")
+    enc.set_defaults(func=cmd_encrypt)
+
+    comp = sub.add_parser("compress", help="compress a TSV or binary vault, before encrypting it")
+    comp.add_argument("input", help="vault to compress")
+    comp.add_argument("output", help="compressed vault to write")
+    comp.add_argument("--block-shift", type=int, default=COMPRESS_BLOCK_SHIFT,
+                      help="log2 of the block size; blocks must fit CONFIG_COMPRESS_UTIL_BLOCK_MAX_LEN")
+    comp.set_defaults(func=cmd_compress)
+
+    delta = sub.add_parser("delta", help="make a patch turning the stored vault into a new one")
+    delta.add_argument("old", help="vault stored on the device")
+    delta.add_argument("new", help="vault to update it to")
+    delta.add_argument("output", help="patch to write")
+    delta.add_argument("--block-len", type=int, default=PATCH_BLOCK_LEN,
+                       help="shortest run of old bytes that is copied")
+    delta.set_defaults(func=cmd_delta)
+
+    bench = sub.add_parser("bench", help="measure compression ratio and decode speed on synthetic vaults")
+    bench.add_argument("--count", type=int, nargs="+", default=[100, 1000, 5000], help="numbers of records")
+    bench.add_argument("--block-shift", type=int, nargs="+", default=[8, 10], help="log2 of the block sizes")
+    bench.add_argument("--name-len", type=int, default=20, help="maximum account name length")
+    bench.add_argument("--folders", type=int, default=0, help="spread the accounts over this many folders")
+    bench.add_argument("--seed", type=int, default=0, help="seed, for reproducible vaults")
+    bench.set_defaults(func=cmd_bench)
+
+    gen = sub.add_parser("generate", help="write a synthetic vault for measuring the parser")
+    gen.add_argument("output", help="vault to write")
+    gen.add_argument("--count", type=int, default=1000, help="number of records")
+    gen.add_argument("--name-len", type=int, default=20, help="maximum account name length")
+    gen.add_argument("--malformed", type=float, default=0.0,
+                     help="fraction of extra malformed lines, TSV only")
+    gen.add_argument("--folders", type=int, default=0, help="spread the accounts over this many folders")
+    gen.add_argument("--binary", action="store_true", help="write the binary format instead of TSV")
+    gen.add_argument("--seed", type=int, default=0, help="seed, for reproducible vaults")
+    gen.set_defaults(func=cmd_generate)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
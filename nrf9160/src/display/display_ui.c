@@ -23,6 +23,17 @@ lv_style_t * style_list;
 
 lv_color_t nordic_blue = LV_COLOR_MAKE(0x7f,0xd4,0xe6);
 
+/* The lists only hold one page of the folders or platforms at a time */
+struct list_page {
+    uint32_t offset;
+    uint32_t count;
+    uint32_t total;
+    bool focus_last_on_load;
+};
+
+static struct list_page folder_page;
+static struct list_page platform_page;
+
 enum scr_index {
     SCR_NONE,
     SCR_WELCOME,
@@ -64,7 +75,7 @@ int get_scr_index(lv_obj_t* scr) {
 
 ///////////////////// COMPONENT BUILDING ////////////////////
 
-void generate_list(lv_obj_t *list, const char opts[CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM][CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN], const int num_opts)
+void generate_list(lv_obj_t *list, const char opts[CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM][CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN + 1], const int num_opts)
 {
     /*Create a list*/
     lv_list_clean(list);
@@ -93,44 +104,69 @@ void set_scr_platform_select(const char *folder_name)
     lv_group_add_obj(select_platform_list_group, select_platform_list);
 }
 
-void set_platform_list_contents(const char *platform_names)
+static void set_list_contents(lv_obj_t *list, struct list_page *page, const char *names,
+                              uint32_t offset, uint32_t total)
 {
-    lv_list_clean(select_platform_list);
-    /*Create a list*/
-    lv_obj_set_size(select_platform_list, DISP_WIDTH - 20, DISP_HEIGHT - 50);
-    lv_obj_align(select_platform_list, NULL, LV_ALIGN_IN_BOTTOM_MID, 0, -10);
-
-    static lv_style_t style_btn;
-    lv_style_init(&style_btn);
-    lv_style_set_bg_color(&style_btn, LV_BTN_STATE_DISABLED, nordic_blue);
-    lv_style_set_value_color(&style_btn, LV_BTN_STATE_DISABLED, LV_COLOR_WHITE);
-    /*Add buttons to the list*/
-    lv_obj_t *list_btn;
-
-    char opts[CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM][CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN];
+    char opts[CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM][CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN + 1];
     int num_opts = 0;
-    char* rest = (char*)platform_names;
+    char* rest = (char*)names;
     char* token = strtok_r(rest, "\t", &rest);
-    while (token != NULL)
+    while (token != NULL && num_opts < CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM)
     {
         strncpy(opts[num_opts], token, CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN);
+        opts[num_opts][CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN] = '\0';
         num_opts++;
-        if (num_opts > CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM) {
-            // LOG_ERR("Number of platform options exceed the maximum configurated value. Consider increasing CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM.");
-            break;
-        }
         token = strtok_r(NULL, "\t", &rest);
     }
-    generate_list(select_platform_list, opts, num_opts);
-    return;
+    generate_list(list, opts, num_opts);
+    page->offset = offset;
+    page->count = num_opts;
+    page->total = total;
+    /* Scrolling up into the previous page continues from its last entry */
+    if (page->focus_last_on_load) {
+        lv_list_focus_btn(list, lv_list_get_prev_btn(list, NULL));
+        page->focus_last_on_load = false;
+    }
 }
 
-    void set_scr_folder_select(const char *folder_opts[], const int num_opts)
+void set_platform_list_contents(const char *platform_names, uint32_t offset, uint32_t total)
 {
-    select_folder_list = lv_list_create(scr_select_folder, NULL);
-    // generate_list(select_folder_list, folder_opts, num_opts);
-    select_folder_list_group = lv_group_create();
-    lv_group_add_obj(select_folder_list_group, select_folder_list);
+    set_list_contents(select_platform_list, &platform_page, platform_names, offset, total);
+}
+
+void set_folder_list_contents(const char *folder_names, uint32_t offset, uint32_t total)
+{
+    set_list_contents(select_folder_list, &folder_page, folder_names, offset, total);
+}
+
+/* Moves the selection, or asks for the neighbouring page at either end of the list */
+static void scroll_list(lv_obj_t *list, lv_group_t *group, struct list_page *page,
+                        uint32_t btn_id, struct display_data *info)
+{
+    lv_obj_t *selected = lv_list_get_btn_selected(list);
+
+    if (btn_id == BTN_DOWN) {
+        if (selected == lv_list_get_prev_btn(list, NULL) &&
+            page->offset + page->count < page->total) {
+            info->offset = page->offset + page->count;
+        } else {
+            lv_group_send_data(group, LV_KEY_DOWN);
+        }
+    } else if (btn_id == BTN_UP) {
+        if (selected == lv_list_get_next_btn(list, NULL) && page->offset > 0) {
+            info->offset = page->offset > CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM ?
+                           page->offset - CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM : 0;
+            page->focus_last_on_load = true;
+        } else {
+            lv_group_send_data(group, LV_KEY_UP);
+        }
+    }
+}
+
+/* The folder screen is skipped for vaults without folders */
+static lv_obj_t *first_list_screen(void)
+{
+    return folder_page.total > 0 ? scr_select_folder : scr_select_platform;
 }
 
 ///////////////////// SCREENS ////////////////////
@@ -167,6 +203,9 @@ void build_pages(void)
     lv_label_set_align(select_folder_label, LV_LABEL_ALIGN_LEFT);
     lv_label_set_text(select_folder_label, "Folder select");
     lv_obj_align(select_folder_label, scr_select_folder, LV_ALIGN_IN_TOP_LEFT, 10, 10);
+    select_folder_list = lv_list_create(scr_select_folder, NULL);
+    select_folder_list_group = lv_group_create();
+    lv_group_add_obj(select_folder_list_group, select_folder_list);
 
     /* Platform select screen */
     scr_select_platform = lv_obj_create(NULL, NULL);
@@ -188,28 +227,31 @@ void lvgl_widgets_init(void) {
 
 
 ///////////////////// HW BUTTONS /////////////////////
-void hw_button_pressed(uint32_t btn_id) {
+struct display_data hw_button_pressed(uint32_t btn_id) {
+    struct display_data info = {
+        .id = DISPLAY_NO_DATA,
+        .data = "",
+        .offset = UINT32_MAX
+    };
     int scr_index = get_scr_index(lv_scr_act());
     switch (scr_index) {
         case SCR_WELCOME:
-            // change_screen(scr_select_folder, LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
-            change_screen(scr_select_platform, LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
+            change_screen(first_list_screen(), LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
         break;
         case SCR_SELECT_FOLDER:
-        if (btn_id == BTN_DOWN) {
-            lv_group_send_data(select_folder_list_group, LV_KEY_DOWN);
-        } else if (btn_id == BTN_UP) {
-            lv_group_send_data(select_folder_list_group, LV_KEY_UP);
+        scroll_list(select_folder_list, select_folder_list_group, &folder_page, btn_id, &info);
+        if (info.offset != UINT32_MAX) {
+            info.id = DISPLAY_FOLDER_PAGE_REQUESTED;
         }
         break;
         case SCR_SELECT_PLATFORM:
-        if (btn_id == BTN_DOWN) {
-            lv_group_send_data(select_platform_list_group, LV_KEY_DOWN);
-        } else if (btn_id == BTN_UP) {
-            lv_group_send_data(select_platform_list_group, LV_KEY_UP);
+        scroll_list(select_platform_list, select_platform_list_group, &platform_page, btn_id, &info);
+        if (info.offset != UINT32_MAX) {
+            info.id = DISPLAY_PAGE_REQUESTED;
         }
         break;
     }
+    return info;
 }
 
 struct display_data hw_button_long_pressed(uint32_t btn_id) {
@@ -220,18 +262,18 @@ struct display_data hw_button_long_pressed(uint32_t btn_id) {
     int scr_index = get_scr_index(lv_scr_act());
     switch (scr_index) {
         case SCR_WELCOME:
-            // change_screen(scr_select_folder, LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
-            change_screen(scr_select_platform, LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
+            change_screen(first_list_screen(), LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
         break;
         case SCR_SELECT_FOLDER:
         if (btn_id == BTN_UP) {
-            char* selected_folder = lv_label_get_text(lv_list_get_btn_label(lv_list_get_btn_selected(select_folder_list)));
-            if (!strcmp(selected_folder, "Welcome!")) {
-                change_screen(scr_welcome, LV_SCR_LOAD_ANIM_MOVE_RIGHT, 1000, 0);
-            } else {
-                // set_scr_platform_select(selected_folder);
-                change_screen(scr_select_platform, LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
+            lv_obj_t *selected = lv_list_get_btn_selected(select_folder_list);
+            if (selected == NULL) {
+                break;
             }
+            info.id = DISPLAY_FOLDER_CHOSEN;
+            strncpy(info.data, lv_label_get_text(lv_list_get_btn_label(selected)), CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN);
+            /* The password module answers with the first page of the folder */
+            change_screen(scr_select_platform, LV_SCR_LOAD_ANIM_MOVE_LEFT, 1000, 0);
         } else if (btn_id == BTN_DOWN) {
             change_screen(scr_welcome, LV_SCR_LOAD_ANIM_MOVE_RIGHT, 1000, 0);
         }
@@ -244,15 +286,40 @@ struct display_data hw_button_long_pressed(uint32_t btn_id) {
             strncpy(info.data, chosen_label, CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN);
             // info.data = lv_label_get_text(lv_list_get_btn_label(lv_list_get_btn_selected(select_platform_list)));
         } else if (btn_id == BTN_DOWN) {
-            // /* Go to the top of the list, change the screen */
-            // lv_list_focus_btn(select_folder_list, lv_list_get_next_btn(select_folder_list, NULL));
-            // change_screen(scr_select_folder, LV_SCR_LOAD_ANIM_MOVE_RIGHT, 1000, 0);
-
-            /*For now, support only single level structure*/
+            /* Go to the top of the list, change the screen */
             lv_list_focus_btn(select_platform_list, lv_list_get_next_btn(select_platform_list, NULL));
-            change_screen(scr_welcome, LV_SCR_LOAD_ANIM_MOVE_RIGHT, 1000, 0);
+            if (folder_page.total > 0) {
+                change_screen(scr_select_folder, LV_SCR_LOAD_ANIM_MOVE_RIGHT, 1000, 0);
+            } else {
+                change_screen(scr_welcome, LV_SCR_LOAD_ANIM_MOVE_RIGHT, 1000, 0);
+            }
         }
         break;
     }
     return info;
+}
+
+struct display_data hw_button_double_pressed(uint32_t btn_id) {
+    struct display_data info = {
+        .id = DISPLAY_NO_DATA,
+        .data = ""
+    };
+    lv_obj_t *selected;
+    int scr_index = get_scr_index(lv_scr_act());
+    switch (scr_index) {
+        case SCR_SELECT_PLATFORM:
+        /* Jump to the next or previous first letter */
+        selected = lv_list_get_btn_selected(select_platform_list);
+        if (selected == NULL) {
+            break;
+        }
+        info.id = DISPLAY_JUMP_REQUESTED;
+        info.offset = platform_page.offset + lv_list_get_btn_index(select_platform_list, selected);
+        info.direction = btn_id == BTN_DOWN ? 1 : -1;
+        break;
+        default:
+        info = hw_button_pressed(btn_id);
+        break;
+    }
+    return info;
 }
\ No newline at end of file
@@ -11,12 +11,20 @@ extern "C" {
 struct display_data {
 	uint8_t id;
 	char data[CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN];
+	/* First entry of the page to request, for the PAGE_REQUESTED types,
+	 * or the selected entry for DISPLAY_JUMP_REQUESTED */
+	uint32_t offset;
+	/* 1 to jump to the next first letter, -1 to the previous */
+	int8_t direction;
 };
 
 enum display_data_type {
     DISPLAY_NO_DATA,
     DISPLAY_FOLDER_CHOSEN,
-    DISPLAY_PLATFORM_CHOSEN
+    DISPLAY_PLATFORM_CHOSEN,
+    DISPLAY_PAGE_REQUESTED,
+    DISPLAY_FOLDER_PAGE_REQUESTED,
+    DISPLAY_JUMP_REQUESTED
 };
 
 enum btn_id_type {
@@ -25,9 +33,11 @@ enum btn_id_type {
 };
 
 void lvgl_widgets_init(void);
-void hw_button_pressed(uint32_t key_id);
+struct display_data hw_button_pressed(uint32_t key_id);
 struct display_data hw_button_long_pressed(uint32_t key_id);
-void set_platform_list_contents(const char *platform_names);
+struct display_data hw_button_double_pressed(uint32_t key_id);
+void set_platform_list_contents(const char *platform_names, uint32_t offset, uint32_t total);
+void set_folder_list_contents(const char *folder_names, uint32_t offset, uint32_t total);
 
 #ifdef __cplusplus
 } /*extern "C"*/
@@ -38,6 +38,10 @@ static char *get_evt_type_str(enum cloud_module_event_type type)
 		return "CLOUD_EVT_LTE_DISCONNECTED";
 	case (CLOUD_EVT_DATABASE_UPDATE_AVAILABLE):
 		return "CLOUD_EVT_DATABASE_UPDATE_AVAILABLE";
+	case (CLOUD_EVT_DATABASE_DELTA_AVAILABLE):
+		return "CLOUD_EVT_DATABASE_DELTA_AVAILABLE";
+	case (CLOUD_EVT_DATABASE_DIGEST_AVAILABLE):
+		return "CLOUD_EVT_DATABASE_DIGEST_AVAILABLE";
 	case (CLOUD_EVT_NEW_LOCK_TIMEOUT):
 		return "CLOUD_EVT_NEW_LOCK_TIMEOUT";
 	default:
@@ -52,7 +56,10 @@ static int log_event(const struct event_header *eh, char *buf,
 	switch (event->type)
 	{
 	case CLOUD_EVT_DATABASE_UPDATE_AVAILABLE:
+	case CLOUD_EVT_DATABASE_DELTA_AVAILABLE:
 		return snprintf(buf, buf_len, "%s: URL %s", get_evt_type_str(event->type), event->data.url);
+	case CLOUD_EVT_DATABASE_DIGEST_AVAILABLE:
+		return snprintf(buf, buf_len, "%s: SHA-256 %s", get_evt_type_str(event->type), event->data.digest);
 	default:
 		return snprintf(buf, buf_len, "%s", get_evt_type_str(event->type));
 	}
@@ -26,6 +26,9 @@ extern "C"
 #define URL_MAX_LEN 10
 #endif
 
+/* Length of a SHA-256 digest as hex characters */
+#define CLOUD_DIGEST_HEX_LEN 64
+
 /** @brief Cloud event types submitted by Cloud module. */
 enum cloud_module_event_type
 {
@@ -42,6 +45,9 @@ enum cloud_module_event_type
 	CLOUD_EVT_LTE_CONNECTED,
 	CLOUD_EVT_LTE_DISCONNECTED,
 	CLOUD_EVT_DATABASE_UPDATE_AVAILABLE,
+	CLOUD_EVT_DATABASE_DELTA_AVAILABLE,
+	/* SHA-256 of the next database update as hex characters, in digest */
+	CLOUD_EVT_DATABASE_DIGEST_AVAILABLE,
 	CLOUD_EVT_NEW_LOCK_TIMEOUT,
 };
 
@@ -65,6 +71,7 @@ struct cloud_module_event
 		int err;
 		uint32_t timeout;
 		char url[URL_MAX_LEN];
+		char digest[CLOUD_DIGEST_HEX_LEN + 1];
 	} data;
 };
 
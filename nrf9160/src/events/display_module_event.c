@@ -15,6 +15,12 @@ static char *get_evt_type_str(enum display_module_event_type type)
 		return "DISPLAY_EVT_PLATFORM_CHOSEN";
 	case DISPLAY_EVT_REQUEST_PLATFORMS:
 		return "DISPLAY_EVT_REQUEST_PLATFORMS";
+	case DISPLAY_EVT_FOLDER_CHOSEN:
+		return "DISPLAY_EVT_FOLDER_CHOSEN";
+	case DISPLAY_EVT_REQUEST_FOLDERS:
+		return "DISPLAY_EVT_REQUEST_FOLDERS";
+	case DISPLAY_EVT_JUMP_PLATFORMS:
+		return "DISPLAY_EVT_JUMP_PLATFORMS";
 	case DISPLAY_EVT_ERROR: 
 		return "DISPLAY_EVT_ERROR";
 	default:
@@ -30,7 +36,17 @@ static int log_event(const struct event_header *eh, char *buf,
 		case DISPLAY_EVT_ERROR:
 			return snprintf(buf, buf_len, "%s - Error code %d",
 							get_evt_type_str(event->type), event->data.err);
+		case DISPLAY_EVT_REQUEST_PLATFORMS:
+		case DISPLAY_EVT_REQUEST_FOLDERS:
+			return snprintf(buf, buf_len, "%s: %d from %d",
+							get_evt_type_str(event->type), event->data.page.count,
+							event->data.page.offset);
+		case DISPLAY_EVT_JUMP_PLATFORMS:
+			return snprintf(buf, buf_len, "%s: %d from %d, prefix %s",
+							get_evt_type_str(event->type), event->data.jump.direction,
+							event->data.jump.from, event->data.jump.prefix);
 		case DISPLAY_EVT_PLATFORM_CHOSEN:
+		case DISPLAY_EVT_FOLDER_CHOSEN:
 			return snprintf(buf, buf_len, "%s: %s",
 							get_evt_type_str(event->type), event->data.choice);
 		default:
@@ -28,9 +28,27 @@ extern "C" {
 enum display_module_event_type {
 	DISPLAY_EVT_PLATFORM_CHOSEN,
 	DISPLAY_EVT_REQUEST_PLATFORMS,
+	DISPLAY_EVT_FOLDER_CHOSEN,
+	DISPLAY_EVT_REQUEST_FOLDERS,
+	DISPLAY_EVT_JUMP_PLATFORMS,
 	DISPLAY_EVT_ERROR,
 };
 
+/** @brief Window of the platform or folder list to request. */
+struct display_page_request {
+	uint32_t offset;
+	uint8_t count;
+};
+
+/** @brief Jump in the platform list, to a prefix or to the next or previous first letter. */
+struct display_jump {
+	/* Position of the selected platform in the list */
+	uint32_t from;
+	/* 1 for the next first letter, -1 for the previous, 0 for prefix */
+	int8_t direction;
+	char prefix[CHOICE_LEN];
+};
+
 /** @brief Display event. */
 struct display_module_event {
 	struct event_header header;
@@ -38,6 +56,8 @@ struct display_module_event {
 
 	union {
 		char choice[CHOICE_LEN];
+		struct display_page_request page;
+		struct display_jump jump;
 		/* Module ID, used when acknowledging shutdown requests. */
 		uint32_t id;
 		int err;
@@ -26,6 +26,9 @@ extern "C"
 		DOWNLOAD_EVT_REQ_DOWNLOAD,
 		DOWNLOAD_EVT_DOWNLOAD_STARTED,
 		DOWNLOAD_EVT_DOWNLOAD_FINISHED,
+		/* The stored file already has the digest the shadow gives for
+		 * the update, so it is not downloaded */
+		DOWNLOAD_EVT_DOWNLOAD_SKIPPED,
 		DOWNLOAD_EVT_ERROR,
 		DOWNLOAD_EVT_STORAGE_ERROR,
 	};
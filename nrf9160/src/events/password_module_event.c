@@ -16,6 +16,8 @@ static char *get_evt_type_str(enum password_module_event_type type)
 		return "PASSWORD_EVT_ERROR";
 	case PASSWORD_EVT_READ_PLATFORMS:
 		return "PASSWORD_EVT_READ_PLATFORMS";
+	case PASSWORD_EVT_READ_FOLDERS:
+		return "PASSWORD_EVT_READ_FOLDERS";
 	case PASSWORD_EVT_READ_CHOSEN_PASSWORD:
 		return "PASSWORD_EVT_READ_CHOSEN_PASSWORD";
 	default:
@@ -30,7 +32,10 @@ static int log_event(const struct event_header *eh, char *buf,
 	switch (event->type)
 	{
 	case PASSWORD_EVT_READ_PLATFORMS:
-		return snprintf(buf, buf_len, "%s: Platforms %s", get_evt_type_str(event->type), event->data.entries);
+	case PASSWORD_EVT_READ_FOLDERS:
+		return snprintf(buf, buf_len, "%s: %d-%d of %d: %s", get_evt_type_str(event->type),
+						event->data.page.offset, event->data.page.offset + event->data.page.count,
+						event->data.page.total, event->data.page.entries);
 	default:
 		return snprintf(buf, buf_len, "%s", get_evt_type_str(event->type));
 	}
@@ -26,11 +26,25 @@ extern "C"
 #define ENTRIES_MAX_LEN 10
 #endif
 
+	/** @brief One page of the platform or folder list. */
+	struct password_page
+	{
+		/* Position of the first name in the whole list */
+		uint32_t offset;
+		/* Number of platforms in the whole list */
+		uint32_t total;
+		/* Number of names in this page */
+		uint8_t count;
+		/* Tab separated names */
+		char entries[ENTRIES_MAX_LEN];
+	};
+
 	/** @brief Password event types submitted by Password module. */
 	enum password_module_event_type
 	{
         PASSWORD_EVT_ERROR,
         PASSWORD_EVT_READ_PLATFORMS,
+        PASSWORD_EVT_READ_FOLDERS,
         PASSWORD_EVT_READ_CHOSEN_PASSWORD,
 	};
 
@@ -45,7 +59,7 @@ extern "C"
 			/* Module ID, used when acknowledging shutdown requests. */
 			uint32_t id;
 			int err;
-			char entries[ENTRIES_MAX_LEN];
+			struct password_page page;
 		} data;
 	};
 
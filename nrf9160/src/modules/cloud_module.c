@@ -22,6 +22,11 @@
 #include "events/download_module_event.h"
 #include "events/modem_module_event.h"
 #include "util/cjson_util.h"
+#include "util/file_util.h"
+#include "util/download_stats.h"
+#if defined(CONFIG_JOURNAL_UTIL)
+#include "util/journal_util.h"
+#endif
 
 #define MODULE cloud_module
 
@@ -86,6 +91,8 @@ static struct module_data self = {
 /* Forward declarations. */
 static void connect_check_work_fn(struct k_work *work);
 static void send_config_received(void);
+static int add_storage_stats(cJSON *delta);
+static int add_download_stats(cJSON *delta);
 
 /* Convenience functions used in internal state handling. */
 static char *state2str(enum state_type state)
@@ -305,6 +312,7 @@ static K_WORK_DELAYABLE_DEFINE(submit_shadow_update_work, submit_shadow_update_w
  */
 static void handle_password_download_failed(void)
 {
+	add_download_stats(NULL);
 	lock_shadow_response();
 	cJSON *root = shadow_response_root;
 	cJSON *state_obj = cJSON_GetOrAddObjectItemCS(root, "state");
@@ -321,6 +329,8 @@ static void handle_password_download_failed(void)
  */
 static void handle_password_download_complete(void)
 {
+	add_storage_stats(NULL);
+	add_download_stats(NULL);
 	lock_shadow_response();
 	cJSON *root = shadow_response_root;
 	cJSON *state_obj = cJSON_GetOrAddObjectItemCS(root, "state");
@@ -356,6 +366,35 @@ static int handle_password_delta(cJSON *delta)
 	cJSON *password_delta = cJSON_GetObjectItemCaseSensitive(skykey_delta, "databaseLocation");
 	if (password_delta != NULL && password_delta->type == cJSON_String)
 	{
+		/* A patch against the stored file is tried first, the download
+		 * module falls back to the full file if it cannot be applied */
+		cJSON *patch_delta = cJSON_GetObjectItemCaseSensitive(skykey_delta, "databaseDeltaLocation");
+		if (patch_delta != NULL && patch_delta->type == cJSON_String)
+		{
+			struct cloud_module_event *patch_evt = new_cloud_module_event();
+			patch_evt->type = CLOUD_EVT_DATABASE_DELTA_AVAILABLE;
+			strncpy(patch_evt->data.url, patch_delta->valuestring, sizeof(patch_evt->data.url));
+			patch_evt->data.url[sizeof(patch_evt->data.url) - 1] = '\0';
+			EVENT_SUBMIT(patch_evt);
+		}
+		/* Like the patch, the digest applies to the update that follows it */
+		cJSON *digest_delta = cJSON_GetObjectItemCaseSensitive(skykey_delta, "databaseSha256");
+		if (digest_delta != NULL && digest_delta->type == cJSON_String)
+		{
+			struct cloud_module_event *digest_evt = new_cloud_module_event();
+			size_t len = strlen(digest_delta->valuestring);
+			/* A longer value is not cut to digest length, but to a length no
+			 * digest has, so the download module rejects the update */
+			if (len > CLOUD_DIGEST_HEX_LEN)
+			{
+				LOG_ERR("databaseSha256 is too long for a SHA-256 digest");
+				len = 1;
+			}
+			digest_evt->type = CLOUD_EVT_DATABASE_DIGEST_AVAILABLE;
+			memcpy(digest_evt->data.digest, digest_delta->valuestring, len);
+			digest_evt->data.digest[len] = '\0';
+			EVENT_SUBMIT(digest_evt);
+		}
 		struct cloud_module_event *evt = new_cloud_module_event();
 		evt->type = CLOUD_EVT_DATABASE_UPDATE_AVAILABLE;
 		strncpy(evt->data.url, password_delta->valuestring, sizeof(evt->data.url));
@@ -388,6 +427,10 @@ static int handle_lock_timeout_delta(cJSON *delta)
 		evt->type = CLOUD_EVT_NEW_LOCK_TIMEOUT;
 		evt->data.timeout = lock_timeout_delta->valueint;
 		EVENT_SUBMIT(evt);
+#if defined(CONFIG_JOURNAL_UTIL)
+		uint32_t timeout = lock_timeout_delta->valueint;
+		journal_record("lock_timeout", &timeout, sizeof(timeout));
+#endif
 		// TODO: Get confirmation from the lock module. This should be done in a separate function.
 		// HACK: For now we just assume the lock module accepted the timeout.
 		lock_shadow_response();
@@ -423,6 +466,100 @@ static int add_device_status(cJSON *delta)
 	return 0;
 }
 
+/**
+ * @brief Adds the storage counters to the shadow response, if enabled with
+ * CONFIG_CLOUD_REPORT_STORAGE_STATS.
+ * 
+ * @param delta UNUSED
+ * @return 0 on success, negative errno otherwise.
+ */
+static int add_storage_stats(cJSON *delta)
+{
+	ARG_UNUSED(delta);
+	if (!IS_ENABLED(CONFIG_CLOUD_REPORT_STORAGE_STATS))
+	{
+		return 0;
+	}
+	struct file_stats stats;
+	file_stats_get(&stats);
+
+	lock_shadow_response();
+	cJSON *root = shadow_response_root;
+	cJSON *state_obj = cJSON_GetOrAddObjectItemCS(root, "state");
+	cJSON *reported_obj = cJSON_GetOrAddObjectItemCS(state_obj, "reported");
+	cJSON *dev_obj = cJSON_GetOrAddObjectItemCS(reported_obj, "dev");
+	/* Replace the counters of an update that has not been sent yet */
+	cJSON_DeleteItemFromObjectCaseSensitive(dev_obj, "storage");
+	cJSON *storage_obj = cJSON_AddObjectToObjectCS(dev_obj, "storage");
+	cJSON_AddNumberToObjectCS(storage_obj, "mountUs", stats.mount_us);
+	cJSON_AddNumberToObjectCS(storage_obj, "read", stats.bytes_read);
+	cJSON_AddNumberToObjectCS(storage_obj, "written", stats.bytes_written);
+	cJSON_AddNumberToObjectCS(storage_obj, "writes", stats.writes);
+	cJSON_AddNumberToObjectCS(storage_obj, "writeMaxUs", stats.write_us_max);
+	cJSON_AddNumberToObjectCS(storage_obj, "erases", stats.erases);
+	cJSON *hist = cJSON_CreateArray();
+	for (int i = 0; hist != NULL && i < FILE_STATS_HIST_LEN; i++)
+	{
+		cJSON_AddItemToArray(hist, cJSON_CreateNumber(stats.write_hist[i]));
+	}
+	cJSON_AddItemToObjectCS(storage_obj, "writeHist", hist);
+	release_shadow_response();
+	return 0;
+}
+
+/**
+ * @brief Adds the metrics of the last downloads, newest first, to the shadow
+ * response, if enabled with CONFIG_CLOUD_REPORT_DOWNLOAD_STATS.
+ * 
+ * @param delta UNUSED
+ * @return 0 on success, negative errno otherwise.
+ */
+static int add_download_stats(cJSON *delta)
+{
+	ARG_UNUSED(delta);
+#if defined(CONFIG_CLOUD_REPORT_DOWNLOAD_STATS)
+	static struct download_stats stats[CONFIG_DOWNLOAD_STATS_HISTORY];
+	int count = download_stats_get(stats, ARRAY_SIZE(stats));
+
+	lock_shadow_response();
+	cJSON *root = shadow_response_root;
+	cJSON *state_obj = cJSON_GetOrAddObjectItemCS(root, "state");
+	cJSON *reported_obj = cJSON_GetOrAddObjectItemCS(state_obj, "reported");
+	cJSON *dev_obj = cJSON_GetOrAddObjectItemCS(reported_obj, "dev");
+	/* Replace the metrics of an update that has not been sent yet */
+	cJSON_DeleteItemFromObjectCaseSensitive(dev_obj, "download");
+	cJSON *downloads = cJSON_CreateArray();
+	for (int i = 0; downloads != NULL && i < count; i++)
+	{
+		cJSON *dl_obj = cJSON_CreateObject();
+		if (dl_obj == NULL)
+		{
+			break;
+		}
+		cJSON_AddNumberToObjectCS(dl_obj, "result", stats[i].result);
+		cJSON_AddNumberToObjectCS(dl_obj, "size", stats[i].size);
+		cJSON_AddNumberToObjectCS(dl_obj, "transferred", stats[i].transferred);
+		cJSON_AddNumberToObjectCS(dl_obj, "connectMs", stats[i].connect_ms);
+		cJSON_AddNumberToObjectCS(dl_obj, "ttfbMs", stats[i].ttfb_ms);
+		cJSON_AddNumberToObjectCS(dl_obj, "durationMs", stats[i].duration_ms);
+		cJSON_AddNumberToObjectCS(dl_obj, "bps", stats[i].throughput);
+		cJSON_AddNumberToObjectCS(dl_obj, "retries", stats[i].retries);
+		cJSON_AddNumberToObjectCS(dl_obj, "rsrp", stats[i].rsrp_dbm);
+		cJSON_AddNumberToObjectCS(dl_obj, "fragSize", stats[i].frag_size);
+		cJSON *hist = cJSON_CreateArray();
+		for (int j = 0; hist != NULL && j < DOWNLOAD_STATS_HIST_LEN; j++)
+		{
+			cJSON_AddItemToArray(hist, cJSON_CreateNumber(stats[i].frag_hist[j]));
+		}
+		cJSON_AddItemToObjectCS(dl_obj, "fragHist", hist);
+		cJSON_AddItemToArray(downloads, dl_obj);
+	}
+	cJSON_AddItemToObjectCS(dev_obj, "download", downloads);
+	release_shadow_response();
+#endif
+	return 0;
+}
+
 /**
  * @brief Delta handler pipeline. Functions here will get called in order with the delta and response as arguments.
  * Functions should return 0 on success, negative errno otherwise.
@@ -431,8 +568,12 @@ static shadow_delta_handler_t shadow_delta_handlers[] = {
 	handle_password_delta,
 	handle_lock_timeout_delta,
 	add_device_status,
+	add_storage_stats,
+	add_download_stats,
 };
 
+static int64_t last_handled_shadow; // Timestamp of last accepted shadow, kept over resets.
+
 /**
  * @brief Updates AWS device shadow.
  * 
@@ -442,7 +583,6 @@ static shadow_delta_handler_t shadow_delta_handlers[] = {
  */
 static int update_shadow(cJSON *delta, int64_t timestamp)
 {
-	static uint64_t last_handled_shadow = 0; // Timestamp of last accepted shadow.
 	if (timestamp < last_handled_shadow)
 	{
 		// More recent shadow received. Do nothing.
@@ -457,6 +597,9 @@ static int update_shadow(cJSON *delta, int64_t timestamp)
 	release_shadow_response();
 
 	last_handled_shadow = timestamp;
+#if defined(CONFIG_JOURNAL_UTIL)
+	journal_record("shadow_ts", &last_handled_shadow, sizeof(last_handled_shadow));
+#endif
 
 	for (int i = 0; i < sizeof(shadow_delta_handlers) / sizeof(shadow_delta_handlers[0]); i++)
 	{
@@ -559,7 +702,8 @@ static void on_cloud_state_cloud_connected(struct cloud_msg_data *msg)
 		handle_password_download_failed();
 	}
 
-	if (IS_EVENT(msg, download, DOWNLOAD_EVT_DOWNLOAD_FINISHED))
+	if (IS_EVENT(msg, download, DOWNLOAD_EVT_DOWNLOAD_FINISHED) ||
+		IS_EVENT(msg, download, DOWNLOAD_EVT_DOWNLOAD_SKIPPED))
 	{
 		handle_password_download_complete();
 	}
@@ -660,6 +804,7 @@ static void aws_iot_evt_handler(const struct aws_iot_evt *evt)
 	{
 		LOG_DBG("Connected to AWS");
 		cloud_state_set(CLOUD_STATE_CLOUD_CONNECTED);
+		SEND_EVENT(cloud, CLOUD_EVT_CONNECTED);
 		break;
 	}
 	case AWS_IOT_EVT_DISCONNECTED:
@@ -752,6 +897,27 @@ static int cloud_configure(void)
 	return 0;
 }
 
+#if defined(CONFIG_JOURNAL_UTIL)
+/**
+ * @brief Restores the state kept over the last reset, so it applies before
+ * the shadow is fetched again.
+ */
+static void restore_state(void)
+{
+	uint32_t timeout;
+
+	journal_get("shadow_ts", &last_handled_shadow, sizeof(last_handled_shadow));
+	if (journal_get("lock_timeout", &timeout, sizeof(timeout)) == sizeof(timeout))
+	{
+		struct cloud_module_event *evt = new_cloud_module_event();
+		evt->type = CLOUD_EVT_NEW_LOCK_TIMEOUT;
+		evt->data.timeout = timeout;
+		EVENT_SUBMIT(evt);
+	}
+	LOG_DBG("Restored shadow timestamp %u", (uint32_t)last_handled_shadow);
+}
+#endif
+
 /**
  * @brief Setup function for the module. Initializes modem and AWS connection.
  * 
@@ -780,6 +946,9 @@ static int setup(void)
 	{
 		return -ENOMEM;
 	}
+#if defined(CONFIG_JOURNAL_UTIL)
+	restore_state();
+#endif
 	return 0;
 }
 
@@ -81,6 +81,17 @@ static bool event_handler(const struct event_header *eh)
     return false;
 }
 
+static void request_page(enum display_module_event_type type, uint32_t offset)
+{
+	struct display_module_event *display_module_event =
+		new_display_module_event();
+
+	display_module_event->type = type;
+	display_module_event->data.page.offset = offset;
+	display_module_event->data.page.count = CONFIG_DISPLAY_LIST_ENTRY_MAX_NUM;
+	EVENT_SUBMIT(display_module_event);
+}
+
 int setup(void) {
 	int err = 0;
 	const struct device *display_dev;
@@ -94,11 +105,8 @@ int setup(void) {
 		LOG_ERR("Display blanking error: %d", err);
 	}
 	lvgl_widgets_init();
-	struct display_module_event *display_module_event =
-		new_display_module_event();
-
-	display_module_event->type = DISPLAY_EVT_REQUEST_PLATFORMS;
-	EVENT_SUBMIT(display_module_event);
+	request_page(DISPLAY_EVT_REQUEST_FOLDERS, 0);
+	request_page(DISPLAY_EVT_REQUEST_PLATFORMS, 0);
 	return 0;
 }
 
@@ -126,25 +134,51 @@ static void module_thread_fn(void)
 		if (!err) {
 			if (IS_EVENT((&msg), password, PASSWORD_EVT_READ_PLATFORMS)) {
 				LOG_WRN("PASSWORD_EVT_READ_PLATFORMS");
-				set_platform_list_contents((const char*)msg.module.password.data.entries);
+				const struct password_page *page = &msg.module.password.data.page;
+				set_platform_list_contents(page->entries, page->offset, page->total);
+			} else if (IS_EVENT((&msg), password, PASSWORD_EVT_READ_FOLDERS)) {
+				const struct password_page *page = &msg.module.password.data.page;
+				set_folder_list_contents(page->entries, page->offset, page->total);
 			} else { // TODO: find better way to check if it is click module
 				if (msg.module.btn.click == CLICK_LONG)
 				{
 					const struct display_data feedback =
 						hw_button_long_pressed(msg.module.btn.key_id);
-					if (feedback.id == DISPLAY_PLATFORM_CHOSEN)
+					if (feedback.id == DISPLAY_PLATFORM_CHOSEN ||
+					    feedback.id == DISPLAY_FOLDER_CHOSEN)
 					{
 						struct display_module_event *display_module_event =
 							new_display_module_event();
 
 						strncpy(display_module_event->data.choice, feedback.data, CONFIG_DISPLAY_LIST_ENTRY_MAX_LEN);
-						display_module_event->type = DISPLAY_EVT_PLATFORM_CHOSEN;
+						display_module_event->type = feedback.id == DISPLAY_PLATFORM_CHOSEN ?
+							DISPLAY_EVT_PLATFORM_CHOSEN : DISPLAY_EVT_FOLDER_CHOSEN;
 						EVENT_SUBMIT(display_module_event);
 					}
 				}
 				else
 				{
-					hw_button_pressed(msg.module.btn.key_id);
+					const struct display_data feedback = msg.module.btn.click == CLICK_DOUBLE ?
+						hw_button_double_pressed(msg.module.btn.key_id) :
+						hw_button_pressed(msg.module.btn.key_id);
+					if (feedback.id == DISPLAY_JUMP_REQUESTED)
+					{
+						struct display_module_event *display_module_event =
+							new_display_module_event();
+
+						display_module_event->type = DISPLAY_EVT_JUMP_PLATFORMS;
+						display_module_event->data.jump.from = feedback.offset;
+						display_module_event->data.jump.direction = feedback.direction;
+						EVENT_SUBMIT(display_module_event);
+					}
+					else if (feedback.id == DISPLAY_PAGE_REQUESTED)
+					{
+						request_page(DISPLAY_EVT_REQUEST_PLATFORMS, feedback.offset);
+					}
+					else if (feedback.id == DISPLAY_FOLDER_PAGE_REQUESTED)
+					{
+						request_page(DISPLAY_EVT_REQUEST_FOLDERS, feedback.offset);
+					}
 				}
 			}
 		}
@@ -12,12 +12,22 @@
 #include <device.h>
 
 #include <net/download_client.h>
+#include <modem/modem_info.h>
 
 #include <drivers/flash.h>
 #include <settings/settings.h>
 #include <storage/stream_flash.h>
+#include <sys/ring_buffer.h>
 
 #include "util/file_util.h"
+#include "util/parse_util.h"
+#include "util/crypto_util.h"
+#include "util/compress_util.h"
+#include "util/patch_util.h"
+#include "util/download_stats.h"
+#if defined(CONFIG_JOURNAL_UTIL)
+#include "util/journal_util.h"
+#endif
 
 #include "events/download_module_event.h"
 #include "events/cloud_module_event.h"
@@ -66,6 +76,67 @@ static struct download_client_cfg dl_client_cfg = {
 
 static bool first_fragment;
 static int socket_retries_left;
+static size_t data_received;
+static size_t data_stored;      /* Bytes through the storage stages */
+static size_t file_size;
+static char active_url[URL_MAX_LEN];    /* URL of the current download */
+static bool resuming;           /* No fragment received since resuming */
+static int resume_attempts;     /* Resumes since the last fragment */
+static size_t bytes_transferred; /* Including bytes received again after errors */
+
+static void resume_work_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(resume_work, resume_work_fn);
+
+static struct download_stats metrics;   /* Metrics of the current download */
+static int64_t request_time;    /* Uptime when the file was requested */
+static int64_t first_byte_time; /* Uptime of the first fragment, 0 before it */
+
+/* Delay before the full file is downloaded when a patch could not be used */
+#define FALLBACK_DELAY_MS 500
+
+static char full_url[URL_MAX_LEN];
+static char delta_url[URL_MAX_LEN];
+static char digest_hex[CLOUD_DIGEST_HEX_LEN + 1];       /* Digest for the next update, empty if none */
+static bool downloading_delta;  /* The current download may be a patch */
+static bool applying_patch;     /* The current download is a patch and the base is open */
+static struct patch_stream patch;
+
+static uint8_t expected_digest[CRYPTO_DIGEST_LEN];
+static bool check_digest;       /* The shadow gave a digest for this download */
+static bool digest_started;
+static struct crypto_digest digest;
+static uint8_t hash_buf[256];   /* Stored bytes read back to be hashed */
+
+static void fallback_work_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(fallback_work, fallback_work_fn);
+
+/* Outcome of the last download, kept over resets */
+struct download_status
+{
+	int32_t result;
+	uint32_t size;
+	uint8_t digest[CRYPTO_DIGEST_LEN];
+};
+
+#if defined(CONFIG_DOWNLOAD_CHECKPOINTS)
+#define CHECKPOINT_KEY "download/checkpoint"
+
+/* Progress of a download, saved so it can be continued after a reset */
+struct download_checkpoint
+{
+	char url[URL_MAX_LEN];
+	uint32_t file_size;
+	uint32_t offset;            /* Bytes of the staged file that are kept */
+	uint8_t digest[CRYPTO_DIGEST_LEN];
+	bool check_digest;
+};
+
+static struct download_checkpoint checkpoint;
+static bool checkpoint_loaded;  /* Saved before the reset, not resumed yet */
+static bool checkpoint_active;  /* Checkpoints are saved for the current download */
+static bool checkpoint_saved;   /* Saved for the current download */
+static size_t next_checkpoint;
+#endif
 
 static char *state2str(enum state_type new_state)
 {
@@ -94,38 +165,658 @@ static void state_set(enum state_type new_state)
 	module_state = new_state;
 }
 
-static int download_connect_and_start(const char* url) 
+/**
+ * @brief RSRP of the serving cell in dBm, 0 if it is not known.
+ */
+static int16_t read_rsrp(void)
+{
+	uint16_t raw;
+	int err = modem_info_short_get(MODEM_INFO_RSRP, &raw);
+
+	/* Values above 97 mean the RSRP is not known */
+	if (err < 0 || raw > 97) {
+		return 0;
+	}
+	return raw - 140;
+}
+
+#if defined(CONFIG_DOWNLOAD_FRAG_SIZE_ADAPTIVE)
+BUILD_ASSERT(CONFIG_DOWNLOAD_FRAG_RSRP_STRONG > CONFIG_DOWNLOAD_FRAG_RSRP_WEAK);
+BUILD_ASSERT(CONFIG_DOWNLOAD_FRAG_SIZE_MAX >= CONFIG_DOWNLOAD_FRAG_SIZE_MIN);
+#endif
+
+/**
+ * @brief Choose the fragment size for a download on a link with the given
+ * RSRP: large fragments save round trips on strong links, small ones lose
+ * less to dropped connections on weak links. The size is rounded down to
+ * whole storage write blocks.
+ *
+ * @return Fragment size in bytes, 0 for the download client default.
+ */
+static size_t choose_frag_size(int16_t rsrp)
+{
+#if defined(CONFIG_DOWNLOAD_FRAG_SIZE_ADAPTIVE)
+	const int strong = CONFIG_DOWNLOAD_FRAG_RSRP_STRONG;
+	const int weak = CONFIG_DOWNLOAD_FRAG_RSRP_WEAK;
+	size_t block = file_write_block_size();
+	size_t size;
+
+	if (rsrp == 0) {
+		return 0;
+	}
+	if (rsrp >= strong) {
+		size = CONFIG_DOWNLOAD_FRAG_SIZE_MAX;
+	} else if (rsrp <= weak) {
+		size = CONFIG_DOWNLOAD_FRAG_SIZE_MIN;
+	} else {
+		size = CONFIG_DOWNLOAD_FRAG_SIZE_MIN +
+		       (CONFIG_DOWNLOAD_FRAG_SIZE_MAX - CONFIG_DOWNLOAD_FRAG_SIZE_MIN) *
+		       (rsrp - weak) / (strong - weak);
+	}
+	if (size >= block) {
+		size = ROUND_DOWN(size, block);
+	}
+	return size;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * @brief Start collecting the metrics of a new download, and choose its
+ * fragment size from the RSRP.
+ */
+static void start_metrics(void)
+{
+	memset(&metrics, 0, sizeof(metrics));
+	metrics.rsrp_dbm = read_rsrp();
+	dl_client_cfg.frag_size_override = choose_frag_size(metrics.rsrp_dbm);
+	metrics.frag_size = dl_client_cfg.frag_size_override;
+	first_byte_time = 0;
+	LOG_DBG("RSRP %d dBm, fragment size %d", metrics.rsrp_dbm, metrics.frag_size);
+}
+
+/**
+ * @brief Time the first fragment of a download and count every fragment
+ * in the size histogram.
+ */
+static void measure_fragment(size_t len)
+{
+	if (first_byte_time == 0) {
+		first_byte_time = k_uptime_get();
+		metrics.ttfb_ms = first_byte_time - request_time;
+	}
+	download_stats_fragment(&metrics, len);
+}
+
+/**
+ * @brief Complete the metrics of the current download and add them to the
+ * download history.
+ */
+static void finish_metrics(int result)
 {
+	metrics.result = result;
+	metrics.size = file_size;
+	metrics.transferred = bytes_transferred;
+	if (first_byte_time != 0) {
+		metrics.duration_ms = k_uptime_get() - first_byte_time;
+	}
+	if (metrics.duration_ms > 0) {
+		metrics.throughput = (uint64_t)bytes_transferred * MSEC_PER_SEC / metrics.duration_ms;
+	}
+	LOG_INF("Connect %d ms, first byte %d ms, %d B/s, %d retries",
+		metrics.connect_ms, metrics.ttfb_ms, metrics.throughput, metrics.retries);
+#if defined(CONFIG_DOWNLOAD_STATS)
+	download_stats_add(&metrics);
+#endif
+}
+
+static int download_connect_and_start(const char* url, size_t offset) 
+{
+	if (url != active_url) {
+		strncpy(active_url, url, sizeof(active_url));
+		active_url[sizeof(active_url) - 1] = '\0';
+	}
+	int64_t start = k_uptime_get();
     int err = download_client_connect(&dl_client, url, &dl_client_cfg);
 	if (err) {
 		return err;
 	}
+	/* Only the first connection of a download is timed */
+	if (metrics.connect_ms == 0) {
+		metrics.connect_ms = k_uptime_get() - start;
+	}
 
-	err = download_client_start(&dl_client, url, 0);
+	err = download_client_start(&dl_client, url, offset);
 	if (err) {
 		return err;
 	}
+	if (first_byte_time == 0) {
+		request_time = k_uptime_get();
+	}
 
 	socket_retries_left = CONFIG_DOWNLOAD_SOCKET_RETRIES;
     state_set(STATE_DOWNLOADING);
 	return err;
 }
 
-static int handle_file_fragment(const void * const fragment, size_t frag_size, size_t file_size)
+/**
+ * @brief Keep the outcome of the download in the journal, and its metrics
+ * in the download history.
+ */
+static void record_status(int result)
+{
+	finish_metrics(result);
+#if defined(CONFIG_JOURNAL_UTIL)
+	struct download_status status = {
+		.result = result,
+		.size = file_size,
+	};
+	if (check_digest) {
+		memcpy(status.digest, expected_digest, sizeof(status.digest));
+	}
+	journal_record("download", &status, sizeof(status));
+#endif
+}
+
+static int hash_chunk(uint8_t *chunk, size_t len, size_t offset, void *user_data)
+{
+	return crypto_digest_update(&digest, chunk, len);
+}
+
+/**
+ * @brief Hash the stored file and compare it with expected_digest.
+ */
+static bool stored_digest_matches(struct file_reader *reader)
+{
+	int64_t start = k_uptime_get();
+	int err = crypto_digest_start(&digest);
+
+	if (!err) {
+		err = file_read_chunks(reader, 0, hash_buf, sizeof(hash_buf), hash_chunk, NULL);
+		if (err) {
+			crypto_digest_abort(&digest);
+		} else {
+			err = crypto_digest_finish(&digest, expected_digest);
+		}
+	}
+	LOG_DBG("Stored file hashed in %d ms: %d", (int)(k_uptime_get() - start), err);
+	return err == 0;
+}
+
+/**
+ * @brief Check whether the stored file already is the update the shadow
+ * names, so a repeated delta does not download it again. Only a digest from
+ * the shadow tells: the same URL may serve new content, so without one the
+ * file is always downloaded. The stored file is hashed to confirm the
+ * digest, as it may have been restored from the backup since. When the last
+ * download in the journal had another digest, the file is not hashed.
+ *
+ * @return true if the stored file has the digest from the shadow.
+ */
+static bool stored_file_matches(void)
+{
+	struct file_reader reader;
+
+	if (!check_digest) {
+		return false;
+	}
+#if defined(CONFIG_JOURNAL_UTIL)
+	struct download_status status;
+
+	if (journal_get("download", &status, sizeof(status)) == sizeof(status) && status.result == 0 &&
+	    memcmp(status.digest, expected_digest, sizeof(status.digest))) {
+		return false;
+	}
+#endif
+	if (file_read_start(&reader)) {
+		return false;
+	}
+	bool matches = stored_digest_matches(&reader);
+	file_read_end(&reader);
+	return matches;
+}
+
+#if defined(CONFIG_DOWNLOAD_CHECKPOINTS)
+static int checkpoint_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+	if (!settings_name_steq(key, "checkpoint", NULL) || len != sizeof(checkpoint)) {
+		return -ENOENT;
+	}
+	if (read_cb(cb_arg, &checkpoint, sizeof(checkpoint)) == sizeof(checkpoint)) {
+		checkpoint_loaded = true;
+	}
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(download, "download", NULL, checkpoint_set, NULL, NULL);
+
+/**
+ * @brief Start saving checkpoints for the download of full_url. Patches
+ * and files from the patch URL are not resumed.
+ */
+static void checkpoint_start(void)
+{
+	if (downloading_delta) {
+		return;
+	}
+	checkpoint_active = true;
+	strncpy(checkpoint.url, full_url, sizeof(checkpoint.url));
+	checkpoint.file_size = file_size;
+	checkpoint.check_digest = check_digest;
+	memcpy(checkpoint.digest, expected_digest, sizeof(checkpoint.digest));
+	next_checkpoint = data_stored + CONFIG_DOWNLOAD_CHECKPOINT_INTERVAL;
+}
+
+/**
+ * @brief Save how much of the download is stored, once every
+ * CONFIG_DOWNLOAD_CHECKPOINT_INTERVAL bytes.
+ */
+static void checkpoint_update(void)
+{
+	if (!checkpoint_active || data_stored < next_checkpoint) {
+		return;
+	}
+	next_checkpoint = data_stored + CONFIG_DOWNLOAD_CHECKPOINT_INTERVAL;
+	int offset = file_write_sync();
+	if (offset < 0) {
+		LOG_WRN("Could not sync the staging file: %d", offset);
+		return;
+	}
+	checkpoint.offset = offset;
+	int err = settings_save_one(CHECKPOINT_KEY, &checkpoint, sizeof(checkpoint));
+	if (err) {
+		LOG_WRN("Could not save checkpoint: %d", err);
+		return;
+	}
+	checkpoint_saved = true;
+	LOG_DBG("Checkpoint at %d B", offset);
+}
+
+static void checkpoint_clear(void)
+{
+	checkpoint_active = false;
+	if (checkpoint_saved) {
+		settings_delete(CHECKPOINT_KEY);
+		checkpoint_saved = false;
+	}
+}
+
+/**
+ * @brief Continue the download interrupted by a reset from its last
+ * checkpoint. The kept bytes are hashed again if the digest is checked.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+static int resume_download(void)
+{
+	int err;
+
+	start_metrics();
+	checkpoint_loaded = false;
+	checkpoint_saved = true;
+	checkpoint_active = true;
+	check_digest = checkpoint.check_digest;
+	memcpy(expected_digest, checkpoint.digest, sizeof(expected_digest));
+	if (check_digest) {
+		err = crypto_digest_start(&digest);
+		if (err) {
+			return err;
+		}
+		digest_started = true;
+	}
+	err = file_write_resume(checkpoint.offset, hash_buf, sizeof(hash_buf),
+				check_digest ? hash_chunk : NULL, NULL);
+	if (err) {
+		return err;
+	}
+	file_size = checkpoint.file_size;
+	data_received = checkpoint.offset;
+	data_stored = checkpoint.offset;
+	bytes_transferred = 0;
+	resume_attempts = 0;
+	next_checkpoint = data_stored + CONFIG_DOWNLOAD_CHECKPOINT_INTERVAL;
+	first_fragment = false;
+	resuming = true;
+	LOG_INF("Resuming download at %d of %d B", checkpoint.offset, checkpoint.file_size);
+	return download_connect_and_start(full_url, checkpoint.offset);
+}
+#else
+static void checkpoint_start(void) {}
+static void checkpoint_update(void) {}
+static void checkpoint_clear(void) {}
+#endif /* CONFIG_DOWNLOAD_CHECKPOINTS */
+
+/**
+ * @brief Open the staging file, and start hashing what is stored in it if
+ * the shadow gave a digest.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+static int start_storage(void)
+{
+	data_stored = 0;
+	int err = file_write_start();
+	if (err || !check_digest) {
+		return err;
+	}
+	err = crypto_digest_start(&digest);
+	if (err) {
+		file_write_abort();
+		return err;
+	}
+	digest_started = true;
+	return 0;
+}
+
+/**
+ * @brief Hash and store bytes of the downloaded file, so it never has to be
+ * read back to be checked.
+ */
+static int store_bytes(const void *buf, size_t len)
+{
+	if (digest_started) {
+		int err = crypto_digest_update(&digest, buf, len);
+		if (err) {
+			return err;
+		}
+	}
+	return file_write(buf, len);
+}
+
+/**
+ * @brief Check the digest of the stored file, if the shadow gave one.
+ *
+ * @return 0 if it matches or there is none, -EBADMSG if it does not match.
+ */
+static int finish_digest(void)
+{
+	if (!digest_started) {
+		return 0;
+	}
+	digest_started = false;
+	return crypto_digest_finish(&digest, expected_digest);
+}
+
+/**
+ * @brief Run the storage stages on downloaded bytes. A patch is decoded,
+ * which stores the patched bytes, any other file is hashed and stored.
+ */
+static int process_bytes(const void *buf, size_t len)
+{
+	if (applying_patch) {
+		return patch_stream_feed(&patch, buf, len);
+	}
+	int err = store_bytes(buf, len);
+	if (!err) {
+		data_stored += len;
+		checkpoint_update();
+	}
+	return err;
+}
+
+#if defined(CONFIG_DOWNLOAD_PIPELINE)
+/* Downloaded bytes on their way from the download client to the storage
+ * thread, so flash writes overlap with receiving the next fragments */
+RING_BUF_DECLARE(pipeline_buf, CONFIG_DOWNLOAD_PIPELINE_BUF_SIZE);
+static K_MUTEX_DEFINE(pipeline_mutex);
+static K_SEM_DEFINE(pipeline_data, 0, 1);       /* Bytes were queued */
+static K_SEM_DEFINE(pipeline_space, 0, 1);      /* Bytes were taken out */
+static K_SEM_DEFINE(pipeline_done, 0, 1);       /* Bytes were processed */
+static atomic_t pipeline_pending;       /* Bytes queued and not processed yet */
+static atomic_t pipeline_err;           /* First error of a stage, 0 if none */
+static uint8_t stage_buf[CONFIG_DOWNLOAD_PIPELINE_CHUNK_SIZE];
+
+/**
+ * @brief Queue downloaded bytes for the storage thread. Blocks while the
+ * queue is full, so the download client stops reading the socket until the
+ * flash has caught up.
+ *
+ * @return 0 on success, the error of a stage on earlier bytes otherwise.
+ */
+static int pipeline_push(const void *buf, size_t len)
+{
+	const uint8_t *pos = buf;
+
+	while (len > 0) {
+		int err = atomic_get(&pipeline_err);
+		if (err) {
+			return err;
+		}
+		k_mutex_lock(&pipeline_mutex, K_FOREVER);
+		uint32_t put = ring_buf_put(&pipeline_buf, pos, len);
+		k_mutex_unlock(&pipeline_mutex);
+		if (put > 0) {
+			atomic_add(&pipeline_pending, put);
+			k_sem_give(&pipeline_data);
+			pos += put;
+			len -= put;
+		}
+		if (len > 0) {
+			k_sem_take(&pipeline_space, K_FOREVER);
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Wait until the storage thread has processed every queued byte.
+ * Must be called before the stages are finished or aborted.
+ *
+ * @return 0 on success, the first error of a stage otherwise. The error is
+ * cleared.
+ */
+static int pipeline_drain(void)
+{
+	while (atomic_get(&pipeline_pending) > 0) {
+		k_sem_take(&pipeline_done, K_FOREVER);
+	}
+	return atomic_set(&pipeline_err, 0);
+}
+
+static void pipeline_thread_fn(void)
+{
+	while (true) {
+		k_sem_take(&pipeline_data, K_FOREVER);
+		while (true) {
+			k_mutex_lock(&pipeline_mutex, K_FOREVER);
+			uint32_t len = ring_buf_get(&pipeline_buf, stage_buf, sizeof(stage_buf));
+			k_mutex_unlock(&pipeline_mutex);
+			if (len == 0) {
+				break;
+			}
+			k_sem_give(&pipeline_space);
+			/* After an error, bytes are dropped until the pipeline is drained */
+			if (!atomic_get(&pipeline_err)) {
+				int err = process_bytes(stage_buf, len);
+				if (err) {
+					atomic_set(&pipeline_err, err);
+				}
+			}
+			atomic_sub(&pipeline_pending, len);
+			k_sem_give(&pipeline_done);
+		}
+	}
+}
+
+K_THREAD_DEFINE(download_pipeline_thread, CONFIG_DOWNLOAD_PIPELINE_STACK_SIZE,
+		pipeline_thread_fn, NULL, NULL, NULL,
+		K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+#else
+static int pipeline_push(const void *buf, size_t len)
+{
+	return process_bytes(buf, len);
+}
+
+static int pipeline_drain(void)
+{
+	return 0;
+}
+#endif /* CONFIG_DOWNLOAD_PIPELINE */
+
+static void abort_storage(void)
+{
+	pipeline_drain();
+	if (digest_started) {
+		crypto_digest_abort(&digest);
+		digest_started = false;
+	}
+	file_write_abort();
+	checkpoint_clear();
+}
+
+static int handle_file_fragment(const void * const fragment, size_t frag_size)
 {
     int err; 
 
     static int frag_count = 0;
-    static int data_received = 0;
     data_received += frag_size;
+	bytes_transferred += frag_size;
+	resume_attempts = 0;
 
-	err = file_write(fragment, frag_size);
+	err = pipeline_push(fragment, frag_size);
 
     int percentage = (data_received * 100) / file_size;
     LOG_DBG("Received fragment %d.\n Received: %d B/%d B\n  (%d%%)", frag_count++, data_received, file_size, percentage);
     return err;
 }
 
+/**
+ * @brief Give up on a patch or a resumed download and download the full
+ * file from the start instead. Called
+ * from the download client, so the new download is started from a work item.
+ */
+static void fall_back_to_full(int err)
+{
+	LOG_WRN("Could not continue download: %d. Downloading the full file.", err);
+	download_client_disconnect(&dl_client);
+	/* Drains the pipeline, so the patch is done reading the stored file */
+	abort_storage();
+	if (applying_patch) {
+		file_base_end();
+		applying_patch = false;
+	}
+	downloading_delta = false;
+	first_fragment = true;
+	k_work_reschedule(&fallback_work, K_MSEC(FALLBACK_DELAY_MS));
+}
+
+static bool is_connection_error(int err)
+{
+	switch (err) {
+	case -ENOTCONN:
+	case -ECONNRESET:
+	case -ECONNREFUSED:
+	case -ECONNABORTED:
+	case -ETIMEDOUT:
+	case -EHOSTUNREACH:
+	case -ENETUNREACH:
+	case -ENETDOWN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Reconnect after the download client ran out of socket retries, and
+ * continue at data_received with a range request. The delay doubles with
+ * every attempt that brings no new data, up to
+ * CONFIG_DOWNLOAD_RESUME_BACKOFF_MAX_S. Called from the download client.
+ */
+static void schedule_resume(int err)
+{
+	uint32_t delay_s = MIN(CONFIG_DOWNLOAD_RESUME_BACKOFF_MIN_S << resume_attempts,
+			       CONFIG_DOWNLOAD_RESUME_BACKOFF_MAX_S);
+
+	resume_attempts++;
+	metrics.retries++;
+	download_client_disconnect(&dl_client);
+	LOG_WRN("Download interrupted: %d. Resuming at %d B in %d s (attempt %d)",
+		err, data_received, delay_s, resume_attempts);
+	k_work_reschedule(&resume_work, K_SECONDS(delay_s));
+}
+
+static void give_up_download(int err)
+{
+	abort_storage();
+	if (applying_patch) {
+		file_base_end();
+		applying_patch = false;
+	}
+	first_fragment = true;
+	downloading_delta = false;
+	LOG_ERR("An error occured while downloading: %d", err);
+	record_status(err);
+	SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
+	state_set(STATE_FREE);
+}
+
+/**
+ * @brief Cancel a download whose bytes could not be stored.
+ */
+static void cancel_storage(int err)
+{
+	LOG_ERR("Could not store fragment: %d. Cancelling download.", err);
+	download_client_disconnect(&dl_client);
+	abort_storage();
+	first_fragment = true;
+	downloading_delta = false;
+	record_status(err);
+	SEND_ERROR(download, DOWNLOAD_EVT_STORAGE_ERROR, err);
+	state_set(STATE_FREE);
+}
+
+static void resume_work_fn(struct k_work *work)
+{
+	/* Nothing stored yet means starting over, which checks the file again */
+	resuming = !first_fragment;
+	int err = download_connect_and_start(active_url, first_fragment ? 0 : data_received);
+	if (!err) {
+		return;
+	}
+	if (resume_attempts < CONFIG_DOWNLOAD_RESUME_RETRIES && is_connection_error(err)) {
+		schedule_resume(err);
+		return;
+	}
+	resuming = false;
+	give_up_download(err);
+}
+
+static void fallback_work_fn(struct k_work *work)
+{
+	int err = download_connect_and_start(full_url, 0);
+	if (err) {
+		LOG_ERR("Could not start full download: %d", err);
+		record_status(err);
+		SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
+		state_set(STATE_FREE);
+	}
+}
+
+/**
+ * @brief Start applying a patch to the stored file. The patched file is
+ * written to the staging file like a download.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+static int start_patch(void)
+{
+	int err = start_storage();
+	if (err) {
+		return err;
+	}
+	err = file_base_start();
+	if (err) {
+		abort_storage();
+		return err;
+	}
+	patch_stream_init(&patch, file_base_read_at, store_bytes,
+			  MIN(CONFIG_DOWNLOAD_FILE_MAX_SIZE_BYTES, file_write_max_size()));
+	applying_patch = true;
+	return 0;
+}
+
 //========================================================================================
 /*                                                                                      *
  *                                    State handlers/                                   *
@@ -133,11 +824,100 @@ static int handle_file_fragment(const void * const fragment, size_t frag_size, s
  *                                                                                      */
 //========================================================================================
 
+#if defined(CONFIG_DOWNLOAD_CHECKPOINTS)
+/**
+ * @brief Resume the download interrupted by a reset once the device is
+ * connected, or when the shadow names the same file again.
+ *
+ * @return true if the message was handled.
+ */
+static bool handle_checkpoint(struct download_msg_data *msg)
+{
+	bool same_file = IS_EVENT(msg, cloud, CLOUD_EVT_DATABASE_UPDATE_AVAILABLE) &&
+			 !strcmp(msg->module.cloud.data.url, checkpoint.url);
+
+	if (!checkpoint_loaded) {
+		return false;
+	}
+	if (IS_EVENT(msg, cloud, CLOUD_EVT_DATABASE_UPDATE_AVAILABLE) && !same_file) {
+		/* The interrupted file is outdated */
+		checkpoint_loaded = false;
+		checkpoint_saved = true;
+		checkpoint_clear();
+		return false;
+	}
+	if (!same_file && !IS_EVENT(msg, cloud, CLOUD_EVT_CONNECTED)) {
+		return false;
+	}
+	/* The checkpoint holds the digest of the interrupted file */
+	digest_hex[0] = '\0';
+	int err = resume_download();
+	if (err) {
+		LOG_WRN("Could not resume download: %d", err);
+		abort_storage();
+		first_fragment = true;
+		err = download_connect_and_start(full_url, 0);
+	}
+	if (err) {
+		SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
+	} else {
+		SEND_EVENT(download, DOWNLOAD_EVT_DOWNLOAD_STARTED);
+	}
+	return true;
+}
+#endif /* CONFIG_DOWNLOAD_CHECKPOINTS */
+
 static void on_state_free(struct download_msg_data *msg)
 {
 	int err;
+#if defined(CONFIG_DOWNLOAD_CHECKPOINTS)
+	if (handle_checkpoint(msg)) {
+		return;
+	}
+#endif
+	if (IS_EVENT(msg, cloud, CLOUD_EVT_DATABASE_DELTA_AVAILABLE)) {
+		strncpy(delta_url, msg->module.cloud.data.url, sizeof(delta_url));
+		delta_url[sizeof(delta_url) - 1] = '\0';
+	}
+	if (IS_EVENT(msg, cloud, CLOUD_EVT_DATABASE_DIGEST_AVAILABLE)) {
+		strncpy(digest_hex, msg->module.cloud.data.digest, sizeof(digest_hex));
+		digest_hex[sizeof(digest_hex) - 1] = '\0';
+	}
     if (IS_EVENT(msg, cloud, CLOUD_EVT_DATABASE_UPDATE_AVAILABLE)) {
-		err = download_connect_and_start(msg->module.cloud.data.url);
+		const char *url = msg->module.cloud.data.url;
+		check_digest = digest_hex[0] != '\0';
+		if (check_digest) {
+			err = crypto_digest_parse(digest_hex, expected_digest);
+			digest_hex[0] = '\0';
+			if (err) {
+				delta_url[0] = '\0';
+				SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
+				return;
+			}
+		}
+		if (stored_file_matches()) {
+			LOG_INF("Stored file is up to date, not downloading it");
+			delta_url[0] = '\0';
+			SEND_EVENT(download, DOWNLOAD_EVT_DOWNLOAD_SKIPPED);
+			return;
+		}
+		strncpy(full_url, url, sizeof(full_url));
+		full_url[sizeof(full_url) - 1] = '\0';
+		file_size = 0;
+		bytes_transferred = 0;
+		resume_attempts = 0;
+		start_metrics();
+		downloading_delta = delta_url[0] != '\0';
+		if (downloading_delta) {
+			url = delta_url;
+		}
+		err = download_connect_and_start(url, 0);
+		if (err && downloading_delta) {
+			LOG_WRN("Could not start patch download: %d", err);
+			downloading_delta = false;
+			err = download_connect_and_start(full_url, 0);
+		}
+		delta_url[0] = '\0';
 		if (err) {
 			SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
 			return;
@@ -166,18 +946,65 @@ static void on_all_states(struct download_msg_data *msg)
 
 static int download_client_callback(const struct download_client_evt *event)
 {
-	static size_t file_size;
 	int err;
 	switch (event->id) {
 	case DOWNLOAD_CLIENT_EVT_FRAGMENT: {
+		measure_fragment(event->fragment.len);
+		if (resuming) {
+			size_t total = 0;
+			resuming = false;
+			download_client_file_size_get(&dl_client, &total);
+			if (total != file_size) {
+				/* The file changed since the download started */
+				fall_back_to_full(-ESTALE);
+				return -ESTALE;
+			}
+		}
+		if (first_fragment && downloading_delta) {
+			if (patch_is_patch(event->fragment.buf, event->fragment.len)) {
+				LOG_DBG("Vault format: patch");
+				err = start_patch();
+				if (err) {
+					fall_back_to_full(err);
+					return err;
+				}
+				err = download_client_file_size_get(&dl_client, &file_size);
+				if (err) {
+					fall_back_to_full(err);
+					return err;
+				}
+				data_received = 0;
+				first_fragment = false;
+			} else {
+				/* The server sent a whole file, which is just as good */
+				downloading_delta = false;
+			}
+		}
 		if (first_fragment) {
-			err = file_write_start();
+			enum vault_format format = parse_detect_format(event->fragment.buf, event->fragment.len);
+			if (format == VAULT_FORMAT_UNSUPPORTED) {
+				LOG_ERR("Unsupported vault version. Cancelling download.");
+				download_client_disconnect(&dl_client);
+				record_status(-ENOTSUP);
+				SEND_ERROR(download, DOWNLOAD_EVT_ERROR, -ENOTSUP);
+				state_set(STATE_FREE);
+				return -ENOTSUP;
+			}
+			if (crypto_is_encrypted(event->fragment.buf, event->fragment.len)) {
+				LOG_DBG("Vault format: encrypted");
+			} else if (compress_is_compressed(event->fragment.buf, event->fragment.len)) {
+				LOG_DBG("Vault format: compressed");
+			} else {
+				LOG_DBG("Vault format: %s", format == VAULT_FORMAT_BINARY ? "binary" : "TSV");
+			}
+			err = start_storage();
 			if (err)
 			{
 				SEND_ERROR(download, DOWNLOAD_EVT_STORAGE_ERROR, err);
 				download_client_disconnect(&dl_client);
-				file_close_and_unmount();
+				abort_storage();
 				LOG_ERR("Could not store file. Cancelling download.");
+				record_status(err);
 				state_set(STATE_FREE);
 				return err;
 			}
@@ -185,25 +1012,92 @@ static int download_client_callback(const struct download_client_evt *event)
 			err = download_client_file_size_get(&dl_client, &file_size);
 			if (err) {
 				LOG_DBG("download_client_file_size_get err: %d", err);
+				download_client_disconnect(&dl_client);
+				abort_storage();
+				first_fragment = true;
+				record_status(err);
+				state_set(STATE_FREE);
 				return err;
 			}
 			if (file_size > CONFIG_DOWNLOAD_FILE_MAX_SIZE_BYTES) {
 				LOG_ERR("File size (%dB) too big", file_size);
+				download_client_disconnect(&dl_client);
+				abort_storage();
+				first_fragment = true;
+				record_status(-EFBIG);
 				SEND_ERROR(download, DOWNLOAD_EVT_ERROR, -EFBIG);
 				state_set(STATE_FREE);
 				return -EFBIG;
 			}
+			data_received = 0;
 			first_fragment = false;
+			checkpoint_start();
+		}
+		err = handle_file_fragment(event->fragment.buf, event->fragment.len);
+		if (err && applying_patch) {
+			fall_back_to_full(err);
+			return err;
+		}
+		if (err) {
+			cancel_storage(err);
+			return err;
 		}
-		handle_file_fragment(event->fragment.buf, event->fragment.len, file_size);
 		break;
 	}
 	case DOWNLOAD_CLIENT_EVT_DONE: {
+		/* The last fragments may still be on their way to the flash */
+		err = pipeline_drain();
+		if (err && applying_patch) {
+			fall_back_to_full(err);
+			break;
+		}
+		if (err) {
+			cancel_storage(err);
+			break;
+		}
+		if (applying_patch) {
+			err = patch_stream_finish(&patch);
+			file_base_end();
+			applying_patch = false;
+			if (err) {
+				fall_back_to_full(err);
+				break;
+			}
+			file_size = patch.header.target_len;
+			/* A patched file that does not match is fetched whole instead */
+			err = finish_digest();
+			if (err) {
+				fall_back_to_full(err);
+				break;
+			}
+		} else {
+			err = finish_digest();
+		}
+		if (err) {
+			LOG_ERR("Downloaded file is corrupt, keeping the stored file");
+			download_client_disconnect(&dl_client);
+			abort_storage();
+			first_fragment = true;
+			downloading_delta = false;
+			record_status(err);
+			SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
+			state_set(STATE_FREE);
+			break;
+		}
 		download_client_disconnect(&dl_client);
-		file_close_and_unmount();
-		state_set(STATE_FREE);
-		LOG_DBG("Download complete");
 		first_fragment = true;
+		downloading_delta = false;
+		state_set(STATE_FREE);
+		/* The old file is only replaced by a complete new one */
+		err = file_write_commit(file_size);
+		checkpoint_clear();
+		record_status(err);
+		if (err) {
+			LOG_ERR("Could not commit downloaded file: %d", err);
+			SEND_ERROR(download, DOWNLOAD_EVT_STORAGE_ERROR, err);
+			break;
+		}
+		LOG_INF("Downloaded %d B, %d B transferred", file_size, bytes_transferred);
 		SEND_EVENT(download, DOWNLOAD_EVT_DOWNLOAD_FINISHED);
 		break;
 	}
@@ -215,18 +1109,22 @@ static int download_client_callback(const struct download_client_evt *event)
 					      (event->error == -ECONNRESET))) {
 			LOG_WRN("Download socket error. %d retries left...", socket_retries_left);
 			socket_retries_left--;
+			metrics.retries++;
 			/* Fall through and return 0 below to tell
 			 * download_client to retry
 			 */
+		} else if (resume_attempts < CONFIG_DOWNLOAD_RESUME_RETRIES &&
+			   is_connection_error(event->error)) {
+			/* Keep what is stored, patches included, and continue later */
+			schedule_resume(event->error);
+			return event->error;
+		} else if (downloading_delta) {
+			fall_back_to_full(event->error);
+			return event->error;
 		} else {
 			download_client_disconnect(&dl_client);
-			file_close_and_unmount();
-			first_fragment = true;
-			int err = event->error; /* Glue for logging */
-			LOG_ERR("An error occured while downloading: %d", err);
-			SEND_ERROR(download, DOWNLOAD_EVT_ERROR, err);
-			state_set(STATE_FREE);
-			return err;
+			give_up_download(event->error);
+			return event->error;
 		}
 		break;
 	}
@@ -290,6 +1188,29 @@ static int setup(void)
 	state_set(STATE_FREE);
 	first_fragment = true;
 	socket_retries_left = CONFIG_DOWNLOAD_SOCKET_RETRIES;
+
+#if defined(CONFIG_JOURNAL_UTIL)
+	struct download_status status;
+	if (journal_get("download", &status, sizeof(status)) == sizeof(status)) {
+		LOG_INF("Last download: %d, %d B", status.result, status.size);
+	}
+#endif
+
+#if defined(CONFIG_DOWNLOAD_CHECKPOINTS)
+	err = settings_subsys_init();
+	if (!err) {
+		err = settings_load_subtree("download");
+	}
+	if (err) {
+		LOG_WRN("Could not load checkpoint: %d", err);
+		return 0;
+	}
+	if (checkpoint_loaded) {
+		strncpy(full_url, checkpoint.url, sizeof(full_url));
+		full_url[sizeof(full_url) - 1] = '\0';
+		LOG_INF("Found checkpoint at %d of %d B", checkpoint.offset, checkpoint.file_size);
+	}
+#endif
     return err;
 }
 
@@ -23,13 +23,11 @@
 #include "modules_common.h"
 #include "util/file_util.h"
 #include "util/parse_util.h"
+#include "util/crypto_util.h"
+#include "util/compress_util.h"
 #include <logging/log.h>
 LOG_MODULE_REGISTER(MODULE, CONFIG_PASSWORD_MODULE_LOG_LEVEL);
 
-#if IS_ENABLED(CONFIG_DOWNLOAD_MODULE)
-BUILD_ASSERT(CONFIG_DOWNLOAD_FILE_MAX_SIZE_BYTES == CONFIG_PASSWORD_FILE_MAX_SIZE_BYTES);
-#endif
-
 struct password_msg_data
 {
 	union
@@ -59,58 +57,923 @@ static struct module_data self = {
  *                                                                                      */
 //========================================================================================
 
-#define READ_BUF_LEN CONFIG_PASSWORD_FILE_MAX_SIZE_BYTES /* Maximum amount of characters read from password file */
-#define ENTRIES_BUF_MAX_LEN (CONFIG_PASSWORD_ENTRY_MAX_NUM) * (CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN + 1)
+#define PASSWORD_MAX_LEN 100 //TODO: Make configurable
+#define VAULT_OPEN_ATTEMPTS 3
+
+/* Handle of the password file while this module reads it */
+static struct file_reader reader;
+
+/* The password file is only ever read through these buffers, so RAM use does
+ * not depend on the size of the file. */
+static uint8_t read_window[CONFIG_PASSWORD_READ_WINDOW_SIZE];
+static uint8_t record_buf[CONFIG_PARSE_UTIL_RECORD_MAX_LEN];
+static struct parse_stream stream;
+
+/* The vault state below was loaded from this generation of the password
+ * file, 0 if nothing is loaded. See file_generation. */
+static uint32_t loaded_generation;
+
+/* The last page sent, served again from memory while the file is unchanged */
+static struct password_page page_cache;
+static uint32_t page_cache_generation;
+static uint32_t page_cache_hits;
+static uint32_t page_cache_misses;
+
+/* Format of the password file. Only valid while vault_loaded is set. */
+static enum vault_format vault_format;
+static bool vault_loaded;
+static size_t records_start;
+static uint32_t account_count;
+
+/* Platforms are listed from the open folder, or from the whole vault if no
+ * folder is open. Only binary vaults with VAULT_FLAG_FOLDERS have folders. */
+static struct vault_folder open_folder;
+static bool folder_open;
+static char open_folder_name[CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN + 1];
+
+/* Binary vaults are searched through their offset table */
+static struct vault_bin bin_vault;
+
+/* TSV files are looked up through an index of record offsets in the file.
+ * Records that do not fit in it are searched by streaming from
+ * unindexed_start on, if index_full is set. */
+static struct entry_index_item entry_index[CONFIG_PASSWORD_INDEX_MAX_NUM];
+static size_t entry_index_count;
+static bool index_full;
+static size_t unindexed_start;
+
+/* Encrypted files are authenticated once when loaded, after that single
+ * records are decrypted on their own. Only valid while vault_loaded is set. */
+static bool vault_encrypted;
+static struct crypto_header vault_header;
+static struct crypto_stream crypto;
+
+/* Compressed vaults are read through their container, one block at a time.
+ * Only valid while vault_loaded is set. */
+static bool vault_compressed;
+static struct compress_vault compressed;
+
+/* Position and length of the (encrypted) vault in the file. For vaults with
+ * separately encrypted passwords this is only the index of the accounts. */
+static size_t payload_start;
+static size_t payload_len;
+
+/* Returned by feed_chunk once the payload and its tag have been read */
+#define READ_DONE 1
+
+BUILD_ASSERT(CONFIG_PASSWORD_READ_WINDOW_SIZE % CRYPTO_BLOCK_LEN == 0,
+	     "The read window must hold whole cipher blocks");
+
+struct load_context
+{
+	uint32_t count;
+	uint8_t tag[CRYPTO_TAG_LEN];
+};
+
+/**
+ * Reads and decrypts bytes of the vault in the open password file. Offsets
+ * are positions in the plaintext, which may be a compressed container.
+ * @return Number of bytes read on success, negative ERRNO on failure.
+*/
+static int payload_read(size_t offset, void *buf, size_t len)
+{
+	if (offset >= payload_len)
+	{
+		return 0;
+	}
+	int rc = file_read_at(&reader, payload_start + offset, buf, MIN(len, payload_len - offset));
+	if (rc > 0 && vault_encrypted)
+	{
+		int err = crypto_decrypt_at(vault_header.nonce, offset, buf, rc);
+		if (err)
+		{
+			return err;
+		}
+	}
+	return rc;
+}
+
+/**
+ * Reads bytes of the vault in the open password file, decrypting and
+ * decompressing them as needed. Offsets are positions in the vault.
+ * @return Number of bytes read on success, negative ERRNO on failure.
+*/
+static int vault_read(size_t offset, void *buf, size_t len)
+{
+	if (vault_compressed)
+	{
+		return compress_read(&compressed, payload_read, offset, buf, len);
+	}
+	return payload_read(offset, buf, len);
+}
 
-static uint8_t encrypted_buf[READ_BUF_LEN];
-static uint8_t plaintext_buf[READ_BUF_LEN];
-uint8_t entries_buf[ENTRIES_BUF_MAX_LEN];
+/**
+ * Ends a read of the password file. The decompressed block of a compressed
+ * vault is wiped, so no plaintext is left in RAM between lookups.
+*/
+static void vault_read_end(void)
+{
+	if (vault_compressed)
+	{
+		compress_invalidate(&compressed);
+	}
+	file_read_end(&reader);
+}
+
+/**
+ * Opens the vault in place if the storage backend maps the password file
+ * into memory. Only unencrypted binary vaults can be read that way, records
+ * are then searched without being copied. Must be called after
+ * file_read_start, and the handle is only valid until file_read_end.
+ * @return true if the vault could be mapped.
+*/
+static bool map_vault(struct vault_bin *vault)
+{
+	const void *buf;
+
+	if (vault_encrypted || vault_compressed || vault_format != VAULT_FORMAT_BINARY ||
+	    file_read_map(&reader, payload_start, payload_len, &buf))
+	{
+		return false;
+	}
+	return parse_bin_open(buf, payload_len, vault) == 0;
+}
+
+/**
+ * Locates the vault in the open password file, and detects its format.
+ * @return Negative ERRNO on failure, 0 on success.
+*/
+static int read_header(void)
+{
+	uint8_t header[MAX(MAX(VAULT_HEADER_MAX_LEN, CRYPTO_HEADER_MAX_LEN), COMPRESS_HEADER_LEN)];
+	int size = file_size_get(&reader);
+	if (size < 0)
+	{
+		return size;
+	}
+	int rc = file_read_at(&reader, 0, header, sizeof(header));
+	if (rc < 0)
+	{
+		return rc;
+	}
+	vault_encrypted = crypto_is_encrypted(header, rc);
+	if (vault_encrypted)
+	{
+		rc = crypto_read_header(header, rc, &vault_header);
+		if (rc)
+		{
+			return rc;
+		}
+		payload_start = vault_header.header_len;
+		payload_len = vault_header.version == CRYPTO_VERSION_SPLIT ?
+			      vault_header.index_len : size - payload_start - CRYPTO_TAG_LEN;
+		if (size < payload_start + CRYPTO_TAG_LEN ||
+		    payload_len > size - payload_start - CRYPTO_TAG_LEN)
+		{
+			LOG_ERR("Encrypted file is truncated");
+			return -EINVAL;
+		}
+	}
+	else
+	{
+		LOG_WRN("Password file is not encrypted");
+		vault_header.version = 0;
+		payload_start = 0;
+		payload_len = size;
+	}
+
+	/* The plaintext is not authenticated yet, but is only used to pick a
+	 * parser. Nothing parsed is kept unless the file turns out authentic. */
+	rc = payload_read(0, header, sizeof(header));
+	if (rc < 0)
+	{
+		return rc;
+	}
+	vault_compressed = compress_is_compressed(header, rc);
+	if (vault_compressed)
+	{
+		rc = compress_read_header(header, rc, &compressed);
+		if (!rc)
+		{
+			rc = vault_read(0, header, VAULT_HEADER_MAX_LEN);
+		}
+		if (rc < 0)
+		{
+			return rc;
+		}
+	}
+	vault_format = parse_detect_format(header, rc);
+	switch (vault_format)
+	{
+	case VAULT_FORMAT_BINARY:
+		rc = parse_bin_read_header(header, rc, &bin_vault);
+		records_start = parse_bin_records_start(&bin_vault);
+		return rc;
+	case VAULT_FORMAT_TSV:
+		if (vault_header.version == CRYPTO_VERSION_SPLIT)
+		{
+			LOG_ERR("Index of the encrypted vault is not a binary vault");
+			return -EINVAL;
+		}
+		records_start = 0;
+		return 0;
+	default:
+		LOG_ERR("Unsupported password file format");
+		return -ENOTSUP;
+	}
+}
+
+/**
+ * Decrypts a chunk of the file in place and passes the plaintext on to the
+ * record parser. Bytes after the ciphertext are the authentication tag.
+ * @return READ_DONE after the tag, 0 to continue, negative ERRNO on failure.
+*/
+static int feed_chunk(uint8_t *chunk, size_t len, size_t offset, void *user_data)
+{
+	struct load_context *ctx = user_data;
+	size_t pos = offset - payload_start;
+	size_t text_len = pos < payload_len ? MIN(len, payload_len - pos) : 0;
+	size_t end = payload_len + (vault_encrypted ? CRYPTO_TAG_LEN : 0);
+	int err;
+
+	if (len > text_len && vault_encrypted)
+	{
+		size_t tag_pos = pos + text_len - payload_len;
+		if (tag_pos < CRYPTO_TAG_LEN)
+		{
+			memcpy(&ctx->tag[tag_pos], &chunk[text_len], MIN(len - text_len, CRYPTO_TAG_LEN - tag_pos));
+		}
+	}
+	if (text_len > 0)
+	{
+		if (vault_encrypted)
+		{
+			err = crypto_stream_update(&crypto, chunk, text_len);
+			if (err)
+			{
+				return err;
+			}
+		}
+		/* Compressed vaults are parsed once authenticated, see stream_vault */
+		if (!vault_compressed)
+		{
+			/* Binary vaults are parsed from the first record on */
+			size_t skip = pos < records_start ? MIN(records_start - pos, text_len) : 0;
+			err = parse_stream_feed(&stream, &chunk[skip], text_len - skip);
+			if (err)
+			{
+				return err;
+			}
+		}
+	}
+	/* Separately encrypted passwords follow the index, and are not read */
+	return pos + len >= end ? READ_DONE : 0;
+}
 
+static int on_record_loaded(const struct vault_record_view *view, size_t offset, void *user_data)
+{
+	struct load_context *ctx = user_data;
 
-int decrypt_file(void) {
-	//TODO: actually decrypt an encrypted file
-	memcpy(plaintext_buf, encrypted_buf, READ_BUF_LEN);
+	if (vault_format == VAULT_FORMAT_TSV && !index_full &&
+		parse_index_add(entry_index, &entry_index_count, ARRAY_SIZE(entry_index), view, offset))
+	{
+		LOG_WRN("Index full, records after %d are searched by scanning. "
+			"Consider increasing CONFIG_PASSWORD_INDEX_MAX_NUM", entry_index_count);
+		index_full = true;
+		unindexed_start = offset;
+	}
+	ctx->count++;
 	return 0;
 }
 
 /**
- * Scans plaintext buffer for platforms. Right now, it assumes that the 
- * platform entry is the first word on each new line.
+ * Streams a compressed vault through the record parser, decompressing one
+ * block at a time into the read window.
+ * @return Negative ERRNO on failure, 0 on success.
+*/
+static int stream_decompressed(void)
+{
+	for (size_t offset = records_start;;)
+	{
+		int rc = vault_read(offset, read_window, sizeof(read_window));
+		if (rc <= 0)
+		{
+			return rc ? rc : parse_stream_finish(&stream);
+		}
+		int err = parse_stream_feed(&stream, read_window, rc);
+		if (err)
+		{
+			return err;
+		}
+		offset += rc;
+	}
+}
+
+/**
+ * Streams the vault through the record parser, decrypting it on the way if
+ * it is encrypted. For encrypted vaults the tag is checked at the end.
+ * Compressed vaults are parsed in a second pass, after authentication.
+ * @return Negative ERRNO on failure, 0 on success.
+*/
+static int stream_vault(struct load_context *ctx)
+{
+	int err;
+
+	parse_stream_init(&stream, vault_format, records_start, on_record_loaded, ctx);
+	if (!vault_encrypted && vault_compressed)
+	{
+		return stream_decompressed();
+	}
+	if (!vault_encrypted)
+	{
+		err = file_read_chunks(&reader, payload_start, read_window, sizeof(read_window), feed_chunk, ctx);
+		return err < 0 ? err : parse_stream_finish(&stream);
+	}
+
+	err = crypto_stream_start(&crypto, vault_header.nonce);
+	if (err)
+	{
+		return err;
+	}
+	err = file_read_chunks(&reader, payload_start, read_window, sizeof(read_window), feed_chunk, ctx);
+	/* Always finish, to free the stream */
+	int auth_err = crypto_stream_finish(&crypto, ctx->tag);
+	if (err >= 0)
+	{
+		err = auth_err;
+	}
+	if (err)
+	{
+		return err;
+	}
+	return vault_compressed ? stream_decompressed() : parse_stream_finish(&stream);
+}
+
+/**
+ * Logs how much of the thread stack has never been used, to size
+ * CONFIG_PASSWORD_THREAD_STACK_SIZE against real vaults.
+*/
+static void log_stack_use(void)
+{
+#if defined(CONFIG_THREAD_STACK_INFO) && defined(CONFIG_INIT_STACKS)
+	size_t unused;
+
+	if (!k_thread_stack_space_get(k_current_get(), &unused))
+	{
+		LOG_DBG("Stack use peak: %d of %d bytes", CONFIG_PASSWORD_THREAD_STACK_SIZE - unused,
+			CONFIG_PASSWORD_THREAD_STACK_SIZE);
+	}
+#endif
+}
+
+/**
+ * Streams through the password file once, decrypting it and counting the
+ * available accounts. TSV files also get their records indexed. The results
+ * are only kept if the file is authentic. Only has to be redone when the
+ * file changes.
  * @return Negative ERRNO on failure. 0 on success.
 */
-int get_available_accounts(void)
+static int load_password_file(void)
 {
+	struct load_context ctx = {0};
+	uint32_t start = k_cycle_get_32();
 	int err;
-	err = decrypt_file();
+
+	vault_loaded = false;
+	loaded_generation = 0;
+	entry_index_count = 0;
+	index_full = false;
+	folder_open = false;
+
+	err = file_read_start(&reader);
 	if (err)
 	{
-		LOG_WRN("Could not decrypt file.");
+		LOG_WRN("Could not open file: %d", err);
 		return err;
 	}
-	memset(entries_buf, '\0', ENTRIES_BUF_MAX_LEN * sizeof(uint8_t));
-	err = parse_entries(plaintext_buf, entries_buf, ENTRIES_BUF_MAX_LEN, ENTRY_ACCOUNT);
+	uint32_t generation = reader.generation;
+	err = read_header();
+	if (!err)
+	{
+		err = stream_vault(&ctx);
+	}
+	vault_read_end();
+	if (err)
+	{
+		LOG_WRN("Could not read file: %d", err);
+		entry_index_count = 0;
+		return err;
+	}
+	parse_index_sort(entry_index, entry_index_count);
+	account_count = ctx.count;
+	vault_loaded = true;
+	loaded_generation = generation;
+	uint32_t cycles = k_cycle_get_32() - start;
+	LOG_INF("Loaded %d records, %d byte %svault in %d us (%d cycles per record)", account_count,
+		payload_len, vault_compressed ? "compressed " : "", k_cyc_to_us_floor32(cycles),
+		account_count ? cycles / account_count : 0);
+	log_stack_use();
+	return 0;
+}
+
+/**
+ * Loads the password file. A new file that can not be read is replaced by
+ * the previous one.
+ * @return Negative ERRNO on failure. 0 on success.
+*/
+static int reload_password_file(void)
+{
+	int err = load_password_file();
+	if ((err == -EBADMSG || err == -EINVAL || err == -ENOTSUP) && file_restore_backup() == 0)
+	{
+		err = load_password_file();
+	}
 	return err;
 }
 
 /**
- * Scans plaintext buffer for platforms. Right now, it assumes that the 
- * platform entry is the first word on each new line.
+ * Opens the password file for reading, loading it first if it has been
+ * replaced since it was loaded. The check is made with the read lock held,
+ * which keeps the file from being replaced until vault_read_end, so the
+ * loaded state matches the file for the whole read.
+ * @return Negative ERRNO on failure. 0 on success.
+*/
+static int vault_read_start(void)
+{
+	int err;
+
+	/* A commit may land between loading and opening, then load again */
+	for (int attempt = 0; attempt < VAULT_OPEN_ATTEMPTS; attempt++)
+	{
+		err = file_read_start(&reader);
+		if (err)
+		{
+			return err;
+		}
+		if (vault_loaded && reader.generation == loaded_generation)
+		{
+			return 0;
+		}
+		vault_read_end();
+		err = reload_password_file();
+		if (err)
+		{
+			return err;
+		}
+	}
+	return -EAGAIN;
+}
+
+/**
+ * Reads and decrypts the separately encrypted password that the locator in
+ * the index record points to. The record is wiped from RAM again afterwards.
  * @return Negative ERRNO on failure. 0 on success.
 */
-int get_available_passwords(void)
+static int read_password_record(const struct vault_record_view *view, const char *account,
+				char *password, size_t password_len)
 {
+	struct crypto_locator locator;
+	uint8_t *plaintext;
 	int err;
-	err = decrypt_file();
+
+	err = crypto_read_locator(view->field[ENTRY_PASSWORD], view->field_len[ENTRY_PASSWORD], &locator);
 	if (err)
 	{
-		LOG_WRN("Could not decrypt file.");
+		LOG_ERR("Invalid password locator");
 		return err;
 	}
-	memset(entries_buf, '\0', ENTRIES_BUF_MAX_LEN * sizeof(uint8_t));
-	err = parse_entries(plaintext_buf, entries_buf, ENTRIES_BUF_MAX_LEN, ENTRY_PASSWORD);
+	if (locator.len > sizeof(record_buf))
+	{
+		LOG_ERR("Password record too long");
+		return -E2BIG;
+	}
+	/* The view points into record_buf, which is about to be overwritten */
+	err = file_read_at(&reader, locator.offset, record_buf, locator.len);
+	if (err >= 0 && err != locator.len)
+	{
+		err = -EINVAL;
+	}
+	if (err >= 0)
+	{
+		err = crypto_decrypt_record(record_buf, locator.len, account, strlen(account), &plaintext);
+	}
+	if (err >= 0)
+	{
+		struct vault_record_view secret = {
+			.field[ENTRY_PASSWORD] = (const char *)plaintext,
+			.field_len[ENTRY_PASSWORD] = err,
+		};
+		err = parse_view_get_field(&secret, ENTRY_PASSWORD, password, password_len);
+	}
+	memset(record_buf, 0, sizeof(record_buf));
+	return err;
+}
+
+/**
+ * Looks up the password of an account. Only the records visited by the
+ * search are read from the file.
+ * @return Negative ERRNO on failure. 0 on success.
+*/
+static int get_account_password(const char *account, char *password, size_t password_len)
+{
+	struct vault_record_view view;
+	struct vault_bin mapped;
+	uint32_t start;
+	int err;
+
+	start = k_cycle_get_32();
+	err = vault_read_start();
+	if (err)
+	{
+		return err;
+	}
+	if (map_vault(&mapped))
+	{
+		err = parse_bin_find(&mapped, account, &view);
+	}
+	else if (vault_format == VAULT_FORMAT_BINARY)
+	{
+		err = parse_bin_find_read(vault_read, &bin_vault, account, record_buf, sizeof(record_buf), &view);
+	}
+	else
+	{
+		err = parse_index_lookup(vault_read, entry_index, entry_index_count, account,
+					 (char *)record_buf, sizeof(record_buf), &view);
+		if (err == -ENOENT && index_full)
+		{
+			err = parse_stream_find(vault_read, &stream, vault_format, unindexed_start, account,
+						read_window, sizeof(read_window), (char *)record_buf,
+						sizeof(record_buf), &view);
+		}
+	}
+	if (!err && vault_header.version == CRYPTO_VERSION_SPLIT)
+	{
+		err = read_password_record(&view, account, password, password_len);
+	}
+	else if (!err)
+	{
+		err = parse_view_get_field(&view, ENTRY_PASSWORD, password, password_len);
+		memset(record_buf, 0, sizeof(record_buf));
+	}
+	else if (err == -ENOENT)
+	{
+		LOG_WRN("No entry for %s", log_strdup(account));
+	}
+	vault_read_end();
+	LOG_DBG("Password lookup took %d us", k_cyc_to_us_floor32(k_cycle_get_32() - start));
+	log_stack_use();
 	return err;
 }
 
+struct page_context
+{
+	struct password_page *page;
+	size_t entries_len;
+	uint32_t skip;
+	size_t strip;
+};
+
+static int on_page_record(const struct vault_record_view *view, size_t offset, void *user_data)
+{
+	struct page_context *ctx = user_data;
+
+	if (ctx->skip > 0)
+	{
+		ctx->skip--;
+		return 0;
+	}
+	/* Names in a folder are listed without the folder */
+	size_t strip = MIN(ctx->strip, view->field_len[ENTRY_ACCOUNT]);
+	int err = parse_append_entry(ctx->page->entries, sizeof(ctx->page->entries), &ctx->entries_len,
+				     view->field[ENTRY_ACCOUNT] + strip, view->field_len[ENTRY_ACCOUNT] - strip);
+	if (err)
+	{
+		return err;
+	}
+	ctx->page->count--;
+	return ctx->page->count == 0 ? READ_DONE : 0;
+}
+
+/**
+ * Collects the names of a window of the accounts in the open folder, in file
+ * order. Binary vaults are read through their offset table, so only the
+ * records of the window are read. TSV files are streamed from the start
+ * until the window is complete.
+ * @param page page->offset and page->count give the window. page->count is
+ * set to the number of names found.
+ * @return Negative ERRNO on failure. 0 on success.
+*/
+static int read_page(struct password_page *page)
+{
+	struct page_context ctx = {
+		.page = page,
+		.strip = folder_open ? strlen(open_folder_name) + 1 : 0,
+	};
+	uint32_t first = folder_open ? open_folder.first : 0;
+	uint32_t total = folder_open ? open_folder.count : account_count;
+	uint8_t wanted = page->count;
+	int err = 0;
+
+	memset(page->entries, '\0', sizeof(page->entries));
+	if (vault_format == VAULT_FORMAT_BINARY)
+	{
+		struct vault_record_view view;
+		struct vault_bin mapped;
+		bool in_place = map_vault(&mapped);
+
+		for (uint32_t i = first + page->offset; i < first + total && page->count > 0 && !err; i++)
+		{
+			err = in_place ? parse_bin_get_record(&mapped, i, &view) :
+			      parse_bin_get_record_read(vault_read, &bin_vault, i, record_buf, sizeof(record_buf), &view);
+			if (!err)
+			{
+				err = on_page_record(&view, 0, &ctx);
+			}
+		}
+	}
+	else
+	{
+		ctx.skip = page->offset;
+		parse_stream_init(&stream, vault_format, records_start, on_page_record, &ctx);
+		for (size_t offset = records_start; page->count > 0 && !err;)
+		{
+			int rc = vault_read(offset, read_window, sizeof(read_window));
+			if (rc <= 0)
+			{
+				err = rc ? rc : parse_stream_finish(&stream);
+				break;
+			}
+			err = parse_stream_feed(&stream, read_window, rc);
+			offset += rc;
+		}
+	}
+	memset(record_buf, 0, sizeof(record_buf));
+	if (err < 0 && err != -ENOBUFS)
+	{
+		return err;
+	}
+	if (ctx.entries_len > 0)
+	{
+		page->entries[ctx.entries_len - 1] = '\0'; //remove trailing tab
+	}
+	page->count = wanted - page->count;
+	page->total = total;
+	return 0;
+}
+
+/**
+ * Sends a window of the accounts of the current password file. The file is
+ * only loaded again if it has changed, and a repeated request for the same
+ * window is served from memory.
+*/
+static void send_available_accounts(uint32_t offset, uint8_t count)
+{
+	uint32_t start = k_cycle_get_32();
+	int err;
+
+	count = MIN(count, CONFIG_PASSWORD_ENTRY_MAX_NUM);
+	if (page_cache_generation == file_generation() && page_cache.offset == offset &&
+	    page_cache.count == MIN(count, page_cache.total - MIN(offset, page_cache.total)))
+	{
+		page_cache_hits++;
+	}
+	else
+	{
+		page_cache_misses++;
+		page_cache_generation = 0;
+		page_cache.offset = offset;
+		page_cache.count = count;
+		err = vault_read_start();
+		if (!err)
+		{
+			err = read_page(&page_cache);
+			page_cache_generation = loaded_generation;
+			vault_read_end();
+		}
+		if (err)
+		{
+			LOG_WRN("Could not read platforms: %d", err);
+			page_cache_generation = 0;
+			return;
+		}
+	}
+	LOG_DBG("Platforms %d-%d of %d ready in %d us (cache hits: %d, misses: %d)",
+		page_cache.offset, page_cache.offset + page_cache.count, page_cache.total,
+		k_cyc_to_us_floor32(k_cycle_get_32() - start), page_cache_hits, page_cache_misses);
+	struct password_module_event *event = new_password_module_event();
+	event->type = PASSWORD_EVT_READ_PLATFORMS;
+	event->data.page = page_cache;
+	EVENT_SUBMIT(event);
+}
+
+/**
+ * Finds where a jump in the platform list of the open folder lands. Binary
+ * vaults are sorted by name, so every jump is a binary search over the
+ * offset table, reading O(log n) records.
+ * @param pos Set to the position in the open folder to jump to.
+ * @return Negative ERRNO on failure. 0 on success.
+*/
+static int jump_position(const struct display_jump *jump, uint32_t *pos)
+{
+	char key[2 * (CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN + 1)];
+	size_t strip = folder_open ? strlen(open_folder_name) + 1 : 0;
+	uint32_t first = folder_open ? open_folder.first : 0;
+	uint32_t end = first + (folder_open ? open_folder.count : account_count);
+	struct vault_record_view view;
+	uint8_t letter;
+	uint32_t start;
+	int err;
+
+	if (vault_format != VAULT_FORMAT_BINARY)
+	{
+		return -ENOTSUP;
+	}
+	if (folder_open)
+	{
+		snprintf(key, sizeof(key), "%s%c", open_folder_name, VAULT_FOLDER_SEPARATOR);
+	}
+	if (jump->direction == 0)
+	{
+		/* First platform starting with the prefix, or the last one before it */
+		size_t len = strnlen(jump->prefix, sizeof(jump->prefix));
+		if (strip + len > sizeof(key))
+		{
+			return -EINVAL;
+		}
+		memcpy(&key[strip], jump->prefix, len);
+		err = parse_bin_lower_bound_read(vault_read, &bin_vault, first, end - first, key, strip + len,
+						 record_buf, sizeof(record_buf), pos);
+		if (!err && *pos == end && end > first)
+		{
+			(*pos)--;
+		}
+		*pos -= first;
+		return err;
+	}
+
+	if (jump->from >= end - first)
+	{
+		return -EINVAL;
+	}
+	err = parse_bin_get_record_read(vault_read, &bin_vault, first + jump->from, record_buf, sizeof(record_buf), &view);
+	if (err)
+	{
+		return err;
+	}
+	letter = view.field_len[ENTRY_ACCOUNT] > strip ? view.field[ENTRY_ACCOUNT][strip] : 0;
+	*pos = jump->from;
+
+	if (jump->direction > 0)
+	{
+		/* First platform after every name starting with this letter */
+		if (letter == UINT8_MAX)
+		{
+			return 0;
+		}
+		key[strip] = letter + 1;
+		err = parse_bin_lower_bound_read(vault_read, &bin_vault, first, end - first, key, strip + 1,
+						 record_buf, sizeof(record_buf), &start);
+		if (!err && start < end)
+		{
+			*pos = start - first;
+		}
+		return err;
+	}
+
+	/* Start of this letter, or of the previous letter if already there */
+	key[strip] = letter;
+	err = parse_bin_lower_bound_read(vault_read, &bin_vault, first, end - first, key, strip + 1,
+					 record_buf, sizeof(record_buf), &start);
+	if (err || start < first + jump->from || start == first)
+	{
+		*pos = start - first;
+		return err;
+	}
+	err = parse_bin_get_record_read(vault_read, &bin_vault, start - 1, record_buf, sizeof(record_buf), &view);
+	if (err)
+	{
+		return err;
+	}
+	key[strip] = view.field_len[ENTRY_ACCOUNT] > strip ? view.field[ENTRY_ACCOUNT][strip] : 0;
+	err = parse_bin_lower_bound_read(vault_read, &bin_vault, first, end - first, key, strip + 1,
+					 record_buf, sizeof(record_buf), &start);
+	*pos = start - first;
+	return err;
+}
+
+/**
+ * Sends the page of platforms starting where a jump lands.
+*/
+static void jump_platforms(const struct display_jump *jump)
+{
+	uint32_t start = k_cycle_get_32();
+	uint32_t pos;
+	int err;
+
+	err = vault_read_start();
+	if (!err)
+	{
+		err = jump_position(jump, &pos);
+		memset(record_buf, 0, sizeof(record_buf));
+		vault_read_end();
+	}
+	if (err)
+	{
+		LOG_WRN("Could not jump in platform list: %d", err);
+		return;
+	}
+	LOG_DBG("Jump from %d lands on %d in %d us", jump->from, pos,
+		k_cyc_to_us_floor32(k_cycle_get_32() - start));
+	send_available_accounts(pos, CONFIG_PASSWORD_ENTRY_MAX_NUM);
+}
+
+/**
+ * Sends a window of the folder names. Vaults without folders have none.
+*/
+static void send_folders(uint32_t offset, uint8_t count)
+{
+	struct password_page page = {
+		.offset = offset,
+	};
+	struct vault_folder folder;
+	size_t entries_len = 0;
+	int err;
+
+	err = vault_read_start();
+	if (err)
+	{
+		LOG_WRN("Could not load password file: %d", err);
+		return;
+	}
+	if (vault_format == VAULT_FORMAT_BINARY && bin_vault.folder_count > 0)
+	{
+		page.total = bin_vault.folder_count;
+		count = MIN(count, CONFIG_PASSWORD_ENTRY_MAX_NUM);
+		for (uint32_t i = offset; !err && i < page.total && page.count < count; i++)
+		{
+			err = parse_bin_get_folder_read(vault_read, &bin_vault, i, record_buf, sizeof(record_buf), &folder);
+			if (!err)
+			{
+				err = parse_append_entry(page.entries, sizeof(page.entries), &entries_len,
+							 folder.name, folder.name_len);
+				page.count++;
+			}
+		}
+	}
+	vault_read_end();
+	if (err)
+	{
+		LOG_WRN("Could not read folders: %d", err);
+		return;
+	}
+	if (entries_len > 0)
+	{
+		page.entries[entries_len - 1] = '\0'; //remove trailing tab
+	}
+	struct password_module_event *event = new_password_module_event();
+	event->type = PASSWORD_EVT_READ_FOLDERS;
+	event->data.page = page;
+	EVENT_SUBMIT(event);
+}
+
+/**
+ * Opens a folder, so that platforms are listed from it, and sends the first
+ * page of its platforms. Only the folder entry is read.
+ * @return Negative ERRNO on failure. 0 on success.
+*/
+static int open_folder_by_name(const char *name)
+{
+	int err = vault_read_start();
+	if (err)
+	{
+		return err;
+	}
+	if (vault_format != VAULT_FORMAT_BINARY || bin_vault.folder_count == 0)
+	{
+		vault_read_end();
+		return -ENOTSUP;
+	}
+	err = parse_bin_find_folder_read(vault_read, &bin_vault, name, record_buf, sizeof(record_buf), &open_folder);
+	vault_read_end();
+	if (!err && open_folder.name_len >= sizeof(open_folder_name))
+	{
+		err = -ENAMETOOLONG;
+	}
+	if (err)
+	{
+		LOG_WRN("Could not open folder %s: %d", log_strdup(name), err);
+		return err;
+	}
+	memcpy(open_folder_name, open_folder.name, open_folder.name_len);
+	open_folder_name[open_folder.name_len] = '\0';
+	open_folder.name = open_folder_name;
+	folder_open = true;
+	page_cache_generation = 0;
+	LOG_DBG("Opened folder %s with %d platforms", log_strdup(open_folder_name), open_folder.count);
+	send_available_accounts(0, CONFIG_PASSWORD_ENTRY_MAX_NUM);
+	return 0;
+}
+
 //========================================================================================
 /*                                                                                      *
  *                                    Event handlers                                    *
@@ -197,30 +1060,48 @@ static void module_thread_fn(void)
 
 		module_get_next_msg(&self, &msg, K_FOREVER);
 		if (IS_EVENT((&msg), display, DISPLAY_EVT_REQUEST_PLATFORMS)) {
-			file_extract_content(encrypted_buf, READ_BUF_LEN);
-			get_available_accounts();
-			struct password_module_event *event = new_password_module_event();
-			event->type = PASSWORD_EVT_READ_PLATFORMS;
-			memcpy(event->data.entries, entries_buf, ENTRIES_BUF_MAX_LEN * sizeof(uint8_t));
-			EVENT_SUBMIT(event);
+			send_available_accounts(msg.module.display.data.page.offset,
+						msg.module.display.data.page.count);
+		}
+		if (IS_EVENT((&msg), display, DISPLAY_EVT_REQUEST_FOLDERS)) {
+			send_folders(msg.module.display.data.page.offset,
+				     msg.module.display.data.page.count);
+		}
+		if (IS_EVENT((&msg), display, DISPLAY_EVT_JUMP_PLATFORMS)) {
+			jump_platforms(&msg.module.display.data.jump);
+		}
+		if (IS_EVENT((&msg), display, DISPLAY_EVT_FOLDER_CHOSEN)) {
+			char choice[CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN + 1] = {0};
+			strncpy(choice, msg.module.display.data.choice, CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN);
+			open_folder_by_name(choice);
 		}
 		if (IS_EVENT((&msg), display, DISPLAY_EVT_PLATFORM_CHOSEN)) {
-			decrypt_file();
-			char choice[CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN];
+			char choice[CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN + 1] = {0};
 			strncpy(choice, msg.module.display.data.choice, CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN);
-			char password[100]; //TODO: Make configurable
-			get_password(plaintext_buf, choice, password, 100);
-			LOG_DBG("Password: %s", log_strdup(password));
+			/* Accounts in folders are named "folder/name" */
+			char account[2 * (CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN + 1)];
+			if (folder_open)
+			{
+				snprintf(account, sizeof(account), "%s%c%s", open_folder_name, VAULT_FOLDER_SEPARATOR, choice);
+			}
+			else
+			{
+				strcpy(account, choice);
+			}
+			char password[PASSWORD_MAX_LEN];
+			err = get_account_password(account, password, sizeof(password));
+			if (!err)
+			{
+				LOG_DBG("Password: %s", log_strdup(password));
+			}
+			memset(password, 0, sizeof(password));
 		}
 		if (IS_EVENT((&msg), download, DOWNLOAD_EVT_DOWNLOAD_FINISHED)) {
+			folder_open = false;
 			/* Temporarily react to this event. Should react to DISPLAY_EVT_REQUEST_PLATFORMS 
 			   when we start supporting folder structure.*/
-			file_extract_content(encrypted_buf, READ_BUF_LEN);
-			get_available_accounts();
-			struct password_module_event *event = new_password_module_event();
-			event->type = PASSWORD_EVT_READ_PLATFORMS;
-			memcpy(event->data.entries, entries_buf, ENTRIES_BUF_MAX_LEN * sizeof(uint8_t));
-			EVENT_SUBMIT(event);
+			send_folders(0, CONFIG_PASSWORD_ENTRY_MAX_NUM);
+			send_available_accounts(0, CONFIG_PASSWORD_ENTRY_MAX_NUM);
 		}
 	}
 }
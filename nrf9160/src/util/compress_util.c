@@ -0,0 +1,211 @@
+#include <zephyr.h>
+#include <string.h>
+#include <sys/util.h>
+#include <sys/byteorder.h>
+#include "compress_util.h"
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(compress_util, CONFIG_COMPRESS_UTIL_LOG_LEVEL);
+
+#define MATCH_MIN_LEN 3
+#define INPUT_CHUNK_LEN 64
+
+/* Compressed bytes of a block, read from the container a chunk at a time */
+struct block_input
+{
+    compress_read_t read;
+    size_t pos;
+    size_t end;
+    size_t len;
+    size_t next;
+    uint8_t buf[INPUT_CHUNK_LEN];
+};
+
+/**
+ * @brief Check whether a file starts with a compressed container.
+ */
+bool compress_is_compressed(const void *buf, size_t len)
+{
+    return len >= sizeof(COMPRESS_MAGIC) - 1 && !memcmp(buf, COMPRESS_MAGIC, sizeof(COMPRESS_MAGIC) - 1);
+}
+
+/**
+ * @brief Read the header of a compressed container from its first
+ * COMPRESS_HEADER_LEN bytes.
+ *
+ * @return 0 on success, -EINVAL if the header is malformed, -ENOTSUP for
+ * unsupported versions or blocks larger than CONFIG_COMPRESS_UTIL_BLOCK_MAX_LEN.
+ */
+int compress_read_header(const uint8_t *buf, size_t len, struct compress_vault *vault)
+{
+    if (len < COMPRESS_HEADER_LEN || !compress_is_compressed(buf, len))
+    {
+        LOG_ERR("Not a compressed vault");
+        return -EINVAL;
+    }
+    if (buf[4] != COMPRESS_VERSION)
+    {
+        LOG_ERR("Unsupported compressed vault version %d", buf[4]);
+        return -ENOTSUP;
+    }
+    vault->block_shift = buf[5];
+    if (vault->block_shift >= 16 || BIT(vault->block_shift) > sizeof(vault->buf))
+    {
+        LOG_ERR("Compressed blocks too large, consider increasing CONFIG_COMPRESS_UTIL_BLOCK_MAX_LEN");
+        return -ENOTSUP;
+    }
+    vault->plain_len = sys_get_le32(&buf[8]);
+    vault->block_count = sys_get_le32(&buf[12]);
+    if (vault->block_count != DIV_ROUND_UP(vault->plain_len, BIT(vault->block_shift)))
+    {
+        LOG_ERR("Malformed compressed vault header");
+        return -EINVAL;
+    }
+    compress_invalidate(vault);
+    return 0;
+}
+
+static int next_byte(struct block_input *in)
+{
+    if (in->next == in->len)
+    {
+        if (in->pos >= in->end)
+        {
+            return -EINVAL;
+        }
+        int rc = in->read(in->pos, in->buf, MIN(sizeof(in->buf), in->end - in->pos));
+        if (rc <= 0)
+        {
+            return rc < 0 ? rc : -EINVAL;
+        }
+        in->pos += rc;
+        in->len = rc;
+        in->next = 0;
+    }
+    return in->buf[in->next++];
+}
+
+/**
+ * @brief Decompress block number `i` into the buffer of the vault.
+ *
+ * @return 0 on success, -EINVAL if the block is malformed, negative errno
+ * from read on failure.
+ */
+static int load_block(struct compress_vault *vault, compress_read_t read, uint32_t i)
+{
+    uint8_t offsets[2 * sizeof(uint32_t)];
+    size_t block_len = MIN(BIT(vault->block_shift), vault->plain_len - (i << vault->block_shift));
+    struct block_input in = {
+        .read = read,
+    };
+    size_t out = 0;
+    uint8_t flags = 0;
+    int bits = 0;
+    int c;
+
+    vault->cached_block = vault->block_count;
+    int rc = read(COMPRESS_HEADER_LEN + i * sizeof(uint32_t), offsets, sizeof(offsets));
+    if (rc >= 0 && rc != sizeof(offsets))
+    {
+        rc = -EINVAL;
+    }
+    if (rc < 0)
+    {
+        return rc;
+    }
+    in.pos = sys_get_le32(offsets);
+    in.end = sys_get_le32(&offsets[4]);
+
+    while (out < block_len)
+    {
+        if (bits == 0)
+        {
+            c = next_byte(&in);
+            if (c < 0)
+            {
+                return c;
+            }
+            flags = c;
+            bits = 8;
+        }
+        bool literal = flags & 1;
+        flags >>= 1;
+        bits--;
+        c = next_byte(&in);
+        if (c < 0)
+        {
+            return c;
+        }
+        if (literal)
+        {
+            vault->buf[out++] = c;
+            continue;
+        }
+        int high = next_byte(&in);
+        if (high < 0)
+        {
+            return high;
+        }
+        size_t dist = (c | (high & 0x0f) << 8) + 1;
+        size_t len = (high >> 4) + MATCH_MIN_LEN;
+        if (dist > out || len > block_len - out)
+        {
+            LOG_ERR("Block %d is malformed", i);
+            return -EINVAL;
+        }
+        /* Byte by byte, matches may overlap the bytes they produce */
+        for (; len > 0; len--, out++)
+        {
+            vault->buf[out] = vault->buf[out - dist];
+        }
+    }
+    vault->cached_block = i;
+    return 0;
+}
+
+/**
+ * @brief Read bytes of the decompressed vault. Only the blocks holding them
+ * are decompressed, and the last block is kept for the next read.
+ *
+ * @param read Function reading the compressed container.
+ * @param offset Position in the decompressed vault.
+ * @return Number of bytes read on success, fewer than len at the end of the
+ * vault. -EINVAL if the container is malformed, negative errno from read on
+ * failure.
+ */
+int compress_read(struct compress_vault *vault, compress_read_t read, size_t offset, void *buf, size_t len)
+{
+    uint8_t *to = buf;
+    size_t done = 0;
+
+    while (done < len && offset < vault->plain_len)
+    {
+        uint32_t block = offset >> vault->block_shift;
+        if (block != vault->cached_block)
+        {
+            int err = load_block(vault, read, block);
+            if (err)
+            {
+                compress_invalidate(vault);
+                return err;
+            }
+        }
+        size_t pos = offset - (block << vault->block_shift);
+        size_t block_len = MIN(BIT(vault->block_shift), vault->plain_len - (block << vault->block_shift));
+        size_t n = MIN(len - done, block_len - pos);
+        memcpy(&to[done], &vault->buf[pos], n);
+        done += n;
+        offset += n;
+    }
+    return done;
+}
+
+/**
+ * @brief Forget the block held by the vault, and wipe the decompressed bytes
+ * from RAM. The next read decompresses its block again.
+ */
+void compress_invalidate(struct compress_vault *vault)
+{
+    memset(vault->buf, 0, sizeof(vault->buf));
+    vault->cached_block = vault->block_count;
+}
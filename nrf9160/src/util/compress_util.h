@@ -0,0 +1,42 @@
+/*
+ * Compressed vault layout, all integers little endian:
+ *
+ *   magic "SKYZ" | version u8 | block_shift u8 | reserved u8[2]
+ *   plain_len u32 | block_count u32
+ *   block offsets, u32[block_count + 1], from the start of the container
+ *   blocks
+ *
+ * The vault is cut into blocks of 2^block_shift bytes, the last one may be
+ * shorter, and each block is compressed on its own. Any byte can then be
+ * read by decompressing only the block that holds it.
+ *
+ * A block is an LZSS stream. Each flag byte describes the next eight items,
+ * least significant bit first. A set bit is a literal byte. A clear bit is a
+ * match of two bytes: distance - 1 in the low 12 bits and length - 3 in the
+ * high 4 bits, copying 3 to 18 bytes from earlier in the same block.
+ *
+ * The container can hold a TSV or binary vault, and can itself be encrypted
+ * (see crypto_util.h). Use scripts/vault_tool.py to compress a vault.
+ */
+#define COMPRESS_MAGIC "SKYZ"
+#define COMPRESS_VERSION 1
+#define COMPRESS_HEADER_LEN 16
+
+/* Reads up to `len` bytes at `offset`. Returns the number of bytes read or a negative errno. */
+typedef int (*compress_read_t)(size_t offset, void *buf, size_t len);
+
+/* Handle to a compressed vault, holding the last decompressed block until
+ * compress_invalidate wipes it. */
+struct compress_vault
+{
+    uint32_t plain_len;
+    uint32_t block_count;
+    uint8_t block_shift;
+    uint32_t cached_block;      /* Block held in buf, block_count if none */
+    uint8_t buf[CONFIG_COMPRESS_UTIL_BLOCK_MAX_LEN];
+};
+
+bool compress_is_compressed(const void *buf, size_t len);
+int compress_read_header(const uint8_t *buf, size_t len, struct compress_vault *vault);
+int compress_read(struct compress_vault *vault, compress_read_t read, size_t offset, void *buf, size_t len);
+void compress_invalidate(struct compress_vault *vault);
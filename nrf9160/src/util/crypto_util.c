@@ -0,0 +1,359 @@
+#include <zephyr.h>
+#include <string.h>
+#include <sys/util.h>
+#include <sys/byteorder.h>
+#include "crypto_util.h"
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(crypto_util, CONFIG_CRYPTO_UTIL_LOG_LEVEL);
+
+#define KEY_LEN 16
+
+BUILD_ASSERT(sizeof(CONFIG_CRYPTO_UTIL_VAULT_KEY) - 1 == 2 * KEY_LEN,
+             "CONFIG_CRYPTO_UTIL_VAULT_KEY must be 32 hex characters");
+
+static uint8_t key[KEY_LEN];
+static bool key_loaded;
+
+static int load_key(void)
+{
+    if (key_loaded)
+    {
+        return 0;
+    }
+    if (hex2bin(CONFIG_CRYPTO_UTIL_VAULT_KEY, 2 * KEY_LEN, key, sizeof(key)) != KEY_LEN)
+    {
+        LOG_ERR("Invalid vault key");
+        return -EINVAL;
+    }
+    key_loaded = true;
+    return 0;
+}
+
+/**
+ * @brief Check whether a file starts with the encrypted vault magic.
+ */
+bool crypto_is_encrypted(const void *buf, size_t len)
+{
+    return len >= sizeof(CRYPTO_MAGIC) - 1 && !memcmp(buf, CRYPTO_MAGIC, sizeof(CRYPTO_MAGIC) - 1);
+}
+
+/**
+ * @brief Validate the header of an encrypted vault.
+ *
+ * @param buf Start of the file, at least CRYPTO_HEADER_MAX_LEN bytes unless
+ * the file is shorter.
+ * @param header Header to fill in.
+ * @return 0 on success, -EINVAL if this is not an encrypted vault, -ENOTSUP
+ * for unsupported versions.
+ */
+int crypto_read_header(const uint8_t *buf, size_t len, struct crypto_header *header)
+{
+    if (len < CRYPTO_HEADER_LEN || !crypto_is_encrypted(buf, len))
+    {
+        return -EINVAL;
+    }
+    header->version = buf[4];
+    switch (header->version)
+    {
+    case CRYPTO_VERSION:
+        header->header_len = CRYPTO_HEADER_LEN;
+        header->index_len = 0;
+        break;
+    case CRYPTO_VERSION_SPLIT:
+        if (len < CRYPTO_HEADER_SPLIT_LEN)
+        {
+            return -EINVAL;
+        }
+        header->header_len = CRYPTO_HEADER_SPLIT_LEN;
+        header->index_len = sys_get_le32(&buf[CRYPTO_HEADER_LEN]);
+        break;
+    default:
+        LOG_ERR("Unsupported encrypted vault version %d", header->version);
+        return -ENOTSUP;
+    }
+    memcpy(header->nonce, &buf[8], CRYPTO_NONCE_LEN);
+    return 0;
+}
+
+/**
+ * @brief Start authenticated decryption of a vault.
+ *
+ * @return 0 on success, negative errno on failure.
+ */
+int crypto_stream_start(struct crypto_stream *stream, const uint8_t *nonce)
+{
+    int err = load_key();
+    if (err)
+    {
+        return err;
+    }
+    mbedtls_gcm_init(&stream->gcm);
+    err = mbedtls_gcm_setkey(&stream->gcm, MBEDTLS_CIPHER_ID_AES, key, KEY_LEN * 8);
+    if (!err)
+    {
+        err = mbedtls_gcm_starts(&stream->gcm, MBEDTLS_GCM_DECRYPT, nonce, CRYPTO_NONCE_LEN, NULL, 0);
+    }
+    if (err)
+    {
+        LOG_ERR("Could not start decryption: %d", err);
+        mbedtls_gcm_free(&stream->gcm);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decrypt the next chunk of ciphertext in place. Every chunk except the
+ * last must be a multiple of CRYPTO_BLOCK_LEN bytes. The plaintext is not
+ * authenticated until crypto_stream_finish succeeds.
+ *
+ * @return 0 on success, negative errno on failure.
+ */
+int crypto_stream_update(struct crypto_stream *stream, uint8_t *buf, size_t len)
+{
+    int err = mbedtls_gcm_update(&stream->gcm, len, buf, buf);
+    if (err)
+    {
+        LOG_ERR("Decryption failed: %d", err);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finish decryption and check the authentication tag. Frees the stream.
+ *
+ * @param tag The CRYPTO_TAG_LEN bytes following the ciphertext.
+ * @return 0 if the vault is authentic, -EBADMSG if it is not.
+ */
+int crypto_stream_finish(struct crypto_stream *stream, const uint8_t *tag)
+{
+    uint8_t expected[CRYPTO_TAG_LEN];
+    uint8_t diff = 0;
+    int err = mbedtls_gcm_finish(&stream->gcm, expected, sizeof(expected));
+
+    mbedtls_gcm_free(&stream->gcm);
+    if (err)
+    {
+        LOG_ERR("Decryption failed: %d", err);
+        return -EIO;
+    }
+    /* Constant time comparison */
+    for (int i = 0; i < CRYPTO_TAG_LEN; i++)
+    {
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff)
+    {
+        LOG_ERR("Vault authentication failed");
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decrypt bytes at an arbitrary position of the ciphertext, in place.
+ * GCM encrypts with AES-CTR, starting from counter 2 for 12 byte nonces, so
+ * any block can be decrypted on its own. This does not authenticate anything
+ * and must only be used on a vault that crypto_stream_finish has accepted.
+ *
+ * @param offset Position of buf in the plaintext.
+ * @return 0 on success, negative errno on failure.
+ */
+int crypto_decrypt_at(const uint8_t *nonce, size_t offset, uint8_t *buf, size_t len)
+{
+    mbedtls_aes_context aes;
+    uint8_t counter[CRYPTO_BLOCK_LEN];
+    uint8_t stream_block[CRYPTO_BLOCK_LEN];
+    size_t nc_off = offset % CRYPTO_BLOCK_LEN;
+    int err = load_key();
+
+    if (err)
+    {
+        return err;
+    }
+    memcpy(counter, nonce, CRYPTO_NONCE_LEN);
+    sys_put_be32(2 + offset / CRYPTO_BLOCK_LEN, &counter[CRYPTO_NONCE_LEN]);
+
+    mbedtls_aes_init(&aes);
+    err = mbedtls_aes_setkey_enc(&aes, key, KEY_LEN * 8);
+    if (!err && nc_off)
+    {
+        /* Start in the middle of a block */
+        err = mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, counter, stream_block);
+        sys_put_be32(3 + offset / CRYPTO_BLOCK_LEN, &counter[CRYPTO_NONCE_LEN]);
+    }
+    if (!err)
+    {
+        err = mbedtls_aes_crypt_ctr(&aes, len, &nc_off, counter, stream_block, buf, buf);
+    }
+    mbedtls_aes_free(&aes);
+    if (err)
+    {
+        LOG_ERR("Decryption failed: %d", err);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the locator stored in the password field of a version 2 index.
+ *
+ * @return 0 on success, -EINVAL if the field is not a locator.
+ */
+int crypto_read_locator(const char *field, size_t len, struct crypto_locator *locator)
+{
+    const uint8_t *bytes = (const uint8_t *)field;
+
+    if (len != CRYPTO_LOCATOR_LEN)
+    {
+        return -EINVAL;
+    }
+    locator->offset = sys_get_le32(bytes);
+    locator->len = sys_get_le16(&bytes[4]);
+    if (locator->len < CRYPTO_NONCE_LEN + CRYPTO_TAG_LEN)
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Authenticate and decrypt a single password record in place.
+ *
+ * @param rec The whole record: nonce, ciphertext and tag.
+ * @param aad The account name the record belongs to.
+ * @param plaintext Set to the start of the plaintext inside rec.
+ * @return Length of the plaintext on success, -EBADMSG if the record is not
+ * authentic, other negative errno on failure.
+ */
+int crypto_decrypt_record(uint8_t *rec, size_t len, const char *aad, size_t aad_len, uint8_t **plaintext)
+{
+    mbedtls_gcm_context gcm;
+    uint8_t *text = &rec[CRYPTO_NONCE_LEN];
+    size_t text_len;
+    int err;
+
+    if (len < CRYPTO_NONCE_LEN + CRYPTO_TAG_LEN)
+    {
+        return -EINVAL;
+    }
+    err = load_key();
+    if (err)
+    {
+        return err;
+    }
+    text_len = len - CRYPTO_NONCE_LEN - CRYPTO_TAG_LEN;
+
+    mbedtls_gcm_init(&gcm);
+    err = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, KEY_LEN * 8);
+    if (!err)
+    {
+        err = mbedtls_gcm_auth_decrypt(&gcm, text_len, rec, CRYPTO_NONCE_LEN,
+                                       (const uint8_t *)aad, aad_len,
+                                       &text[text_len], CRYPTO_TAG_LEN, text, text);
+    }
+    mbedtls_gcm_free(&gcm);
+    if (err == MBEDTLS_ERR_GCM_AUTH_FAILED)
+    {
+        LOG_ERR("Password record authentication failed");
+        return -EBADMSG;
+    }
+    if (err)
+    {
+        LOG_ERR("Decryption failed: %d", err);
+        return -EIO;
+    }
+    *plaintext = text;
+    return text_len;
+}
+
+/**
+ * @brief Read a SHA-256 digest written as 64 hex characters.
+ *
+ * @param digest CRYPTO_DIGEST_LEN bytes to fill.
+ * @return 0 on success, -EINVAL if hex is not a digest.
+ */
+int crypto_digest_parse(const char *hex, uint8_t *digest)
+{
+    if (strlen(hex) != 2 * CRYPTO_DIGEST_LEN ||
+        hex2bin(hex, 2 * CRYPTO_DIGEST_LEN, digest, CRYPTO_DIGEST_LEN) != CRYPTO_DIGEST_LEN)
+    {
+        LOG_ERR("Invalid SHA-256 digest");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start hashing a file with SHA-256.
+ *
+ * @return 0 on success, negative errno on failure.
+ */
+int crypto_digest_start(struct crypto_digest *digest)
+{
+    mbedtls_sha256_init(&digest->sha);
+    int err = mbedtls_sha256_starts_ret(&digest->sha, 0);
+    if (err)
+    {
+        LOG_ERR("Could not start hashing: %d", err);
+        mbedtls_sha256_free(&digest->sha);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hash the next chunk of the file. Chunks may have any length.
+ *
+ * @return 0 on success, negative errno on failure.
+ */
+int crypto_digest_update(struct crypto_digest *digest, const void *buf, size_t len)
+{
+    int err = mbedtls_sha256_update_ret(&digest->sha, buf, len);
+    if (err)
+    {
+        LOG_ERR("Hashing failed: %d", err);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finish hashing and compare with the expected digest. Frees the digest.
+ *
+ * @param expected CRYPTO_DIGEST_LEN bytes.
+ * @return 0 if the digests match, -EBADMSG if they do not.
+ */
+int crypto_digest_finish(struct crypto_digest *digest, const uint8_t *expected)
+{
+    uint8_t actual[CRYPTO_DIGEST_LEN];
+    uint8_t diff = 0;
+    int err = mbedtls_sha256_finish_ret(&digest->sha, actual);
+
+    mbedtls_sha256_free(&digest->sha);
+    if (err)
+    {
+        LOG_ERR("Hashing failed: %d", err);
+        return -EIO;
+    }
+    for (int i = 0; i < CRYPTO_DIGEST_LEN; i++)
+    {
+        diff |= actual[i] ^ expected[i];
+    }
+    if (diff)
+    {
+        LOG_DBG("SHA-256 digest does not match");
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+/**
+ * @brief Free a digest that will not be finished.
+ */
+void crypto_digest_abort(struct crypto_digest *digest)
+{
+    mbedtls_sha256_free(&digest->sha);
+}
@@ -0,0 +1,85 @@
+#ifndef _CRYPTO_UTIL_H_
+#define _CRYPTO_UTIL_H_
+
+#include <mbedtls/aes.h>
+#include <mbedtls/gcm.h>
+#include <mbedtls/sha256.h>
+
+/*
+ * Encrypted vault layout, all integers little endian:
+ *
+ *   magic "SKYE" | version u8 | reserved u8[3] | nonce u8[12]
+ *   AES-128-GCM ciphertext of a TSV or binary vault
+ *   tag u8[16]
+ *
+ * Version 2 encrypts every password on its own, so a password can be read
+ * without decrypting the rest of the file:
+ *
+ *   magic "SKYE" | version u8 | reserved u8[3] | nonce u8[12] | index_len u32
+ *   AES-128-GCM ciphertext of the index, index_len bytes
+ *   tag u8[16]
+ *   password records:
+ *     nonce u8[12] | AES-128-GCM ciphertext of the password | tag u8[16]
+ *
+ * The index is a binary vault (see parse_util.h) where the password field of
+ * each record holds a locator instead: offset u32 of the password record
+ * from the start of the file | length u16 of the whole password record.
+ * The account name is the additional authenticated data of its password
+ * record, so records cannot be swapped between accounts.
+ *
+ * Use scripts/vault_tool.py to encrypt a vault.
+ */
+#define CRYPTO_MAGIC "SKYE"
+#define CRYPTO_VERSION 1
+#define CRYPTO_VERSION_SPLIT 2
+#define CRYPTO_NONCE_LEN 12
+#define CRYPTO_TAG_LEN 16
+#define CRYPTO_HEADER_LEN (8 + CRYPTO_NONCE_LEN)
+#define CRYPTO_HEADER_SPLIT_LEN (CRYPTO_HEADER_LEN + 4)
+#define CRYPTO_HEADER_MAX_LEN CRYPTO_HEADER_SPLIT_LEN
+#define CRYPTO_BLOCK_LEN 16
+#define CRYPTO_LOCATOR_LEN 6
+#define CRYPTO_DIGEST_LEN 32
+
+struct crypto_header
+{
+    uint8_t version;
+    uint8_t header_len;
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    uint32_t index_len;         /* Version 2 only */
+};
+
+/* Position of an encrypted password record in the file */
+struct crypto_locator
+{
+    uint32_t offset;
+    uint16_t len;
+};
+
+/* Authenticated decryption of a whole vault, one chunk at a time. */
+struct crypto_stream
+{
+    mbedtls_gcm_context gcm;
+};
+
+/* SHA-256 of a file, one chunk at a time. */
+struct crypto_digest
+{
+    mbedtls_sha256_context sha;
+};
+
+bool crypto_is_encrypted(const void *buf, size_t len);
+int crypto_read_header(const uint8_t *buf, size_t len, struct crypto_header *header);
+int crypto_stream_start(struct crypto_stream *stream, const uint8_t *nonce);
+int crypto_stream_update(struct crypto_stream *stream, uint8_t *buf, size_t len);
+int crypto_stream_finish(struct crypto_stream *stream, const uint8_t *tag);
+int crypto_decrypt_at(const uint8_t *nonce, size_t offset, uint8_t *buf, size_t len);
+int crypto_read_locator(const char *field, size_t len, struct crypto_locator *locator);
+int crypto_decrypt_record(uint8_t *rec, size_t len, const char *aad, size_t aad_len, uint8_t **plaintext);
+int crypto_digest_parse(const char *hex, uint8_t *digest);
+int crypto_digest_start(struct crypto_digest *digest);
+int crypto_digest_update(struct crypto_digest *digest, const void *buf, size_t len);
+int crypto_digest_finish(struct crypto_digest *digest, const uint8_t *expected);
+void crypto_digest_abort(struct crypto_digest *digest);
+
+#endif /* _CRYPTO_UTIL_H_ */
@@ -0,0 +1,82 @@
+#include <zephyr.h>
+#include <string.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+#include "download_stats.h"
+
+static struct k_spinlock stats_lock;
+static struct download_stats history[CONFIG_DOWNLOAD_STATS_HISTORY];
+static uint32_t added;          /* Downloads added since boot */
+
+/**
+ *  Counts one fragment of len bytes in the histogram of stats.
+ * */
+void download_stats_fragment(struct download_stats *stats, size_t len) {
+    int bucket = 0;
+
+    while (bucket < DOWNLOAD_STATS_HIST_LEN - 1 && len >= (128 << bucket)) {
+        bucket++;
+    }
+    stats->frag_hist[bucket]++;
+}
+
+/**
+ *  Adds the metrics of a finished download, replacing the oldest one once
+ * the ring is full.
+ * */
+void download_stats_add(const struct download_stats *stats) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    history[added % ARRAY_SIZE(history)] = *stats;
+    added++;
+    k_spin_unlock(&stats_lock, key);
+}
+
+/**
+ *  Copies the metrics of up to max downloads, newest first.
+ * @return The number of downloads copied.
+ * */
+int download_stats_get(struct download_stats *out, int max) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    int count = MIN(MIN(added, ARRAY_SIZE(history)), max);
+
+    for (int i = 0; i < count; i++) {
+        out[i] = history[(added - 1 - i) % ARRAY_SIZE(history)];
+    }
+    k_spin_unlock(&stats_lock, key);
+    return count;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_download_stats(const struct shell *shell, size_t argc, char **argv) {
+    struct download_stats s[CONFIG_DOWNLOAD_STATS_HISTORY];
+
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    int count = download_stats_get(s, ARRAY_SIZE(s));
+    if (count == 0) {
+        shell_print(shell, "no downloads since boot");
+    }
+    for (int i = 0; i < count; i++) {
+        shell_print(shell, "%d: result %d, %u B, %u B transferred, %u retries, RSRP %d dBm", i,
+                    s[i].result, s[i].size, s[i].transferred, s[i].retries, s[i].rsrp_dbm);
+        shell_print(shell, "  connect: %u ms, first byte: %u ms, %u ms at %u B/s", s[i].connect_ms,
+                    s[i].ttfb_ms, s[i].duration_ms, s[i].throughput);
+        shell_print(shell, "  fragment size: %u B", s[i].frag_size);
+        for (int j = 0; j < DOWNLOAD_STATS_HIST_LEN; j++) {
+            if (j < DOWNLOAD_STATS_HIST_LEN - 1) {
+                shell_print(shell, "  < %4u B: %u", 128 << j, s[i].frag_hist[j]);
+            } else {
+                shell_print(shell, "  >= %3u B: %u", 128 << (j - 1), s[i].frag_hist[j]);
+            }
+        }
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(download_cmds,
+    SHELL_CMD(stats, NULL, "Show metrics of the last downloads", cmd_download_stats),
+    SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(download, &download_cmds, "Password file download", NULL);
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Metrics of the last CONFIG_DOWNLOAD_STATS_HISTORY downloads, kept in a
+ * ring. Filled in by the download module and read by the shell and the
+ * cloud module.
+ */
+
+/* Number of buckets of the fragment size histogram */
+#define DOWNLOAD_STATS_HIST_LEN 7
+
+/* Bucket i of frag_hist counts fragments shorter than 128 << i bytes, the
+ * last bucket all longer ones. */
+struct download_stats
+{
+    int32_t result;             /* 0 or the negative errno the download ended with */
+    int16_t rsrp_dbm;           /* RSRP when the download started, 0 if unknown */
+    uint16_t retries;           /* Socket retries and resumes */
+    uint32_t connect_ms;        /* DNS lookup, TCP connect and TLS handshake */
+    uint32_t ttfb_ms;           /* From the request to the first fragment */
+    uint32_t duration_ms;       /* From the first fragment to the end */
+    uint32_t size;              /* Length of the file */
+    uint32_t transferred;       /* Bytes received, repeats included */
+    uint32_t frag_size;         /* Fragment size asked for, 0 for the default */
+    uint32_t throughput;        /* Bytes per second after the first fragment */
+    uint32_t frag_hist[DOWNLOAD_STATS_HIST_LEN];
+};
+
+void download_stats_fragment(struct download_stats *stats, size_t len);
+void download_stats_add(const struct download_stats *stats);
+int download_stats_get(struct download_stats *out, int max);
@@ -0,0 +1,126 @@
+#include <zephyr.h>
+#include <kernel.h>
+#include "file_lock.h"
+#include "file_util.h"
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(file_util, CONFIG_FILE_UTIL_LOG_LEVEL);
+
+/* Readers share the live password file, a writer gets it alone. A waiting
+ * writer blocks new readers, so password lookups can not starve a commit.
+ * Downloads go to a staging area and only need the lock to commit it. */
+static K_MUTEX_DEFINE(lock_mutex);
+static K_CONDVAR_DEFINE(lock_cond);
+static int readers;
+static int writers_waiting;
+static bool writer;
+/* Bumped each time the live file is replaced. Starts at 1, so 0 can stand
+ * for nothing loaded. */
+static uint32_t generation = 1;
+
+#define LOCK_TIMEOUT_MS 100
+/* A commit waits for the readers to finish, which may include a full load */
+#define WRITE_LOCK_TIMEOUT_MS 2000
+
+/**
+ *  Waits on lock_cond, for at most until the deadline.
+ *  Must be called with lock_mutex held.
+ * @return 0 when woken, -EAGAIN when the deadline has passed.
+ * */
+static int lock_wait(int64_t deadline) {
+    int64_t left = deadline - k_uptime_get();
+    if (left <= 0) {
+        return -EAGAIN;
+    }
+    k_condvar_wait(&lock_cond, &lock_mutex, K_MSEC(left));
+    return 0;
+}
+
+/**
+ *  Takes the password file for reading. Any number of readers may hold it
+ *  at once, but not while a writer does.
+ * @return 0 on success, -EAGAIN on timeout.
+ * */
+int file_lock_read(void) {
+    int64_t deadline = k_uptime_get() + LOCK_TIMEOUT_MS;
+    int rc = 0;
+
+    k_mutex_lock(&lock_mutex, K_FOREVER);
+    while (!rc && (writer || writers_waiting > 0)) {
+        rc = lock_wait(deadline);
+    }
+    if (!rc) {
+        readers++;
+    }
+    k_mutex_unlock(&lock_mutex);
+    if (rc) {
+        LOG_WRN("Could not acquire read lock");
+    }
+    return rc;
+}
+
+void file_unlock_read(void) {
+    k_mutex_lock(&lock_mutex, K_FOREVER);
+    if (--readers == 0) {
+        k_condvar_broadcast(&lock_cond);
+    }
+    k_mutex_unlock(&lock_mutex);
+}
+
+/**
+ *  Takes the password file for writing. Waits for the current readers to
+ *  finish.
+ * @return 0 on success, -EAGAIN on timeout.
+ * */
+int file_lock_write(void) {
+    int64_t deadline = k_uptime_get() + WRITE_LOCK_TIMEOUT_MS;
+    int rc = 0;
+
+    k_mutex_lock(&lock_mutex, K_FOREVER);
+    writers_waiting++;
+    while (!rc && (writer || readers > 0)) {
+        rc = lock_wait(deadline);
+    }
+    writers_waiting--;
+    if (!rc) {
+        writer = true;
+    } else {
+        /* Readers may have been held back by this writer */
+        k_condvar_broadcast(&lock_cond);
+    }
+    k_mutex_unlock(&lock_mutex);
+    if (rc) {
+        LOG_WRN("Could not acquire write lock");
+    }
+    return rc;
+}
+
+void file_unlock_write(void) {
+    k_mutex_lock(&lock_mutex, K_FOREVER);
+    writer = false;
+    k_condvar_broadcast(&lock_cond);
+    k_mutex_unlock(&lock_mutex);
+}
+
+/**
+ *  Records that the live password file was replaced.
+ *  Must be called with the write lock held.
+ * */
+void file_lock_changed(void) {
+    k_mutex_lock(&lock_mutex, K_FOREVER);
+    generation++;
+    k_mutex_unlock(&lock_mutex);
+}
+
+/**
+ *  Gets the number of the live password file, which changes each time it is
+ *  replaced. Only stable while the read or write lock is held.
+ * @return Generation of the live file.
+ * */
+uint32_t file_generation(void) {
+    uint32_t gen;
+    k_mutex_lock(&lock_mutex, K_FOREVER);
+    gen = generation;
+    k_mutex_unlock(&lock_mutex);
+    return gen;
+}
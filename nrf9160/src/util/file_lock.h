@@ -0,0 +1,9 @@
+/*
+ * Reader/writer lock of the stored password file, shared by the storage
+ * backends. Readers share it, a writer gets it alone.
+ */
+int file_lock_read(void);
+void file_unlock_read(void);
+int file_lock_write(void);
+void file_unlock_write(void);
+void file_lock_changed(void);
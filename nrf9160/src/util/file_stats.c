@@ -0,0 +1,85 @@
+#include <zephyr.h>
+#include <string.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+#include "file_util.h"
+#include "file_stats.h"
+
+static struct k_spinlock stats_lock;
+static struct file_stats stats;
+
+void file_stats_mount(uint32_t us) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    stats.mounts++;
+    stats.mount_us = us;
+    k_spin_unlock(&stats_lock, key);
+}
+
+void file_stats_read(size_t len) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    stats.bytes_read += len;
+    k_spin_unlock(&stats_lock, key);
+}
+
+/**
+ *  Counts one write of len bytes that took us microseconds.
+ * */
+void file_stats_write(size_t len, uint32_t us) {
+    uint32_t ms = us / USEC_PER_MSEC;
+    int bucket = 0;
+
+    while (bucket < FILE_STATS_HIST_LEN - 1 && ms >= BIT(bucket)) {
+        bucket++;
+    }
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    stats.writes++;
+    stats.bytes_written += len;
+    stats.write_us_max = MAX(stats.write_us_max, us);
+    stats.write_hist[bucket]++;
+    k_spin_unlock(&stats_lock, key);
+}
+
+void file_stats_erase(uint32_t blocks) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    stats.erases += blocks;
+    k_spin_unlock(&stats_lock, key);
+}
+
+/**
+ *  Copies the storage counters collected since boot.
+ * */
+void file_stats_get(struct file_stats *out) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    *out = stats;
+    k_spin_unlock(&stats_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_storage_stats(const struct shell *shell, size_t argc, char **argv) {
+    struct file_stats s;
+
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    file_stats_get(&s);
+    shell_print(shell, "mounts: %u, last mount: %u us", s.mounts, s.mount_us);
+    shell_print(shell, "read: %u B, written: %u B in %u writes", s.bytes_read,
+                s.bytes_written, s.writes);
+    shell_print(shell, "erased blocks: %u", s.erases);
+    shell_print(shell, "slowest write: %u us", s.write_us_max);
+    for (int i = 0; i < FILE_STATS_HIST_LEN; i++) {
+        if (i < FILE_STATS_HIST_LEN - 1) {
+            shell_print(shell, "  < %4u ms: %u", BIT(i), s.write_hist[i]);
+        } else {
+            shell_print(shell, "  >= %3u ms: %u", BIT(i - 1), s.write_hist[i]);
+        }
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(storage_cmds,
+    SHELL_CMD(stats, NULL, "Show storage counters", cmd_storage_stats),
+    SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(storage, &storage_cmds, "Password file storage", NULL);
+#endif
@@ -0,0 +1,8 @@
+/*
+ * Recording side of the storage counters read with file_stats_get. Called
+ * by the storage backends.
+ */
+void file_stats_mount(uint32_t us);
+void file_stats_read(size_t len);
+void file_stats_write(size_t len, uint32_t us);
+void file_stats_erase(uint32_t blocks);
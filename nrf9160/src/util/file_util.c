@@ -1,6 +1,7 @@
 #ifndef _FILE_UTIL_
 #define _FILE_UTIL_
 #include <stdio.h>
+#include <string.h>
 
 #include <zephyr.h>
 #include <device.h>
@@ -10,6 +11,8 @@
 
 #include <kernel.h> 
 #include "file_util.h"
+#include "file_lock.h"
+#include "file_stats.h"
 
 
 #include <logging/log.h>
@@ -20,7 +23,8 @@ LOG_MODULE_REGISTER(file_util, CONFIG_FILE_UTIL_LOG_LEVEL);
 
 static int log_contents(void);
 
-static K_MUTEX_DEFINE(fs_mutex);
+/* Serializes the mount. Access to the files is guarded by file_lock.h. */
+static K_MUTEX_DEFINE(mount_mutex);
 
 FS_LITTLEFS_DECLARE_DEFAULT_CONFIG(storage);
 static struct fs_mount_t lfs_storage_mnt = {
@@ -31,21 +35,73 @@ static struct fs_mount_t lfs_storage_mnt = {
 };
 
 struct fs_mount_t *mp = &lfs_storage_mnt;
+static bool mounted;
 
 char filename[MAX_PATH_LEN];
-struct fs_file_t file;
+static char staging_name[MAX_PATH_LEN];
+static char backup_name[MAX_PATH_LEN];
+static bool staging_open;
+static struct fs_file_t write_file;
+static struct fs_file_t base_file;
 
-int mount_fs(void) {
+/* Fragments are collected here and written to the staging file in whole
+ * buffers, so littlefs programs whole cache lines instead of whatever size
+ * the download client delivers. Only the tail is written short. */
+BUILD_ASSERT(CONFIG_FILE_UTIL_WRITE_BUF_SIZE % CONFIG_FS_LITTLEFS_CACHE_SIZE == 0,
+             "The write buffer must hold whole littlefs cache lines");
+static uint8_t write_buf[CONFIG_FILE_UTIL_WRITE_BUF_SIZE];
+static size_t write_buf_len;
+
+/* Counted per download, to compare against the number of fragments */
+static uint32_t write_fragments;
+static uint32_t write_ops;
+static size_t write_bytes;
+
+/**
+ *  Tells whether a file exists.
+ * */
+static bool file_exists(const char *path) {
+    struct fs_dirent entry;
+    return fs_stat(path, &entry) == 0;
+}
+
+/**
+ *  Finishes or undoes a commit that was interrupted by a reset. The staging
+ *  file of an interrupted download is kept for file_write_resume, the next
+ *  file_write_start deletes it.
+ * */
+static void recover_files(void) {
+    if (!file_exists(filename) && file_exists(backup_name)) {
+        LOG_WRN("Password file missing, restoring the backup");
+        fs_rename(backup_name, filename);
+    }
+}
+
+/* Erase callback of the littlefs block device, wrapped to count erases */
+static int (*lfs_erase)(const struct lfs_config *c, lfs_block_t block);
+
+static int count_erase(const struct lfs_config *c, lfs_block_t block) {
+    file_stats_erase(1);
+    return lfs_erase(c, block);
+}
+
+/**
+ *  Mounts the file system the first time it is used. It then stays mounted,
+ *  so later accesses do not pay for the littlefs mount scan.
+ *  Must be called with mount_mutex held.
+ * @return 0 on success, on fail: negative errno.
+ * */
+static int mount_fs(void) {
     int rc;
-    rc = k_mutex_lock(&fs_mutex, K_MSEC(100));
-    if (rc < 0)
-    {
-        LOG_WRN("Could not acquire mutex");
-        return rc;
+    if (mounted) {
+        return 0;
     }
     unsigned int id = (uintptr_t)mp->storage_dev;
+    uint32_t start = k_cycle_get_32();
 
     snprintf(filename, sizeof(filename), "%s/my_passwords", mp->mnt_point);
+    snprintf(staging_name, sizeof(staging_name), "%s.tmp", filename);
+    snprintf(backup_name, sizeof(backup_name), "%s.bak", filename);
 
     rc = fs_mount(mp);
     if (rc < 0)
@@ -53,93 +109,486 @@ int mount_fs(void) {
          LOG_ERR("FAIL: mount id %u at %s: %d",
                  id, mp->mnt_point,
                  rc);
-        k_mutex_unlock(&fs_mutex);
         return rc;
     }
-    LOG_DBG("%s mount: %d", mp->mnt_point, rc);
-
+    mounted = true;
+    /* littlefs calls the block device through this config from now on */
+    lfs_erase = storage.cfg.erase;
+    storage.cfg.erase = count_erase;
+    recover_files();
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    file_stats_mount(us);
+    LOG_INF("%s mounted in %d us", mp->mnt_point, us);
     return 0;
 }
+
 /**
- *  Mounts the file system and deletes the old password file
+ *  Mounts the file system if needed, without taking the lock.
  * @return 0 on success, on fail: negative errno.
  * */
-int file_write_start(void) {
+static int mount_unlocked(void) {
     int rc;
+    k_mutex_lock(&mount_mutex, K_FOREVER);
     rc = mount_fs();
+    k_mutex_unlock(&mount_mutex);
+    return rc;
+}
+
+/**
+ *  Takes the file system for reading, mounting it if needed.
+ * @return 0 on success, on fail: negative errno.
+ * */
+static int lock_read(void) {
+    int rc = mount_unlocked();
+    return rc ? rc : file_lock_read();
+}
+
+/**
+ *  Takes the file system for writing, mounting it if needed.
+ * @return 0 on success, on fail: negative errno.
+ * */
+static int lock_write(void) {
+    int rc = mount_unlocked();
+    return rc ? rc : file_lock_write();
+}
+
+/**
+ *  Opens an empty staging file for a new password file. The live file is
+ *  not touched, so it can still be read until file_write_commit replaces it.
+ *  Only one download may write at a time.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_write_start(void) {
+    int rc;
+    rc = mount_unlocked();
     if (rc < 0) {
         return rc;
     }
-    /* Delete the old file */
-    // TODO: Find a way to set the old file as backup
-    fs_unlink(filename);
-    fs_file_t_init(&file);
+    fs_unlink(staging_name);
+    fs_file_t_init(&write_file);
 
-    rc = fs_open(&file, filename, FS_O_CREATE | FS_O_APPEND);
+    rc = fs_open(&write_file, staging_name, FS_O_CREATE | FS_O_APPEND);
     if (rc < 0)
     {
         LOG_ERR("FAIL: %d", rc);
+        return rc;
     }
-    return rc;
+    staging_open = true;
+    write_buf_len = 0;
+    write_fragments = 0;
+    write_ops = 0;
+    write_bytes = 0;
+    return 0;
 }
 
 /**
- * Append the fragment to the password file
+ *  Writes bytes to the staging file in one fs_write.
+ * @return 0 on success, negative errno on failure.
+ * */
+static int write_out(const void *data, size_t len) {
+    uint32_t start = k_cycle_get_32();
+    int rc;
+    rc = fs_write(&write_file, data, len);
+    file_stats_write(MAX(rc, 0), k_cyc_to_us_floor32(k_cycle_get_32() - start));
+    write_ops++;
+    if (rc >= 0 && rc != len) {
+        return -ENOSPC;
+    }
+    if (rc < 0) {
+        return rc;
+    }
+    write_bytes += len;
+    return 0;
+}
+
+/**
+ * Append the fragment to the staging file. Only whole write buffers are
+ * written, the rest is kept until the next fragment or the commit.
  * @param fragment data to append
  * @param frag_size 
  * @return 0 on success, negative errno on failure.
  * */
 int file_write(const void* const fragment, size_t frag_size) {
+    const uint8_t *data = fragment;
     int rc;
-    rc = fs_write(&file, fragment, frag_size);
+
+    write_fragments++;
+    if (write_buf_len > 0) {
+        size_t len = MIN(frag_size, sizeof(write_buf) - write_buf_len);
+        memcpy(&write_buf[write_buf_len], data, len);
+        write_buf_len += len;
+        data += len;
+        frag_size -= len;
+        if (write_buf_len < sizeof(write_buf)) {
+            return 0;
+        }
+        write_buf_len = 0;
+        rc = write_out(write_buf, sizeof(write_buf));
+        if (rc) {
+            return rc;
+        }
+    }
+    /* Whole buffers are written straight from the fragment */
+    size_t whole = ROUND_DOWN(frag_size, sizeof(write_buf));
+    if (whole > 0) {
+        rc = write_out(data, whole);
+        if (rc) {
+            return rc;
+        }
+    }
+    memcpy(write_buf, &data[whole], frag_size - whole);
+    write_buf_len = frag_size - whole;
+    return 0;
+}
+
+/**
+ *  Closes and deletes the staging file. The live file is kept.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_write_abort(void) {
+    if (!staging_open) {
+        return 0;
+    }
+    staging_open = false;
+    write_buf_len = 0;
+    fs_close(&write_file);
+    return fs_unlink(staging_name);
+}
+
+/**
+ *  Makes the bytes written to the staging file so far durable. Bytes still
+ *  in the write buffer are not counted, so no short write is forced.
+ * @return On success: offset a download can be resumed from after a reset.
+ * On fail: negative errno.
+ * */
+int file_write_sync(void) {
+    int rc;
+    if (!staging_open) {
+        return -EINVAL;
+    }
+    rc = fs_sync(&write_file);
+    return rc < 0 ? rc : write_bytes;
+}
+
+/**
+ *  Gets the size of the write buffer, which is programmed in one piece.
+ *  Fragments that are a multiple of it fill the buffer evenly.
+ * @return Size in bytes.
+ * */
+size_t file_write_block_size(void) {
+    return sizeof(write_buf);
+}
+
+/**
+ *  Gets the size of the largest file that can be staged. littlefs sets no
+ *  limit of its own, running out of blocks is reported by file_write.
+ * @return Size in bytes.
+ * */
+size_t file_write_max_size(void) {
+    return SIZE_MAX;
+}
+
+/**
+ *  Continues a download interrupted by a reset. The staging file is opened
+ *  again and cut back to offset bytes. The live file is not touched.
+ * @param offset Value returned by file_write_sync before the reset.
+ * @param cb If not NULL, called with the kept bytes in chunks of
+ * read_buf_size, e.g. to hash them again.
+ * @return 0 on success, -ENOENT if the staging file is missing or shorter
+ * than offset, the non-zero return value of cb, on fail: negative errno.
+ * */
+int file_write_resume(size_t offset, void *read_buf, size_t read_buf_size, file_chunk_cb_t cb, void *user_data) {
+    int rc;
+    rc = mount_unlocked();
+    if (rc < 0) {
+        return rc;
+    }
+    fs_file_t_init(&write_file);
+    rc = fs_open(&write_file, staging_name, FS_O_RDWR | FS_O_APPEND);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = fs_seek(&write_file, 0, FS_SEEK_END);
+    if (!rc && fs_tell(&write_file) < offset) {
+        rc = -ENOENT;
+    }
+    if (!rc) {
+        rc = fs_truncate(&write_file, offset);
+    }
+    for (size_t pos = 0; !rc && cb && pos < offset; pos += read_buf_size) {
+        rc = fs_seek(&write_file, pos, FS_SEEK_SET);
+        if (!rc) {
+            rc = fs_read(&write_file, read_buf, MIN(read_buf_size, offset - pos));
+            rc = rc < 0 ? rc : cb(read_buf, rc, pos, user_data);
+        }
+    }
+    if (rc) {
+        fs_close(&write_file);
+        return rc;
+    }
+    staging_open = true;
+    write_buf_len = 0;
+    write_fragments = 0;
+    write_ops = 0;
+    write_bytes = offset;
+    return 0;
+}
+
+/**
+ *  Closes the staging file and, if it holds expected_len bytes, makes it the
+ *  live password file. The previous live file is kept as a backup. Renames
+ *  are atomic in littlefs, and a reset between them is recovered on mount,
+ *  so there always is a usable password file if there was one before. If
+ *  the second rename fails, the first one is undone.
+ * @param expected_len Size the complete file must have.
+ * @return 0 on success, on fail: negative errno. The staging file is
+ * deleted either way.
+ * */
+int file_write_commit(size_t expected_len) {
+    struct fs_dirent entry;
+    int rc;
+
+    if (!staging_open) {
+        return -EINVAL;
+    }
+    staging_open = false;
+    rc = write_buf_len > 0 ? write_out(write_buf, write_buf_len) : 0;
+    write_buf_len = 0;
+    if (!rc) {
+        rc = fs_close(&write_file);
+    } else {
+        fs_close(&write_file);
+    }
+    LOG_INF("Stored %d bytes from %d fragments in %d writes", write_bytes,
+            write_fragments, write_ops);
+    if (!rc) {
+        rc = fs_stat(staging_name, &entry);
+    }
+    if (!rc && entry.size != expected_len) {
+        LOG_ERR("Staged file has %d of %d bytes", entry.size, expected_len);
+        rc = -EIO;
+    }
+    if (!rc) {
+        rc = lock_write();
+    }
+    if (rc) {
+        fs_unlink(staging_name);
+        return rc;
+    }
+    bool backed_up = false;
+    if (file_exists(filename)) {
+        rc = fs_rename(filename, backup_name);
+        backed_up = !rc;
+    }
+    if (!rc) {
+        rc = fs_rename(staging_name, filename);
+    }
+    if (rc && backed_up) {
+        /* Put the live file back before readers are let in again */
+        fs_rename(backup_name, filename);
+    }
+    file_lock_changed();
+    file_unlock_write();
+    if (rc) {
+        LOG_ERR("Could not commit password file: %d", rc);
+        fs_unlink(staging_name);
+    }
     return rc;
 }
 
 /**
- *  Reads the bytes of a file into buffer.
- * @param read_buf buffer to put contents of password file into
- * @param read_buf_size Length of read buffer
- * @return On success: Number of bytes read. May be lower than read_buf_size 
- * if there were fewer bytes available than requested. 
- * On fail: negative errno code on error.
+ *  Replaces the live password file with the backup kept by the last commit,
+ *  e.g. when the new file turns out to be unreadable.
+ * @return 0 on success, -ENOENT if there is no backup, on fail: negative errno.
  * */
-int file_extract_content(void *read_buf, size_t read_buf_size) {
+int file_restore_backup(void) {
     int rc;
-    rc = mount_fs();
+    rc = lock_write();
     if (rc < 0) {
-        file_close_and_unmount();
-        LOG_ERR("Failed in mounting file system: %d", rc);
+        return rc;
+    }
+    if (file_exists(backup_name)) {
+        rc = fs_rename(backup_name, filename);
+    } else {
+        rc = -ENOENT;
+    }
+    if (!rc) {
+        file_lock_changed();
+    }
+    file_unlock_write();
+    if (!rc) {
+        LOG_WRN("Restored the previous password file");
+    }
+    return rc;
+}
+
+/**
+ *  Opens the password file for reading. Reads may run alongside other
+ *  readers, each with its own handle, but writes are blocked until
+ *  file_read_end is called.
+ * @param reader Handle of this reader, used until file_read_end.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_read_start(struct file_reader *reader) {
+    int rc;
+    uint32_t start = k_cycle_get_32();
+    rc = lock_read();
+    if (rc < 0) {
+        LOG_ERR("Failed in locking file system: %d", rc);
         return rc;
     }
 
-    rc = fs_open(&file, filename, FS_O_READ);
+    fs_file_t_init(&reader->file);
+    rc = fs_open(&reader->file, filename, FS_O_READ);
     if (rc < 0)
     {
-        file_close_and_unmount();
+        file_unlock_read();
         LOG_ERR("Failed in opening file: %d", rc);
         return rc;
     }
+    reader->generation = file_generation();
+    LOG_DBG("Opened file for reading in %d us",
+            k_cyc_to_us_floor32(k_cycle_get_32() - start));
+    return 0;
+}
 
-    rc = fs_read(&file, read_buf, read_buf_size);
+/**
+ *  Reads bytes from the password file opened by file_read_start.
+ * @param offset Position in the file to read from
+ * @param read_buf buffer to put the bytes into
+ * @param read_buf_size Number of bytes to read
+ * @return On success: Number of bytes read. May be lower than read_buf_size 
+ * if there were fewer bytes available than requested. 
+ * On fail: negative errno code on error.
+ * */
+int file_read_at(struct file_reader *reader, size_t offset, void *read_buf, size_t read_buf_size) {
+    int rc;
+    rc = fs_seek(&reader->file, offset, FS_SEEK_SET);
     if (rc < 0) {
-        file_close_and_unmount();
-        LOG_ERR("Failed in reading file: %d", rc);
+        LOG_ERR("Failed in seeking file: %d", rc);
         return rc;
     }
-    rc = file_close_and_unmount();
+    rc = fs_read(&reader->file, read_buf, read_buf_size);
+    if (rc < 0) {
+        LOG_ERR("Failed in reading file: %d", rc);
+    } else {
+        file_stats_read(rc);
+    }
     return rc;
 }
 
+/**
+ *  Gets the size of the password file opened by file_read_start.
+ * @return On success: size in bytes. On fail: negative errno code.
+ * */
+int file_size_get(struct file_reader *reader) {
+    int rc;
+    rc = fs_seek(&reader->file, 0, FS_SEEK_END);
+    if (rc < 0) {
+        return rc;
+    }
+    return fs_tell(&reader->file);
+}
+
+/**
+ *  Reads the password file opened by file_read_start in chunks of
+ *  read_buf_size bytes, starting at offset, and passes each chunk to cb.
+ *  Only read_buf is used, so RAM use does not depend on the file size.
+ * @param cb Called for each chunk. A non-zero return value stops the read.
+ * @return 0 when the end of the file was reached, the non-zero return value
+ * of cb, or negative errno code on read errors.
+ * */
+int file_read_chunks(struct file_reader *reader, size_t offset, void *read_buf, size_t read_buf_size,
+                     file_chunk_cb_t cb, void *user_data) {
+    int rc;
+    while (true) {
+        rc = file_read_at(reader, offset, read_buf, read_buf_size);
+        if (rc <= 0) {
+            return rc;
+        }
+        size_t len = rc;
+        rc = cb(read_buf, len, offset, user_data);
+        if (rc) {
+            return rc;
+        }
+        offset += len;
+    }
+}
 
-int file_close_and_unmount(void) {
+/**
+ *  littlefs files are not memory-mapped, they can only be read by copying.
+ * @return -ENOTSUP
+ * */
+int file_read_map(struct file_reader *reader, size_t offset, size_t len, const void **ptr) {
+    ARG_UNUSED(reader);
+    ARG_UNUSED(offset);
+    ARG_UNUSED(len);
+    ARG_UNUSED(ptr);
+    return -ENOTSUP;
+}
+
+/**
+ *  Closes the file opened by file_read_start. The file system stays mounted.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_read_end(struct file_reader *reader) {
     int rc;
 
-    fs_close(&file);
+    rc = fs_close(&reader->file);
 
     //log_contents(); //seems to cause stack overflow for now
 
-    rc = fs_unmount(mp);
-    k_mutex_unlock(&fs_mutex);
+    file_unlock_read();
+    return rc;
+}
+
+/**
+ *  Opens the password file as the base of a patch, with its own handle so
+ *  it can be read while file_read_start is used by others. Writes are
+ *  blocked until file_base_end is called, so end it before file_write_commit.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_base_start(void) {
+    int rc;
+    rc = lock_read();
+    if (rc < 0) {
+        return rc;
+    }
+    fs_file_t_init(&base_file);
+    rc = fs_open(&base_file, filename, FS_O_READ);
+    if (rc < 0) {
+        file_unlock_read();
+        LOG_ERR("Failed in opening base file: %d", rc);
+    }
+    return rc;
+}
+
+/**
+ *  Reads bytes from the file opened by file_base_start.
+ * @return On success: Number of bytes read, 0 at the end of the file.
+ * On fail: negative errno code.
+ * */
+int file_base_read_at(size_t offset, void *read_buf, size_t read_buf_size) {
+    int rc;
+    rc = fs_seek(&base_file, offset, FS_SEEK_SET);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = fs_read(&base_file, read_buf, read_buf_size);
+    if (rc > 0) {
+        file_stats_read(rc);
+    }
+    return rc;
+}
+
+/**
+ *  Closes the file opened by file_base_start.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_base_end(void) {
+    int rc;
+    rc = fs_close(&base_file);
+    file_unlock_read();
     return rc;
 }
 
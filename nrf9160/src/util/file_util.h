@@ -1,4 +1,58 @@
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+#include <fs/fs.h>
+#endif
+
+/* Number of buckets of the write latency histogram */
+#define FILE_STATS_HIST_LEN 8
+
+/* Storage counters since boot. Bucket i of write_hist counts writes that
+ * took less than 2^i ms, the last bucket all slower ones. */
+struct file_stats
+{
+    uint32_t mounts;
+    uint32_t mount_us;          /* Time the last mount took */
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t writes;
+    uint32_t write_us_max;
+    uint32_t write_hist[FILE_STATS_HIST_LEN];
+    uint32_t erases;            /* Flash blocks erased */
+};
+
+/* The password file opened by file_read_start. Every reader has its own, so
+ * any number of them can read at once. generation changes each time the
+ * file is replaced, so a reader can tell whether what it cached is stale. */
+struct file_reader
+{
+    uint32_t generation;
+#if defined(CONFIG_FILE_UTIL_BACKEND_RAW_FLASH)
+    const uint8_t *base;
+    size_t len;
+#else
+    struct fs_file_t file;
+#endif
+};
+
+/* Called with each chunk read by file_read_chunks and its offset in the file. */
+typedef int (*file_chunk_cb_t)(uint8_t *chunk, size_t len, size_t offset, void *user_data);
+
 int file_write_start(void);
 int file_write(const void *const fragment, size_t frag_size);
-int file_extract_content(void *read_buf, size_t read_buf_size);
-int file_close_and_unmount(void);
\ No newline at end of file
+int file_write_commit(size_t expected_len);
+int file_write_abort(void);
+int file_write_sync(void);
+size_t file_write_block_size(void);
+size_t file_write_max_size(void);
+int file_write_resume(size_t offset, void *read_buf, size_t read_buf_size, file_chunk_cb_t cb, void *user_data);
+int file_restore_backup(void);
+int file_read_start(struct file_reader *reader);
+int file_size_get(struct file_reader *reader);
+int file_read_at(struct file_reader *reader, size_t offset, void *read_buf, size_t read_buf_size);
+int file_read_map(struct file_reader *reader, size_t offset, size_t len, const void **ptr);
+int file_read_chunks(struct file_reader *reader, size_t offset, void *read_buf, size_t read_buf_size, file_chunk_cb_t cb, void *user_data);
+int file_read_end(struct file_reader *reader);
+int file_base_start(void);
+int file_base_read_at(size_t offset, void *read_buf, size_t read_buf_size);
+int file_base_end(void);
+uint32_t file_generation(void);
+void file_stats_get(struct file_stats *stats);
\ No newline at end of file
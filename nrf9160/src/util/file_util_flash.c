@@ -0,0 +1,576 @@
+#include <zephyr.h>
+#include <device.h>
+#include <string.h>
+#include <drivers/flash.h>
+#include <storage/flash_map.h>
+#include <storage/stream_flash.h>
+#include <sys/crc.h>
+#if defined(CONFIG_FLASH_SIMULATOR)
+#include <drivers/flash/flash_simulator.h>
+#endif
+
+#include "file_util.h"
+#include "file_lock.h"
+#include "file_stats.h"
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(file_util, CONFIG_FILE_UTIL_LOG_LEVEL);
+
+/*
+ * Password file storage in a raw flash partition, read in place through the
+ * memory map instead of through a file system.
+ *
+ * The password_storage partition, which no file system or settings backend
+ * shares, is split into two slots of whole pages. A slot holds
+ * one password file from its start, and a trailer in its last bytes:
+ *
+ *   magic "SKYF" | sequence u32 | length u32 | CRC-32 of the file u32
+ *   revoked u32, left erased until the file is given up for the other slot
+ *
+ * The live file is the valid slot with the highest sequence number, the
+ * other valid slot holds the previous file. A download is streamed into the
+ * other slot and only becomes live once its trailer is written, so a reset
+ * never leaves a half written file live.
+ */
+#define SLOT_MAGIC 0x46594b53
+#define SLOT_TRAILER_LEN 32
+#define SLOT_HEADER_LEN 16
+#define SLOT_REVOKED_OFFSET SLOT_HEADER_LEN
+#define NO_SLOT -1
+
+struct slot_header {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t len;
+    uint32_t crc;
+};
+
+static K_MUTEX_DEFINE(open_mutex);
+static bool opened;
+
+static const struct flash_area *fa;
+static const struct device *flash_dev;
+static const uint8_t *mem;
+static size_t slot_size;
+static size_t write_block_size;
+static size_t page_size;
+static uint8_t erase_value;
+
+/* Only changed with the write lock held */
+static int live_slot = NO_SLOT;
+static int backup_slot = NO_SLOT;
+static struct slot_header live_header;
+static struct slot_header backup_header;
+
+static struct stream_flash_ctx stream;
+static uint8_t write_buf[CONFIG_FILE_UTIL_RAW_FLASH_BUF_SIZE] __aligned(4);
+static int staging_slot = NO_SLOT;
+static size_t staging_offset;   /* Bytes already in the slot when a resumed download started */
+
+/* File opened by file_base_start */
+static const uint8_t *base_mem;
+static size_t base_len;
+
+static size_t slot_offset(int slot) {
+    return slot * slot_size;
+}
+
+static size_t trailer_offset(int slot) {
+    return slot_offset(slot) + slot_size - SLOT_TRAILER_LEN;
+}
+
+/**
+ *  Finds where the partition is mapped into memory.
+ * */
+static const uint8_t *partition_mem(void) {
+#if defined(CONFIG_FLASH_SIMULATOR)
+    size_t size;
+    return (const uint8_t *)flash_simulator_get_memory(flash_dev, &size) + fa->fa_off;
+#else
+    return (const uint8_t *)CONFIG_FLASH_BASE_ADDRESS + fa->fa_off;
+#endif
+}
+
+/**
+ *  Reads the trailer of a slot, and checks the file it describes.
+ * @return true if the slot holds a complete file that has not been revoked.
+ * */
+static bool slot_valid(int slot, struct slot_header *header) {
+    const uint8_t *trailer = mem + trailer_offset(slot);
+
+    memcpy(header, trailer, sizeof(*header));
+    if (header->magic != SLOT_MAGIC || header->len > slot_size - SLOT_TRAILER_LEN) {
+        return false;
+    }
+    for (int i = 0; i < sizeof(uint32_t); i++) {
+        if (trailer[SLOT_REVOKED_OFFSET + i] != erase_value) {
+            return false;
+        }
+    }
+    return crc32_ieee(mem + slot_offset(slot), header->len) == header->crc;
+}
+
+/**
+ *  Picks the live file and its backup from the valid slots.
+ * */
+static void find_slots(void) {
+    struct slot_header header[2];
+    bool valid[2];
+
+    live_slot = NO_SLOT;
+    backup_slot = NO_SLOT;
+    for (int slot = 0; slot < 2; slot++) {
+        valid[slot] = slot_valid(slot, &header[slot]);
+    }
+    if (valid[0] && valid[1]) {
+        live_slot = header[1].seq > header[0].seq ? 1 : 0;
+        backup_slot = 1 - live_slot;
+    } else if (valid[0] || valid[1]) {
+        live_slot = valid[0] ? 0 : 1;
+    }
+    if (live_slot != NO_SLOT) {
+        live_header = header[live_slot];
+    }
+    if (backup_slot != NO_SLOT) {
+        backup_header = header[backup_slot];
+    }
+}
+
+/**
+ *  Opens the storage partition the first time it is used, and finds the
+ *  live file. Must be called with open_mutex held.
+ * @return 0 on success, on fail: negative errno.
+ * */
+static int open_partition(void) {
+    struct flash_pages_info page;
+    uint32_t start = k_cycle_get_32();
+    int rc;
+
+    if (opened) {
+        return 0;
+    }
+    rc = flash_area_open(FLASH_AREA_ID(password_storage), &fa);
+    if (rc < 0) {
+        LOG_ERR("FAIL: open password_storage partition: %d", rc);
+        return rc;
+    }
+    flash_dev = device_get_binding(fa->fa_dev_name);
+    if (flash_dev == NULL) {
+        return -ENODEV;
+    }
+    write_block_size = flash_get_write_block_size(flash_dev);
+    erase_value = flash_get_parameters(flash_dev)->erase_value;
+    rc = flash_get_page_info_by_offs(flash_dev, fa->fa_off, &page);
+    if (rc < 0) {
+        return rc;
+    }
+    if (SLOT_HEADER_LEN % write_block_size || fa->fa_off % page.size) {
+        LOG_ERR("Storage partition does not fit the slot layout");
+        return -EINVAL;
+    }
+    slot_size = ROUND_DOWN(fa->fa_size / 2, page.size);
+    mem = partition_mem();
+    page_size = page.size;
+    find_slots();
+    opened = true;
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    file_stats_mount(us);
+    LOG_INF("Storage partition opened in %d us, live file: %d bytes in slot %d",
+            us, live_slot == NO_SLOT ? 0 : live_header.len, live_slot);
+    return 0;
+}
+
+static int open_unlocked(void) {
+    int rc;
+    k_mutex_lock(&open_mutex, K_FOREVER);
+    rc = open_partition();
+    k_mutex_unlock(&open_mutex);
+    return rc;
+}
+
+static int lock_read(void) {
+    int rc = open_unlocked();
+    return rc ? rc : file_lock_read();
+}
+
+static int lock_write(void) {
+    int rc = open_unlocked();
+    return rc ? rc : file_lock_write();
+}
+
+/**
+ *  Picks the slot that does not hold the live file for staging, and gives
+ *  up the backup in it. Must be called with the write lock held.
+ * */
+static void pick_staging_slot(void) {
+    staging_slot = live_slot == 0 ? 1 : 0;
+    if (backup_slot == staging_slot) {
+        backup_slot = NO_SLOT;
+    }
+}
+
+/**
+ *  Prepares the slot that does not hold the live file for a new password
+ *  file. The previous file in it is given up, the live file can still be
+ *  read until file_write_commit replaces it.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_write_start(void) {
+    struct flash_pages_info page;
+    int rc;
+
+    rc = lock_write();
+    if (rc < 0) {
+        return rc;
+    }
+    pick_staging_slot();
+    staging_offset = 0;
+
+    /* Erase the trailer first, so the slot is invalid until committed. The
+     * lock is held until then, so no restore can make the slot live again. */
+    rc = flash_get_page_info_by_offs(flash_dev, fa->fa_off + trailer_offset(staging_slot), &page);
+    if (!rc) {
+        rc = flash_area_erase(fa, page.start_offset - fa->fa_off, page.size);
+        file_stats_erase(1);
+    }
+    file_unlock_write();
+    if (!rc) {
+        rc = stream_flash_init(&stream, flash_dev, write_buf, sizeof(write_buf),
+                               fa->fa_off + slot_offset(staging_slot),
+                               slot_size - SLOT_TRAILER_LEN, NULL);
+    }
+    if (rc < 0) {
+        LOG_ERR("FAIL: %d", rc);
+        staging_slot = NO_SLOT;
+        return rc;
+    }
+    return 0;
+}
+
+/**
+ * Append the fragment to the staging slot. Pages are erased as the file
+ * reaches them.
+ * @param fragment data to append
+ * @param frag_size
+ * @return 0 on success, negative errno on failure.
+ * */
+int file_write(const void* const fragment, size_t frag_size) {
+    uint32_t start = k_cycle_get_32();
+    int rc;
+
+    if (staging_slot == NO_SLOT) {
+        return -EINVAL;
+    }
+    rc = stream_flash_buffered_write(&stream, fragment, frag_size, false);
+    file_stats_write(rc ? 0 : frag_size, k_cyc_to_us_floor32(k_cycle_get_32() - start));
+    return rc;
+}
+
+/**
+ *  Gives up the file being written. The live file is kept.
+ * @return 0
+ * */
+int file_write_abort(void) {
+    staging_slot = NO_SLOT;
+    return 0;
+}
+
+/**
+ *  Gets how much of the staged file a download can be resumed from. Bytes
+ *  given to stream_flash but not yet programmed are not counted, and the
+ *  offset is rounded down to a page, as stream_flash erases the page it
+ *  continues in.
+ * @return On success: offset to resume from. On fail: negative errno.
+ * */
+int file_write_sync(void) {
+    if (staging_slot == NO_SLOT) {
+        return -EINVAL;
+    }
+    return ROUND_DOWN(staging_offset + stream_flash_bytes_written(&stream), page_size);
+}
+
+/**
+ *  Gets the size of the write buffer, which is programmed in one piece.
+ *  Fragments that are a multiple of it fill the buffer evenly.
+ * @return Size in bytes.
+ * */
+size_t file_write_block_size(void) {
+    return sizeof(write_buf);
+}
+
+/**
+ *  Gets the size of the largest file that fits in a slot. Only valid once
+ *  the partition has been opened, as it is by file_write_start.
+ * @return Size in bytes.
+ * */
+size_t file_write_max_size(void) {
+    return slot_size - SLOT_TRAILER_LEN;
+}
+
+/**
+ *  Continues a download interrupted by a reset, keeping the first offset
+ *  bytes of the staging slot. The live file is not touched.
+ * @param offset Value returned by file_write_sync before the reset.
+ * @param cb If not NULL, called with the kept bytes in chunks of
+ * read_buf_size, e.g. to hash them again.
+ * @return 0 on success, -EINVAL if offset cannot be resumed from, the
+ * non-zero return value of cb, on fail: negative errno.
+ * */
+int file_write_resume(size_t offset, void *read_buf, size_t read_buf_size, file_chunk_cb_t cb, void *user_data) {
+    int rc;
+
+    rc = lock_write();
+    if (rc < 0) {
+        return rc;
+    }
+    pick_staging_slot();
+    file_unlock_write();
+    if (offset % page_size || offset > slot_size - SLOT_TRAILER_LEN) {
+        staging_slot = NO_SLOT;
+        return -EINVAL;
+    }
+    for (size_t pos = 0; cb && pos < offset; pos += read_buf_size) {
+        size_t len = MIN(read_buf_size, offset - pos);
+        memcpy(read_buf, mem + slot_offset(staging_slot) + pos, len);
+        rc = cb(read_buf, len, pos, user_data);
+        if (rc) {
+            staging_slot = NO_SLOT;
+            return rc;
+        }
+    }
+    rc = stream_flash_init(&stream, flash_dev, write_buf, sizeof(write_buf),
+                           fa->fa_off + slot_offset(staging_slot) + offset,
+                           slot_size - SLOT_TRAILER_LEN - offset, NULL);
+    if (rc < 0) {
+        LOG_ERR("FAIL: %d", rc);
+        staging_slot = NO_SLOT;
+        return rc;
+    }
+    staging_offset = offset;
+    return 0;
+}
+
+/**
+ *  Writes the rest of the staged file and, if it holds expected_len bytes,
+ *  makes it the live password file by writing its trailer. The previous live
+ *  file is kept as a backup.
+ * @param expected_len Size the complete file must have.
+ * @return 0 on success, on fail: negative errno.
+ * */
+int file_write_commit(size_t expected_len) {
+    struct slot_header header = {
+        .magic = SLOT_MAGIC,
+        .len = expected_len,
+    };
+    int slot = staging_slot;
+    int rc;
+
+    if (slot == NO_SLOT) {
+        return -EINVAL;
+    }
+    staging_slot = NO_SLOT;
+    rc = stream_flash_buffered_write(&stream, NULL, 0, true);
+    size_t staged = staging_offset + stream_flash_bytes_written(&stream);
+    if (!rc && staged != expected_len) {
+        LOG_ERR("Staged file has %d of %d bytes", staged, expected_len);
+        rc = -EIO;
+    }
+    /* stream_flash erases each page as the file reaches it */
+    file_stats_erase(DIV_ROUND_UP(stream_flash_bytes_written(&stream), page_size));
+    if (rc) {
+        return rc;
+    }
+    header.crc = crc32_ieee(mem + slot_offset(slot), expected_len);
+
+    rc = lock_write();
+    if (rc) {
+        return rc;
+    }
+    header.seq = live_slot == NO_SLOT ? 1 : live_header.seq + 1;
+    rc = flash_area_write(fa, trailer_offset(slot), &header, sizeof(header));
+    if (!rc) {
+        backup_slot = live_slot;
+        backup_header = live_header;
+        live_slot = slot;
+        live_header = header;
+        file_lock_changed();
+    }
+    file_unlock_write();
+    if (rc) {
+        LOG_ERR("Could not commit password file: %d", rc);
+    }
+    return rc;
+}
+
+/**
+ *  Revokes the live password file, so the backup kept by the last commit is
+ *  live again, e.g. when the new file turns out to be unreadable.
+ * @return 0 on success, -ENOENT if there is no backup, on fail: negative errno.
+ * */
+int file_restore_backup(void) {
+    uint8_t revoked[SLOT_HEADER_LEN] = {0};
+    int rc;
+
+    rc = lock_write();
+    if (rc < 0) {
+        return rc;
+    }
+    if (backup_slot == NO_SLOT) {
+        rc = -ENOENT;
+    } else {
+        rc = flash_area_write(fa, trailer_offset(live_slot) + SLOT_REVOKED_OFFSET,
+                              revoked, write_block_size);
+    }
+    if (!rc) {
+        live_slot = backup_slot;
+        live_header = backup_header;
+        backup_slot = NO_SLOT;
+        file_lock_changed();
+    }
+    file_unlock_write();
+    if (!rc) {
+        LOG_WRN("Restored the previous password file");
+    }
+    return rc;
+}
+
+/**
+ *  Opens the live password file for reading. Reads may run alongside other
+ *  readers, each with its own handle, but commits are blocked until
+ *  file_read_end is called.
+ * @param reader Handle of this reader, used until file_read_end.
+ * @return 0 on success, -ENOENT if there is no file, on fail: negative errno.
+ * */
+int file_read_start(struct file_reader *reader) {
+    int rc;
+    rc = lock_read();
+    if (rc < 0) {
+        LOG_ERR("Failed in locking file system: %d", rc);
+        return rc;
+    }
+    if (live_slot == NO_SLOT) {
+        file_unlock_read();
+        return -ENOENT;
+    }
+    reader->base = mem + slot_offset(live_slot);
+    reader->len = live_header.len;
+    reader->generation = file_generation();
+    return 0;
+}
+
+/**
+ *  Copies bytes of the password file opened by file_read_start.
+ * @return On success: Number of bytes read. May be lower than read_buf_size
+ * if there were fewer bytes available than requested.
+ * */
+int file_read_at(struct file_reader *reader, size_t offset, void *read_buf, size_t read_buf_size) {
+    if (offset >= reader->len) {
+        return 0;
+    }
+    size_t len = MIN(read_buf_size, reader->len - offset);
+    memcpy(read_buf, reader->base + offset, len);
+    file_stats_read(len);
+    return len;
+}
+
+/**
+ *  Gets the size of the password file opened by file_read_start.
+ * */
+int file_size_get(struct file_reader *reader) {
+    return reader->len;
+}
+
+/**
+ *  Gets a pointer to bytes of the password file opened by file_read_start,
+ *  straight into flash. Nothing is copied. The pointer is only valid until
+ *  file_read_end is called.
+ * @return 0 on success, -EINVAL if the range is not within the file.
+ * */
+int file_read_map(struct file_reader *reader, size_t offset, size_t len, const void **ptr) {
+    if (offset > reader->len || len > reader->len - offset) {
+        return -EINVAL;
+    }
+    *ptr = reader->base + offset;
+    return 0;
+}
+
+/**
+ *  Reads the password file opened by file_read_start in chunks of
+ *  read_buf_size bytes, starting at offset, and passes each chunk to cb.
+ * @param cb Called for each chunk. A non-zero return value stops the read.
+ * @return 0 when the end of the file was reached, or the non-zero return
+ * value of cb.
+ * */
+int file_read_chunks(struct file_reader *reader, size_t offset, void *read_buf, size_t read_buf_size,
+                     file_chunk_cb_t cb, void *user_data) {
+    int rc;
+    while (true) {
+        rc = file_read_at(reader, offset, read_buf, read_buf_size);
+        if (rc <= 0) {
+            return rc;
+        }
+        size_t len = rc;
+        rc = cb(read_buf, len, offset, user_data);
+        if (rc) {
+            return rc;
+        }
+        offset += len;
+    }
+}
+
+/**
+ *  Closes the file opened by file_read_start.
+ * @return 0
+ * */
+int file_read_end(struct file_reader *reader) {
+    reader->base = NULL;
+    reader->len = 0;
+    file_unlock_read();
+    return 0;
+}
+
+/**
+ *  Opens the live password file as the base of a patch. It is read apart
+ *  from file_read_start, and commits are blocked until file_base_end is
+ *  called, so end it before file_write_commit.
+ * @return 0 on success, -ENOENT if there is no file, on fail: negative errno.
+ * */
+int file_base_start(void) {
+    int rc;
+    rc = lock_read();
+    if (rc < 0) {
+        return rc;
+    }
+    if (live_slot == NO_SLOT) {
+        file_unlock_read();
+        return -ENOENT;
+    }
+    base_mem = mem + slot_offset(live_slot);
+    base_len = live_header.len;
+    return 0;
+}
+
+/**
+ *  Copies bytes of the file opened by file_base_start.
+ * @return Number of bytes read, 0 at the end of the file.
+ * */
+int file_base_read_at(size_t offset, void *read_buf, size_t read_buf_size) {
+    if (offset >= base_len) {
+        return 0;
+    }
+    size_t len = MIN(read_buf_size, base_len - offset);
+    memcpy(read_buf, base_mem + offset, len);
+    file_stats_read(len);
+    return len;
+}
+
+/**
+ *  Closes the file opened by file_base_start.
+ * @return 0
+ * */
+int file_base_end(void) {
+    base_mem = NULL;
+    base_len = 0;
+    file_unlock_read();
+    return 0;
+}
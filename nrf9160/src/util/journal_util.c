@@ -0,0 +1,202 @@
+#include <zephyr.h>
+#include <string.h>
+#include <stdio.h>
+#include <settings/settings.h>
+#include "journal_util.h"
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(journal_util, CONFIG_JOURNAL_UTIL_LOG_LEVEL);
+
+#define SUBTREE "journal"
+#define KEY_MAX_LEN (sizeof(SUBTREE) + CONFIG_JOURNAL_UTIL_NAME_MAX_LEN)
+
+struct journal_entry
+{
+    char name[CONFIG_JOURNAL_UTIL_NAME_MAX_LEN + 1];
+    uint8_t value[CONFIG_JOURNAL_UTIL_VALUE_MAX_LEN];
+    uint8_t len;
+    bool dirty;                 /* Changed since the last flush */
+};
+
+static struct journal_entry entries[CONFIG_JOURNAL_UTIL_ENTRIES];
+static size_t entry_count;
+static bool replayed;
+static K_MUTEX_DEFINE(journal_mutex);
+
+static void flush_work_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_fn);
+
+static struct journal_entry *find_entry(const char *name, bool add)
+{
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        if (!strcmp(entries[i].name, name))
+        {
+            return &entries[i];
+        }
+    }
+    if (!add || entry_count == ARRAY_SIZE(entries) || strlen(name) > CONFIG_JOURNAL_UTIL_NAME_MAX_LEN)
+    {
+        return NULL;
+    }
+    struct journal_entry *entry = &entries[entry_count++];
+    strcpy(entry->name, name);
+    entry->len = 0;
+    entry->dirty = false;
+    return entry;
+}
+
+static int journal_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    if (len > CONFIG_JOURNAL_UTIL_VALUE_MAX_LEN)
+    {
+        LOG_WRN("Skipping oversized entry %s", log_strdup(key));
+        return 0;
+    }
+    struct journal_entry *entry = find_entry(key, true);
+    if (entry == NULL)
+    {
+        LOG_WRN("No room for entry %s, consider increasing CONFIG_JOURNAL_UTIL_ENTRIES", log_strdup(key));
+        return 0;
+    }
+    int rc = read_cb(cb_arg, entry->value, len);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    entry->len = rc;
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(journal, SUBTREE, NULL, journal_set, NULL, NULL);
+
+/**
+ * @brief Load the entries from flash the first time the journal is used.
+ * Must be called with journal_mutex held.
+ *
+ * @return 0 on success, negative errno on failure.
+ */
+static int replay(void)
+{
+    if (replayed)
+    {
+        return 0;
+    }
+    uint32_t start = k_cycle_get_32();
+    int rc = settings_subsys_init();
+    if (!rc)
+    {
+        rc = settings_load_subtree(SUBTREE);
+    }
+    if (rc)
+    {
+        LOG_ERR("Could not replay journal: %d", rc);
+        return rc;
+    }
+    replayed = true;
+    LOG_INF("Replayed %d entries in %d us", entry_count, k_cyc_to_us_floor32(k_cycle_get_32() - start));
+    return 0;
+}
+
+/**
+ * @brief Record the new value of an entry. Nothing is written if the value
+ * did not change, otherwise it is written with the other changes after
+ * CONFIG_JOURNAL_UTIL_FLUSH_DELAY_MS.
+ *
+ * @return 0 on success, -EINVAL if the name or value is too long, -ENOMEM if
+ * all CONFIG_JOURNAL_UTIL_ENTRIES entries are used, negative errno if the
+ * journal could not be replayed.
+ */
+int journal_record(const char *name, const void *value, size_t len)
+{
+    if (len > CONFIG_JOURNAL_UTIL_VALUE_MAX_LEN || strlen(name) > CONFIG_JOURNAL_UTIL_NAME_MAX_LEN)
+    {
+        return -EINVAL;
+    }
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    int rc = replay();
+    struct journal_entry *entry = rc ? NULL : find_entry(name, true);
+    if (!rc && entry == NULL)
+    {
+        rc = -ENOMEM;
+    }
+    if (!rc && (entry->len != len || memcmp(entry->value, value, len)))
+    {
+        memcpy(entry->value, value, len);
+        entry->len = len;
+        entry->dirty = true;
+        /* Not rescheduled, so changes in quick succession share a flush */
+        k_work_schedule(&flush_work, K_MSEC(CONFIG_JOURNAL_UTIL_FLUSH_DELAY_MS));
+    }
+    k_mutex_unlock(&journal_mutex);
+    return rc;
+}
+
+/**
+ * @brief Get the value of an entry, as recorded before the last reset or since.
+ *
+ * @return Length of the value on success, -ENOENT if it was never recorded,
+ * -ENOSPC if it does not fit into len bytes, negative errno if the journal
+ * could not be replayed.
+ */
+int journal_get(const char *name, void *value, size_t len)
+{
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    int rc = replay();
+    struct journal_entry *entry = rc ? NULL : find_entry(name, false);
+    if (!rc && entry == NULL)
+    {
+        rc = -ENOENT;
+    }
+    if (!rc && entry->len > len)
+    {
+        rc = -ENOSPC;
+    }
+    if (!rc)
+    {
+        memcpy(value, entry->value, entry->len);
+        rc = entry->len;
+    }
+    k_mutex_unlock(&journal_mutex);
+    return rc;
+}
+
+/**
+ * @brief Write all changed entries now, e.g. before shutting down.
+ *
+ * @return 0 on success, negative errno from the settings backend on failure.
+ * Entries that could not be written are tried again on the next flush.
+ */
+int journal_flush(void)
+{
+    char key[KEY_MAX_LEN + 1];
+    int written = 0;
+    int rc = 0;
+
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        if (!entries[i].dirty)
+        {
+            continue;
+        }
+        snprintf(key, sizeof(key), SUBTREE "/%s", entries[i].name);
+        int err = settings_save_one(key, entries[i].value, entries[i].len);
+        if (err)
+        {
+            LOG_ERR("Could not write %s: %d", log_strdup(key), err);
+            rc = err;
+            continue;
+        }
+        entries[i].dirty = false;
+        written++;
+    }
+    k_mutex_unlock(&journal_mutex);
+    LOG_DBG("Wrote %d entries", written);
+    return rc;
+}
+
+static void flush_work_fn(struct k_work *work)
+{
+    journal_flush();
+}
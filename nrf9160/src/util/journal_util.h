@@ -0,0 +1,15 @@
+/*
+ * Small pieces of state that must survive a reset, such as settings received
+ * from the cloud, so they are not fetched again after every boot.
+ *
+ * Entries are named, hold up to CONFIG_JOURNAL_UTIL_VALUE_MAX_LEN bytes and
+ * live in RAM. They are replayed from flash on first use. Changes are
+ * collected for CONFIG_JOURNAL_UTIL_FLUSH_DELAY_MS and then written together,
+ * one settings record per changed entry. With the NVS settings backend every
+ * record is appended, and full sectors are compacted into the next free one,
+ * so writes are spread over the whole settings partition.
+ */
+
+int journal_record(const char *name, const void *value, size_t len);
+int journal_get(const char *name, void *value, size_t len);
+int journal_flush(void);
@@ -1,6 +1,8 @@
 
 #include <zephyr.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/byteorder.h>
 #include "parse_util.h"
 #include <logging/log.h>
 
@@ -13,83 +15,895 @@ LOG_MODULE_REGISTER(parse_util, CONFIG_PARSE_UTIL_LOG_LEVEL);
 #define ENTRY_MAX_LEN 10
 #endif
 
-int parse_entries(const char* from_buf, char* to_buf, size_t to_buf_len, uint8_t entry_type) {
-    int err = 0;
-    if (entry_type > ENTRY_PASSWORD)
+/**
+ * @brief Get the length of the field starting at `str`. A field ends at a tab,
+ * a line ending or the end of the buffer.
+ */
+static size_t field_length(const char *str, const char *end)
+{
+    const char *pos = str;
+
+    while (pos < end && *pos != '\t' && *pos != '\n' && *pos != '\r' && *pos != '\0')
+    {
+        pos++;
+    }
+    return pos - str;
+}
+
+/**
+ * @brief Locate the fields of the line starting at `line`. Unlike strtok_r,
+ * consecutive tabs are treated as empty fields and the buffer is left untouched.
+ *
+ * @return Number of fields found, at most ENTRY_PASSWORD + 1.
+ */
+static int split_line(const char *line, const char *end, const char *fields[], size_t lens[])
+{
+    int num = 0;
+    const char *pos = line;
+
+    while (num <= ENTRY_PASSWORD)
+    {
+        fields[num] = pos;
+        lens[num] = field_length(pos, end);
+        pos += lens[num];
+        num++;
+        if (pos >= end || *pos != '\t')
+        {
+            break;
+        }
+        pos++;
+    }
+    return num;
+}
+
+/**
+ * @brief Append `field` and a tab separator to the entries in `to_buf`.
+ * Fields longer than ENTRY_MAX_LEN are truncated and marked with "...".
+ *
+ * @return 0 on success, -ENOBUFS if to_buf is full.
+ */
+int parse_append_entry(char *to_buf, size_t to_buf_len, size_t *offset, const char *field, size_t len)
+{
+    char platform[ENTRY_MAX_LEN + 2];
+
+    if (len > ENTRY_MAX_LEN)
+    {
+        memcpy(platform, field, ENTRY_MAX_LEN - 3);
+        memcpy(platform + ENTRY_MAX_LEN - 3, "...", 3);
+        platform[ENTRY_MAX_LEN] = '\0';
+        LOG_INF("Entry exceeds CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN. Altered entry name: %s", log_strdup(platform));
+    }
+    else
+    {
+        memcpy(platform, field, len);
+        platform[len] = '\0';
+        LOG_DBG("Platform: %s", log_strdup(platform));
+    }
+    strcat(platform, "\t");
+    if (*offset + strlen(platform) > to_buf_len)
+    {
+        LOG_WRN("Size of entries exceeded max buffer length. Some entries will be lost. Consider increasing CONFIG_PASSWORD_ENTRY_MAX_NUM");
+        return -ENOBUFS;
+    }
+    memcpy(to_buf + *offset, platform, strlen(platform));
+    *offset += strlen(platform);
+    return 0;
+}
+
+/**
+ * @brief 32-bit FNV-1a hash of the first `len` bytes of `str`.
+ */
+uint32_t parse_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int index_item_cmp(const void *a, const void *b)
+{
+    const struct entry_index_item *item_a = a;
+    const struct entry_index_item *item_b = b;
+
+    if (item_a->hash != item_b->hash)
+    {
+        return item_a->hash < item_b->hash ? -1 : 1;
+    }
+    /* Keep file order for colliding hashes so lookups find the first record */
+    return item_a->offset < item_b->offset ? -1 : (item_a->offset > item_b->offset);
+}
+
+/**
+ * @brief Add a record to an unsorted index. Call parse_index_sort when all
+ * records have been added.
+ *
+ * @param offset Offset of the record from the start of the buffer or file.
+ * @return 0 on success, -ENOBUFS if the index is full.
+ */
+int parse_index_add(struct entry_index_item *index, size_t *count, size_t index_max,
+                    const struct vault_record_view *view, size_t offset)
+{
+    if (*count == index_max)
+    {
+        return -ENOBUFS;
+    }
+    struct entry_index_item *item = &index[(*count)++];
+    item->hash = parse_hash(view->field[ENTRY_ACCOUNT], view->field_len[ENTRY_ACCOUNT]);
+    item->offset = offset;
+    for (int i = 0; i <= ENTRY_PASSWORD; i++)
+    {
+        item->field_len[i] = view->field_len[i];
+    }
+    return 0;
+}
+
+void parse_index_sort(struct entry_index_item *index, size_t count)
+{
+    qsort(index, count, sizeof(*index), index_item_cmp);
+    LOG_DBG("Indexed %d records", count);
+}
+
+/**
+ * @brief Turn the fields of a TSV line into a record view.
+ *
+ * @return 0 on success, -EINVAL if the line is malformed or has oversized fields.
+ */
+static int line_view(const char *line, const char *end, struct vault_record_view *view)
+{
+    const char *fields[ENTRY_PASSWORD + 1];
+    size_t lens[ENTRY_PASSWORD + 1];
+    int num = split_line(line, end, fields, lens);
+
+    if (num <= ENTRY_PASSWORD || lens[ENTRY_ACCOUNT] == 0)
     {
-        LOG_ERR("Entry does not exist");
         return -EINVAL;
     }
-    char *rest = (char *)from_buf;
-    char *line;
-    char* entry;
-    char platform[ENTRY_MAX_LEN];
-    line = strtok_r(rest, "\n", &rest);
-    
-    int offset = 0;
-    int entry_index = 0;
-    while (line != NULL)
+    for (int i = 0; i <= ENTRY_PASSWORD; i++)
     {
-        entry_index = 0;
-        entry = strtok_r(line, "\t", &line);
-        while ((entry_index != entry_type) && (entry != NULL))
+        if (lens[i] > UINT8_MAX)
         {
-            entry = strtok_r(NULL, "\t", &line);
-            entry_index++;
+            return -EINVAL;
         }
-        if (strlen(entry) > ENTRY_MAX_LEN)
+        view->field[i] = fields[i];
+        view->field_len[i] = lens[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Find the position of the first index item with a hash not less than `hash`.
+ */
+static size_t index_lower_bound(const struct entry_index_item *index, size_t count, uint32_t hash)
+{
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (index[mid].hash < hash)
         {
-            strncpy(platform, entry, ENTRY_MAX_LEN - 3);
-            strncat(platform, "...", 3);
-            LOG_INF("Entry %s exceeds CONFIG_PASSWORD_ENTRY_NAME_MAX_LEN. Altered entry name: %s", entry, platform);
+            low = mid + 1;
         }
         else
         {
-            strncpy(platform, entry, ENTRY_MAX_LEN);
-            LOG_DBG("Platform: %s", log_strdup(platform));
+            high = mid;
         }
-        strncat(platform, "\t", 1);
-        if (offset + strlen(platform) > to_buf_len)
+    }
+    return low;
+}
+
+/**
+ * @brief Binary search an index for `account`. The records are not held in
+ * memory, candidate records are read into `buf` one at a time.
+ *
+ * @param read Function reading the indexed file.
+ * @param buf Buffer for one record.
+ * @param view Filled with a view into buf of the matching record.
+ * @return 0 on success, -ENOENT if not found, negative errno from read on
+ * failure.
+ */
+int parse_index_lookup(parse_read_t read, const struct entry_index_item *index, size_t count,
+                       const char *account, char *buf, size_t buf_len, struct vault_record_view *view)
+{
+    size_t len = strlen(account);
+    uint32_t hash = parse_hash(account, len);
+
+    for (size_t i = index_lower_bound(index, count, hash); i < count && index[i].hash == hash; i++)
+    {
+        const struct entry_index_item *item = &index[i];
+        size_t rec_len = item->field_len[ENTRY_ACCOUNT] + item->field_len[ENTRY_LOGIN_NAME] +
+                         item->field_len[ENTRY_PASSWORD] + ENTRY_PASSWORD;
+
+        if (item->field_len[ENTRY_ACCOUNT] != len || rec_len > buf_len)
         {
-            LOG_WRN("Size of entries exceeded max buffer length. Some entries will be lost. Consider increasing CONFIG_PASSWORD_ENTRY_MAX_NUM");
-            err = -ENOBUFS;
-            break;
+            continue;
+        }
+        int rc = read(item->offset, buf, rec_len);
+        if (rc < 0)
+        {
+            return rc;
+        }
+        if (rc == rec_len && !line_view(buf, buf + rec_len, view) &&
+            view->field_len[ENTRY_ACCOUNT] == len && !memcmp(view->field[ENTRY_ACCOUNT], account, len))
+        {
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+//========================================================================================
+/*                                                                                      *
+ *                                 Binary vault format                                  *
+ *                                                                                      */
+//========================================================================================
+
+/**
+ * @brief Check which format a password file is in from its first bytes.
+ *
+ * @param buf Start of the file.
+ * @param len Number of bytes available in buf.
+ * @return VAULT_FORMAT_BINARY for supported binary vaults, VAULT_FORMAT_UNSUPPORTED
+ * for binary vaults of an unknown version, VAULT_FORMAT_TSV otherwise.
+ */
+enum vault_format parse_detect_format(const void *buf, size_t len)
+{
+    const uint8_t *bytes = buf;
+
+    if (len < sizeof(VAULT_MAGIC) - 1 || memcmp(bytes, VAULT_MAGIC, sizeof(VAULT_MAGIC) - 1))
+    {
+        return VAULT_FORMAT_TSV;
+    }
+    if (len < VAULT_HEADER_LEN || bytes[4] != VAULT_VERSION)
+    {
+        return VAULT_FORMAT_UNSUPPORTED;
+    }
+    return VAULT_FORMAT_BINARY;
+}
+
+/**
+ * @brief Validate the header and offset table of a binary vault.
+ *
+ * @param buf Buffer holding the whole vault. Must outlive `vault`.
+ * @param len Number of valid bytes in buf.
+ * @param vault Handle to initialize.
+ * @return 0 on success, -EINVAL if the vault is malformed, -ENOTSUP for
+ * unsupported versions.
+ */
+int parse_bin_open(const uint8_t *buf, size_t len, struct vault_bin *vault)
+{
+    int err = parse_bin_read_header(buf, len, vault);
+
+    if (err)
+    {
+        return err;
+    }
+    if (vault->header_len > len || vault->count > (len - vault->header_len) / sizeof(uint32_t))
+    {
+        LOG_ERR("Malformed vault header");
+        return -EINVAL;
+    }
+    vault->buf = buf;
+    vault->len = len;
+    vault->offsets = buf + vault->header_len;
+    return 0;
+}
+
+/**
+ * @brief Read the record count and header length of a binary vault from its
+ * first VAULT_HEADER_MAX_LEN bytes. The buffer and offset table are left
+ * unset, for vaults that are read from file rather than held in memory.
+ *
+ * @return 0 on success, -EINVAL if the header is malformed, -ENOTSUP for
+ * unsupported versions.
+ */
+int parse_bin_read_header(const uint8_t *buf, size_t len, struct vault_bin *vault)
+{
+    enum vault_format format = parse_detect_format(buf, len);
+
+    if (format != VAULT_FORMAT_BINARY)
+    {
+        LOG_ERR("Not a supported binary vault");
+        return format == VAULT_FORMAT_UNSUPPORTED ? -ENOTSUP : -EINVAL;
+    }
+    vault->flags = buf[5];
+    vault->header_len = sys_get_le16(&buf[6]);
+    vault->count = sys_get_le32(&buf[8]);
+    vault->buf = NULL;
+    vault->len = 0;
+    vault->offsets = NULL;
+    vault->folder_count = 0;
+    /* The offset table must fit in the 32-bit offsets of the format */
+    if (vault->header_len < VAULT_HEADER_LEN ||
+        vault->count > (UINT32_MAX - vault->header_len) / sizeof(uint32_t))
+    {
+        LOG_ERR("Malformed vault header");
+        return -EINVAL;
+    }
+    vault->records_start = vault->header_len + vault->count * sizeof(uint32_t);
+    if (vault->flags & VAULT_FLAG_FOLDERS)
+    {
+        if (vault->header_len < VAULT_HEADER_FOLDERS_LEN || len < VAULT_HEADER_FOLDERS_LEN)
+        {
+            LOG_ERR("Malformed vault header");
+            return -EINVAL;
+        }
+        vault->folder_count = sys_get_le32(&buf[12]);
+        if (vault->folder_count > (UINT32_MAX - vault->records_start) / sizeof(uint32_t) ||
+            sys_get_le32(&buf[16]) < vault->records_start + vault->folder_count * sizeof(uint32_t))
+        {
+            LOG_ERR("Malformed vault header");
+            return -EINVAL;
+        }
+        vault->records_start = sys_get_le32(&buf[16]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Offset of the first record of a binary vault, right after the
+ * offset table and the folders.
+ */
+size_t parse_bin_records_start(const struct vault_bin *vault)
+{
+    return vault->records_start;
+}
+
+/**
+ * @brief Turn a length-prefixed binary record into a record view.
+ *
+ * @param rec Start of the record.
+ * @param avail Number of valid bytes from rec.
+ * @return 0 on success, -EINVAL if the record runs past avail.
+ */
+static int record_view(const uint8_t *rec, size_t avail, struct vault_record_view *view)
+{
+    size_t pos = 0;
+
+    for (int field = 0; field <= ENTRY_PASSWORD; field++)
+    {
+        if (pos >= avail || rec[pos] > avail - pos - 1)
+        {
+            return -EINVAL;
         }
-        strncpy(to_buf + offset, platform, ENTRY_MAX_LEN + 1);
-        offset += strlen(platform);
-        line = strtok_r(NULL, "\n", &rest);
+        view->field_len[field] = rec[pos];
+        view->field[field] = (const char *)&rec[pos + 1];
+        pos += 1 + view->field_len[field];
+    }
+    return 0;
+}
+
+/**
+ * @brief Get a read-only view of record number `i`. The view points into the
+ * vault buffer, nothing is copied.
+ *
+ * @return 0 on success, -ENOENT if i is out of range, -EINVAL if the record is
+ * malformed.
+ */
+int parse_bin_get_record(const struct vault_bin *vault, uint32_t i, struct vault_record_view *view)
+{
+    if (i >= vault->count)
+    {
+        return -ENOENT;
     }
-    if (offset > 0)
+    uint32_t pos = sys_get_le32(vault->offsets + i * sizeof(uint32_t));
+
+    if (pos >= vault->len || record_view(&vault->buf[pos], vault->len - pos, view))
     {
-        to_buf[offset - 1] = '\0'; //remove trailing comma
+        LOG_ERR("Record %d is out of bounds", i);
+        return -EINVAL;
     }
-    return err;
+    return 0;
 }
 
-int get_password(const char *from_buf, const char *platform, char *pw_buf, size_t pw_len) {
+static int view_cmp(const struct vault_record_view *view, const char *account, size_t len)
+{
+    size_t common = MIN(view->field_len[ENTRY_ACCOUNT], len);
+    int cmp = memcmp(view->field[ENTRY_ACCOUNT], account, common);
+
+    if (cmp == 0)
+    {
+        cmp = (int)view->field_len[ENTRY_ACCOUNT] - (int)len;
+    }
+    return cmp;
+}
+
+/**
+ * @brief Binary search a vault for `account`. Records are stored sorted by
+ * account name, so no index has to be built.
+ *
+ * @return 0 and a view of the record on success, -ENOENT if not found,
+ * -EINVAL if the vault is malformed.
+ */
+int parse_bin_find(const struct vault_bin *vault, const char *account, struct vault_record_view *view)
+{
+    size_t len = strlen(account);
+    uint32_t low = 0;
+    uint32_t high = vault->count;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int err = parse_bin_get_record(vault, mid, view);
+        if (err)
+        {
+            return err;
+        }
+        int cmp = view_cmp(view, account, len);
+        if (cmp == 0)
+        {
+            return 0;
+        }
+        if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return -ENOENT;
+}
+
+/**
+ * @brief Same as parse_bin_get_record, but for vaults that are not held in
+ * memory. Only the offset table entry and the record are read.
+ *
+ * @param read Function reading the vault file.
+ * @param vault Handle initialized by parse_bin_read_header.
+ * @param buf Buffer for one record. Records that do not fit are treated as malformed.
+ * @param view Filled with a view into buf of the record.
+ * @return 0 on success, -ENOENT if i is out of range, -EINVAL if the record
+ * is malformed, negative errno from read on failure.
+ */
+int parse_bin_get_record_read(parse_read_t read, const struct vault_bin *vault, uint32_t i,
+                              uint8_t *buf, size_t buf_len, struct vault_record_view *view)
+{
+    uint8_t offset_buf[sizeof(uint32_t)];
+
+    if (i >= vault->count)
+    {
+        return -ENOENT;
+    }
+    int rc = read(vault->header_len + i * sizeof(uint32_t), offset_buf, sizeof(offset_buf));
+    if (rc >= 0 && rc != sizeof(offset_buf))
+    {
+        rc = -EINVAL;
+    }
+    if (rc >= 0)
+    {
+        rc = read(sys_get_le32(offset_buf), buf, buf_len);
+    }
+    if (rc < 0)
+    {
+        return rc;
+    }
+    if (record_view(buf, rc, view))
+    {
+        LOG_ERR("Record %d is malformed", i);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find the first record in [first, first + count) whose account name
+ * is not less than `key`. Since records are sorted by account name, this is
+ * the first record starting with `key` if there is one.
+ *
+ * @param pos Set to the position found, first + count if every name is less.
+ * @return 0 on success, negative errno as parse_bin_get_record_read.
+ */
+int parse_bin_lower_bound_read(parse_read_t read, const struct vault_bin *vault, uint32_t first, uint32_t count,
+                               const char *key, size_t key_len, uint8_t *buf, size_t buf_len, uint32_t *pos)
+{
+    struct vault_record_view view;
+    uint32_t low = first;
+    uint32_t high = first + count;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int err = parse_bin_get_record_read(read, vault, mid, buf, buf_len, &view);
+        if (err)
+        {
+            return err;
+        }
+        if (view_cmp(&view, key, key_len) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    *pos = low;
+    return 0;
+}
+
+/**
+ * @brief Same as parse_bin_find, but for vaults that are not held in memory.
+ * Only the offset table entries and records visited by the search are read.
+ *
+ * @param read Function reading the vault file.
+ * @param vault Handle initialized by parse_bin_read_header.
+ * @param buf Buffer for one record. Records that do not fit are treated as malformed.
+ * @param view Filled with a view into buf of the matching record.
+ * @return 0 on success, -ENOENT if not found, -EINVAL if the vault is
+ * malformed, negative errno from read on failure.
+ */
+int parse_bin_find_read(parse_read_t read, const struct vault_bin *vault, const char *account,
+                        uint8_t *buf, size_t buf_len, struct vault_record_view *view)
+{
+    size_t len = strlen(account);
+    uint32_t low = 0;
+    uint32_t high = vault->count;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int err = parse_bin_get_record_read(read, vault, mid, buf, buf_len, view);
+        if (err)
+        {
+            return err;
+        }
+        int cmp = view_cmp(view, account, len);
+        if (cmp == 0)
+        {
+            return 0;
+        }
+        if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return -ENOENT;
+}
+
+/**
+ * @brief Read folder number `i` of a vault with VAULT_FLAG_FOLDERS. Folders
+ * are sorted by name.
+ *
+ * @param buf Buffer for one folder entry.
+ * @param folder Filled in, with the name pointing into buf.
+ * @return 0 on success, -ENOENT if i is out of range, -EINVAL if the folder
+ * is malformed, negative errno from read on failure.
+ */
+int parse_bin_get_folder_read(parse_read_t read, const struct vault_bin *vault, uint32_t i,
+                              uint8_t *buf, size_t buf_len, struct vault_folder *folder)
+{
+    const size_t fixed_len = 2 * sizeof(uint32_t) + 1;
+    uint8_t offset_buf[sizeof(uint32_t)];
+
+    if (i >= vault->folder_count)
+    {
+        return -ENOENT;
+    }
+    int rc = read(vault->header_len + (vault->count + i) * sizeof(uint32_t), offset_buf, sizeof(offset_buf));
+    if (rc >= 0 && rc != sizeof(offset_buf))
+    {
+        rc = -EINVAL;
+    }
+    if (rc >= 0)
+    {
+        rc = read(sys_get_le32(offset_buf), buf, buf_len);
+    }
+    if (rc < 0)
+    {
+        return rc;
+    }
+    if ((size_t)rc < fixed_len || buf[fixed_len - 1] > (size_t)rc - fixed_len)
+    {
+        LOG_ERR("Folder %d is malformed", i);
+        return -EINVAL;
+    }
+    folder->first = sys_get_le32(buf);
+    folder->count = sys_get_le32(&buf[4]);
+    folder->name_len = buf[fixed_len - 1];
+    folder->name = (const char *)&buf[fixed_len];
+    if (folder->first > vault->count || folder->count > vault->count - folder->first)
+    {
+        LOG_ERR("Folder %d is out of bounds", i);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Binary search the folders of a vault for `name`.
+ *
+ * @return 0 on success, -ENOENT if not found, other negative errno as
+ * parse_bin_get_folder_read.
+ */
+int parse_bin_find_folder_read(parse_read_t read, const struct vault_bin *vault, const char *name,
+                               uint8_t *buf, size_t buf_len, struct vault_folder *folder)
+{
+    size_t len = strlen(name);
+    uint32_t low = 0;
+    uint32_t high = vault->folder_count;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int err = parse_bin_get_folder_read(read, vault, mid, buf, buf_len, folder);
+        if (err)
+        {
+            return err;
+        }
+        int cmp = memcmp(folder->name, name, MIN(folder->name_len, len));
+        if (cmp == 0)
+        {
+            cmp = (int)folder->name_len - (int)len;
+        }
+        if (cmp == 0)
+        {
+            return 0;
+        }
+        if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return -ENOENT;
+}
+
+/**
+ * @brief Copy one field of a record view into a NULL terminated string.
+ *
+ * @return 0 on success, -ERANGE if the field does not fit in to_buf.
+ */
+int parse_view_get_field(const struct vault_record_view *view, uint8_t entry_type, char *to_buf, size_t to_buf_len)
+{
+    if (entry_type > ENTRY_PASSWORD)
+    {
+        LOG_ERR("Entry does not exist");
+        return -EINVAL;
+    }
+    if (view->field_len[entry_type] >= to_buf_len)
+    {
+        LOG_ERR("Field too long (%d). Max: %d", view->field_len[entry_type], to_buf_len - 1);
+        return -ERANGE;
+    }
+    memcpy(to_buf, view->field[entry_type], view->field_len[entry_type]);
+    to_buf[view->field_len[entry_type]] = '\0';
+    return 0;
+}
+
+//========================================================================================
+/*                                                                                      *
+ *                                  Streaming parser                                    *
+ *                                                                                      */
+//========================================================================================
+
+/**
+ * @brief Prepare a stream parser. Records are reported through `cb` as soon
+ * as their last byte has been fed, so the file never has to be held in memory.
+ *
+ * @param format Format of the file, from parse_detect_format.
+ * @param offset File offset of the first byte that will be fed. For binary
+ * vaults this must be parse_bin_records_start.
+ * @param cb Called for each complete record. A non-zero return value stops
+ * the stream and is returned from parse_stream_feed.
+ */
+void parse_stream_init(struct parse_stream *stream, enum vault_format format, size_t offset,
+                       parse_record_cb_t cb, void *user_data)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->format = format;
+    stream->offset = offset;
+    stream->cb = cb;
+    stream->user_data = user_data;
+}
+
+static int stream_emit(struct parse_stream *stream)
+{
+    struct vault_record_view view;
+    size_t len = stream->len;
+    int err;
+
+    stream->len = 0;
+    if (len > sizeof(stream->buf))
+    {
+        LOG_WRN("Skipping record at offset %d, longer than CONFIG_PARSE_UTIL_RECORD_MAX_LEN", stream->record_offset);
+        return 0;
+    }
+    if (stream->format == VAULT_FORMAT_BINARY)
+    {
+        err = record_view((const uint8_t *)stream->buf, len, &view);
+    }
+    else
+    {
+        err = line_view(stream->buf, stream->buf + len, &view);
+    }
+    if (err)
+    {
+        if (len > 0 && field_length(stream->buf, stream->buf + len) != 0)
+        {
+            LOG_WRN("Skipping malformed record at offset %d", stream->record_offset);
+        }
+        return 0;
+    }
+    return stream->cb(&view, stream->record_offset, stream->user_data);
+}
+
+static void stream_store(struct parse_stream *stream, char c)
+{
+    if (stream->len == 0)
+    {
+        stream->record_offset = stream->offset;
+    }
+    if (stream->len < sizeof(stream->buf))
+    {
+        stream->buf[stream->len] = c;
+    }
+    stream->len++;
+}
+
+/**
+ * @brief Feed the next chunk of a file to a stream parser.
+ *
+ * @return 0 on success, otherwise the non-zero value returned by the record callback.
+ */
+int parse_stream_feed(struct parse_stream *stream, const void *chunk, size_t len)
+{
+    const uint8_t *bytes = chunk;
     int err = 0;
-    char *rest = (char *)from_buf;
-    char *line;
-    char* entry;
-    line = strtok_r(rest, "\n", &rest);
-    while (line != NULL)
-    {
-        entry = strtok_r(line, "\t", &line);
-        if (!strncmp((const char*) entry, platform, ENTRY_MAX_LEN)) {
-            entry = strtok_r(NULL, "\t", &line);
-            entry = strtok_r(NULL, "\t\n", &line);
-            strncpy(pw_buf, entry, pw_len);
-            if (strlen(entry) > pw_len) {
-                err = -ERANGE;
-                LOG_ERR("Parsed password entry was too long (%d). Max: %d", strlen(entry), pw_len);
-                return -ERANGE;
+
+    for (size_t i = 0; i < len && !err; i++, stream->offset++)
+    {
+        uint8_t byte = bytes[i];
+
+        if (stream->format != VAULT_FORMAT_BINARY)
+        {
+            if (byte == '\n')
+            {
+                err = stream_emit(stream);
+            }
+            else
+            {
+                stream_store(stream, byte);
             }
+            continue;
+        }
+
+        stream_store(stream, byte);
+        if (stream->need > 0)
+        {
+            stream->need--;
+        }
+        else
+        {
+            /* Length prefix of the next field */
+            stream->need = byte;
+            stream->field++;
+        }
+        if (stream->field > ENTRY_PASSWORD && stream->need == 0)
+        {
+            stream->field = 0;
+            err = stream_emit(stream);
         }
-        line = strtok_r(rest, "\n", &rest);
     }
     return err;
 }
 
+/**
+ * @brief Signal the end of the file to a stream parser, reporting a last
+ * line without a trailing newline.
+ *
+ * @return 0 on success, otherwise the non-zero value returned by the record callback.
+ */
+int parse_stream_finish(struct parse_stream *stream)
+{
+    if (stream->len == 0)
+    {
+        return 0;
+    }
+    if (stream->format == VAULT_FORMAT_BINARY)
+    {
+        LOG_WRN("Vault ends in the middle of a record");
+        stream->len = 0;
+        return 0;
+    }
+    return stream_emit(stream);
+}
+
+/* Returned by find_record once the account has been found */
+#define FIND_DONE 1
+
+struct find_context
+{
+    const char *account;
+    size_t len;
+    char *buf;
+    size_t buf_len;
+    struct vault_record_view *view;
+};
+
+static int find_record(const struct vault_record_view *view, size_t offset, void *user_data)
+{
+    struct find_context *ctx = user_data;
+    size_t len = 0;
+
+    if (view->field_len[ENTRY_ACCOUNT] != ctx->len || memcmp(view->field[ENTRY_ACCOUNT], ctx->account, ctx->len))
+    {
+        return 0;
+    }
+    /* The stream buffer is wiped before parse_stream_find returns */
+    for (int i = 0; i <= ENTRY_PASSWORD; i++)
+    {
+        if (view->field_len[i] > ctx->buf_len - len)
+        {
+            return -ENOBUFS;
+        }
+        memcpy(&ctx->buf[len], view->field[i], view->field_len[i]);
+        ctx->view->field[i] = &ctx->buf[len];
+        ctx->view->field_len[i] = view->field_len[i];
+        len += view->field_len[i];
+    }
+    return FIND_DONE;
+}
+
+/**
+ * @brief Find `account` by streaming through the records from `offset` on,
+ * e.g. the records that did not fit in an index. The first matching record
+ * is copied into `buf`.
+ *
+ * @param stream Parser state, its buffer is wiped before returning.
+ * @param offset File offset of the first record to search.
+ * @param chunk Buffer the file is read into, chunk_len bytes at a time.
+ * @param view Filled with a view into buf of the matching record.
+ * @return 0 on success, -ENOENT if not found, -ENOBUFS if the record does
+ * not fit in buf, negative errno from read on failure.
+ */
+int parse_stream_find(parse_read_t read, struct parse_stream *stream, enum vault_format format,
+                      size_t offset, const char *account, void *chunk, size_t chunk_len,
+                      char *buf, size_t buf_len, struct vault_record_view *view)
+{
+    struct find_context ctx = {
+        .account = account,
+        .len = strlen(account),
+        .buf = buf,
+        .buf_len = buf_len,
+        .view = view,
+    };
+    int err = 0;
+
+    parse_stream_init(stream, format, offset, find_record, &ctx);
+    while (!err)
+    {
+        int rc = read(offset, chunk, chunk_len);
+        if (rc <= 0)
+        {
+            err = rc ? rc : parse_stream_finish(stream);
+            break;
+        }
+        err = parse_stream_feed(stream, chunk, rc);
+        offset += rc;
+    }
+    memset(stream->buf, 0, sizeof(stream->buf));
+    if (err == FIND_DONE)
+    {
+        return 0;
+    }
+    return err ? err : -ENOENT;
+}
+
 /**
  * @brief Separate `str` by any char in `sep` and return NULL terminated
  * sections. Consecutive `sep` chars in `str` are treated as a single
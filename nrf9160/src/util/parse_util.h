@@ -5,8 +5,121 @@ enum entry_type
     ENTRY_PASSWORD,
 };
 
-int parse_entries(const char *from_buf, char *to_buf, size_t to_buf_len, uint8_t entry_type);
-int get_password(const char* from_buf, const char* platform, char* pw_buf, size_t pw_len);
+/* Location of one record in a plaintext password buffer. */
+struct entry_index_item
+{
+    uint32_t hash;                          /* FNV-1a hash of the account name */
+    uint32_t offset;                        /* Offset of the record from the start of the buffer */
+    uint8_t field_len[ENTRY_PASSWORD + 1];  /* Length of each field, indexed by enum entry_type */
+};
+
+/*
+ * Binary vault layout, all integers little endian:
+ *
+ *   magic "SKYV" | version u8 | flags u8 | header_len u16 | record_count u32
+ *   with VAULT_FLAG_FOLDERS: folder_count u32 | records_start u32
+ *   record offsets, u32[record_count], from the start of the file
+ *   with VAULT_FLAG_FOLDERS:
+ *     folder offsets, u32[folder_count], from the start of the file
+ *     folders, sorted by name:
+ *       first_record u32 | record_count u32 | name_len u8 | name
+ *   records, sorted by account name:
+ *     account_len u8 | account | login_len u8 | login | password_len u8 | password
+ *
+ * In vaults with folders every account name is "folder/name". Sorting by
+ * account name keeps the records of a folder next to each other.
+ *
+ * Use scripts/vault_tool.py to convert a TSV file to this format.
+ */
+#define VAULT_MAGIC "SKYV"
+#define VAULT_VERSION 1
+#define VAULT_HEADER_LEN 12
+#define VAULT_HEADER_FOLDERS_LEN 20
+#define VAULT_HEADER_MAX_LEN VAULT_HEADER_FOLDERS_LEN
+#define VAULT_FLAG_FOLDERS BIT(0)
+#define VAULT_FOLDER_SEPARATOR '/'
+
+enum vault_format
+{
+    VAULT_FORMAT_TSV,
+    VAULT_FORMAT_BINARY,
+    VAULT_FORMAT_UNSUPPORTED,
+};
+
+/* Handle to a binary vault. buf and offsets are NULL for vaults read from file. */
+struct vault_bin
+{
+    const uint8_t *buf;
+    size_t len;
+    uint32_t count;
+    uint16_t header_len;
+    uint8_t flags;
+    uint32_t folder_count;      /* 0 without VAULT_FLAG_FOLDERS */
+    uint32_t records_start;
+    const uint8_t *offsets;
+};
+
+/* A folder of a binary vault: a range of records. The name points into the
+ * buffer it was read into and is not NULL terminated. */
+struct vault_folder
+{
+    uint32_t first;
+    uint32_t count;
+    const char *name;
+    uint8_t name_len;
+};
+
+/* Read-only view of one record. Fields point into the vault buffer and are not NULL terminated. */
+struct vault_record_view
+{
+    const char *field[ENTRY_PASSWORD + 1];
+    uint8_t field_len[ENTRY_PASSWORD + 1];
+};
+
+/* Reads up to `len` bytes at `offset`. Returns the number of bytes read or a negative errno. */
+typedef int (*parse_read_t)(size_t offset, void *buf, size_t len);
+
+/* Called for each record found by a stream parser, with the file offset of the record. */
+typedef int (*parse_record_cb_t)(const struct vault_record_view *view, size_t offset, void *user_data);
+
+/* Incremental record parser. Holds at most one record at a time. */
+struct parse_stream
+{
+    enum vault_format format;
+    parse_record_cb_t cb;
+    void *user_data;
+    size_t offset;          /* File offset of the next byte */
+    size_t record_offset;   /* File offset of the record being collected */
+    size_t len;             /* Bytes of that record seen so far */
+    uint8_t field;          /* Binary vaults: field being collected */
+    uint8_t need;           /* Binary vaults: bytes left of that field */
+    char buf[CONFIG_PARSE_UTIL_RECORD_MAX_LEN];
+};
+
+int parse_append_entry(char *to_buf, size_t to_buf_len, size_t *offset, const char *field, size_t len);
+
+uint32_t parse_hash(const char *str, size_t len);
+int parse_index_add(struct entry_index_item *index, size_t *count, size_t index_max, const struct vault_record_view *view, size_t offset);
+void parse_index_sort(struct entry_index_item *index, size_t count);
+int parse_index_lookup(parse_read_t read, const struct entry_index_item *index, size_t count, const char *account, char *buf, size_t buf_len, struct vault_record_view *view);
+
+enum vault_format parse_detect_format(const void *buf, size_t len);
+int parse_bin_open(const uint8_t *buf, size_t len, struct vault_bin *vault);
+int parse_bin_read_header(const uint8_t *buf, size_t len, struct vault_bin *vault);
+size_t parse_bin_records_start(const struct vault_bin *vault);
+int parse_bin_get_record(const struct vault_bin *vault, uint32_t i, struct vault_record_view *view);
+int parse_bin_find(const struct vault_bin *vault, const char *account, struct vault_record_view *view);
+int parse_bin_get_record_read(parse_read_t read, const struct vault_bin *vault, uint32_t i, uint8_t *buf, size_t buf_len, struct vault_record_view *view);
+int parse_bin_lower_bound_read(parse_read_t read, const struct vault_bin *vault, uint32_t first, uint32_t count, const char *key, size_t key_len, uint8_t *buf, size_t buf_len, uint32_t *pos);
+int parse_bin_find_read(parse_read_t read, const struct vault_bin *vault, const char *account, uint8_t *buf, size_t buf_len, struct vault_record_view *view);
+int parse_bin_get_folder_read(parse_read_t read, const struct vault_bin *vault, uint32_t i, uint8_t *buf, size_t buf_len, struct vault_folder *folder);
+int parse_bin_find_folder_read(parse_read_t read, const struct vault_bin *vault, const char *name, uint8_t *buf, size_t buf_len, struct vault_folder *folder);
+int parse_view_get_field(const struct vault_record_view *view, uint8_t entry_type, char *to_buf, size_t to_buf_len);
+
+void parse_stream_init(struct parse_stream *stream, enum vault_format format, size_t offset, parse_record_cb_t cb, void *user_data);
+int parse_stream_feed(struct parse_stream *stream, const void *chunk, size_t len);
+int parse_stream_finish(struct parse_stream *stream);
+int parse_stream_find(parse_read_t read, struct parse_stream *stream, enum vault_format format, size_t offset, const char *account, void *chunk, size_t chunk_len, char *buf, size_t buf_len, struct vault_record_view *view);
 
 char *strtok_r(char *str, const char *sep, char **state);
-char *strchr(const char *s, int c);
\ No newline at end of file
+char *strchr(const char *s, int c);
@@ -0,0 +1,242 @@
+#include <zephyr.h>
+#include <string.h>
+#include <sys/util.h>
+#include <sys/byteorder.h>
+#include <sys/crc.h>
+#include "patch_util.h"
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(patch_util, CONFIG_PATCH_UTIL_LOG_LEVEL);
+
+enum patch_state
+{
+    STATE_HEADER,
+    STATE_OP,
+    STATE_ARGS,
+    STATE_INSERT,
+};
+
+/**
+ * @brief Check whether a file starts with a patch.
+ */
+bool patch_is_patch(const void *buf, size_t len)
+{
+    return len >= sizeof(PATCH_MAGIC) - 1 && !memcmp(buf, PATCH_MAGIC, sizeof(PATCH_MAGIC) - 1);
+}
+
+/**
+ * @brief Prepare to apply a patch.
+ *
+ * @param read_base Function reading the file the patch applies to.
+ * @param write Function writing the patched file.
+ * @param target_max Largest patched file that can be written. Patches for
+ * larger files are rejected with their header.
+ */
+void patch_stream_init(struct patch_stream *patch, patch_read_t read_base, patch_write_t write, size_t target_max)
+{
+    memset(patch, 0, sizeof(*patch));
+    patch->read_base = read_base;
+    patch->write = write;
+    patch->target_max = target_max;
+    patch->state = STATE_HEADER;
+    patch->arg_need = PATCH_HEADER_LEN;
+}
+
+static int write_target(struct patch_stream *patch, const uint8_t *buf, size_t len)
+{
+    if (len > patch->header.target_len - patch->written)
+    {
+        LOG_ERR("Patch writes past the end of the file");
+        return -EINVAL;
+    }
+    patch->crc = crc32_ieee_update(patch->crc, buf, len);
+    patch->written += len;
+    return patch->write(buf, len);
+}
+
+/**
+ * @brief Check that the base is the file the patch was made for.
+ *
+ * @return 0 if it is, -ESTALE if not, negative errno from read_base on failure.
+ */
+static int check_base(struct patch_stream *patch)
+{
+    uint32_t crc = 0;
+    size_t offset = 0;
+    int rc;
+
+    while (true)
+    {
+        rc = patch->read_base(offset, patch->copy_buf, sizeof(patch->copy_buf));
+        if (rc <= 0)
+        {
+            break;
+        }
+        crc = crc32_ieee_update(crc, patch->copy_buf, rc);
+        offset += rc;
+    }
+    if (rc < 0)
+    {
+        return rc;
+    }
+    if (offset != patch->header.base_len || crc != patch->header.base_crc)
+    {
+        LOG_WRN("Patch is for another file");
+        return -ESTALE;
+    }
+    return 0;
+}
+
+static int copy_base(struct patch_stream *patch, uint32_t offset, uint32_t len)
+{
+    if (offset > patch->header.base_len || len > patch->header.base_len - offset)
+    {
+        LOG_ERR("Patch copies past the end of the base");
+        return -EINVAL;
+    }
+    while (len > 0)
+    {
+        int rc = patch->read_base(offset, patch->copy_buf, MIN(len, sizeof(patch->copy_buf)));
+        if (rc <= 0)
+        {
+            return rc < 0 ? rc : -EINVAL;
+        }
+        int err = write_target(patch, patch->copy_buf, rc);
+        if (err)
+        {
+            return err;
+        }
+        offset += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/**
+ * @brief Act on a complete header, operation byte or set of arguments.
+ *
+ * @return 0 on success, -EINVAL if the patch is malformed, -ENOTSUP for
+ * unsupported versions, -ESTALE if the base does not match.
+ */
+static int handle_arg(struct patch_stream *patch)
+{
+    const uint8_t *arg = patch->arg;
+
+    patch->arg_len = 0;
+    switch (patch->state)
+    {
+    case STATE_HEADER:
+        if (!patch_is_patch(arg, PATCH_HEADER_LEN))
+        {
+            return -EINVAL;
+        }
+        if (arg[4] != PATCH_VERSION)
+        {
+            LOG_ERR("Unsupported patch version %d", arg[4]);
+            return -ENOTSUP;
+        }
+        patch->header.base_len = sys_get_le32(&arg[8]);
+        patch->header.base_crc = sys_get_le32(&arg[12]);
+        patch->header.target_len = sys_get_le32(&arg[16]);
+        patch->header.target_crc = sys_get_le32(&arg[20]);
+        if (patch->header.target_len > patch->target_max)
+        {
+            LOG_ERR("Patched file too big (%d B). Max: %d B", patch->header.target_len, patch->target_max);
+            return -EFBIG;
+        }
+        patch->state = STATE_OP;
+        patch->arg_need = 1;
+        return check_base(patch);
+    case STATE_OP:
+        patch->op = arg[0];
+        if (patch->op != PATCH_OP_COPY && patch->op != PATCH_OP_INSERT)
+        {
+            LOG_ERR("Unknown patch operation %d", patch->op);
+            return -EINVAL;
+        }
+        patch->state = STATE_ARGS;
+        patch->arg_need = patch->op == PATCH_OP_COPY ? 2 * sizeof(uint32_t) : sizeof(uint32_t);
+        return 0;
+    case STATE_ARGS:
+        patch->state = STATE_OP;
+        patch->arg_need = 1;
+        if (patch->op == PATCH_OP_COPY)
+        {
+            return copy_base(patch, sys_get_le32(arg), sys_get_le32(&arg[4]));
+        }
+        patch->insert_left = sys_get_le32(arg);
+        if (patch->insert_left > 0)
+        {
+            patch->state = STATE_INSERT;
+        }
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+/**
+ * @brief Apply the next piece of a patch. The base is checked as soon as the
+ * header is complete.
+ *
+ * @return 0 on success, -EINVAL if the patch is malformed, -ENOTSUP for
+ * unsupported versions, -ESTALE if the base is not the file the patch was
+ * made for, negative errno from read_base or write on failure.
+ */
+int patch_stream_feed(struct patch_stream *patch, const uint8_t *buf, size_t len)
+{
+    int err;
+
+    while (len > 0)
+    {
+        if (patch->state == STATE_INSERT)
+        {
+            size_t n = MIN(len, patch->insert_left);
+            err = write_target(patch, buf, n);
+            if (err)
+            {
+                return err;
+            }
+            patch->insert_left -= n;
+            if (patch->insert_left == 0)
+            {
+                patch->state = STATE_OP;
+                patch->arg_need = 1;
+            }
+            buf += n;
+            len -= n;
+            continue;
+        }
+        size_t n = MIN(len, patch->arg_need - patch->arg_len);
+        memcpy(&patch->arg[patch->arg_len], buf, n);
+        patch->arg_len += n;
+        buf += n;
+        len -= n;
+        if (patch->arg_len == patch->arg_need)
+        {
+            err = handle_arg(patch);
+            if (err)
+            {
+                return err;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check that the whole patch has been applied and produced the file
+ * it describes.
+ *
+ * @return 0 on success, -EBADMSG if the patched file is not the expected one.
+ */
+int patch_stream_finish(struct patch_stream *patch)
+{
+    if (patch->state == STATE_HEADER || patch->state == STATE_INSERT || patch->arg_len > 0 ||
+        patch->written != patch->header.target_len || patch->crc != patch->header.target_crc)
+    {
+        LOG_ERR("Patched file does not match, %d of %d bytes", patch->written, patch->header.target_len);
+        return -EBADMSG;
+    }
+    return 0;
+}
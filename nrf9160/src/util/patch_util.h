@@ -0,0 +1,58 @@
+/*
+ * Patch layout, all integers little endian:
+ *
+ *   magic "SKYD" | version u8 | reserved u8[3]
+ *   base_len u32 | base_crc u32 | target_len u32 | target_crc u32
+ *   operations, until target_len bytes have been produced:
+ *     PATCH_OP_COPY u8 | offset u32 | len u32: copy bytes of the base file
+ *     PATCH_OP_INSERT u8 | len u32 | bytes: insert new bytes
+ *
+ * A patch turns the stored password file (the base) into a new one (the
+ * target). Both are described by their length and CRC-32, so a patch is
+ * only applied to the file it was made for, and the result is checked
+ * before it replaces the stored file.
+ *
+ * Use scripts/vault_tool.py to make a patch.
+ */
+#define PATCH_MAGIC "SKYD"
+#define PATCH_VERSION 1
+#define PATCH_HEADER_LEN 24
+#define PATCH_OP_COPY 1
+#define PATCH_OP_INSERT 2
+
+/* Reads up to `len` bytes of the base at `offset`. Returns the number of bytes read or a negative errno. */
+typedef int (*patch_read_t)(size_t offset, void *buf, size_t len);
+
+/* Writes bytes of the target. Returns 0 or a negative errno. */
+typedef int (*patch_write_t)(const void *buf, size_t len);
+
+struct patch_header
+{
+    uint32_t base_len;
+    uint32_t base_crc;
+    uint32_t target_len;
+    uint32_t target_crc;
+};
+
+/* Applies a patch as it arrives, in pieces of any size. */
+struct patch_stream
+{
+    patch_read_t read_base;
+    patch_write_t write;
+    struct patch_header header;
+    size_t target_max;
+    uint8_t state;
+    uint8_t op;
+    uint8_t arg[PATCH_HEADER_LEN];  /* Header or arguments being collected */
+    uint8_t arg_len;
+    uint8_t arg_need;
+    uint32_t insert_left;
+    uint32_t written;
+    uint32_t crc;                   /* CRC-32 of the target written so far */
+    uint8_t copy_buf[64];
+};
+
+bool patch_is_patch(const void *buf, size_t len);
+void patch_stream_init(struct patch_stream *patch, patch_read_t read_base, patch_write_t write, size_t target_max);
+int patch_stream_feed(struct patch_stream *patch, const uint8_t *buf, size_t len);
+int patch_stream_finish(struct patch_stream *patch);
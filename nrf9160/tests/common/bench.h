@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <zephyr.h>
+
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+#include <time.h>
+#endif
+
+/*
+ * Timing and stack helpers shared by the test suites.
+ *
+ * native_posix runs in simulated time, in which code takes no time at all,
+ * so there the host clock is used: the time stamp counter on x86 hosts, the
+ * monotonic clock in ns elsewhere. On hardware it is k_cycle_get_32.
+ */
+
+static inline uint64_t bench_cycles(void)
+{
+#if defined(CONFIG_BOARD_NATIVE_POSIX) && (defined(__i386__) || defined(__x86_64__))
+    return __builtin_ia32_rdtsc();
+#elif defined(CONFIG_BOARD_NATIVE_POSIX)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+/* Elapsed cycles since `start`, from bench_cycles */
+static inline uint32_t bench_since(uint64_t start)
+{
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+    return (uint32_t)MIN(bench_cycles() - start, UINT32_MAX);
+#else
+    return k_cycle_get_32() - (uint32_t)start;
+#endif
+}
+
+/*
+ * Peak stack use of a call, measured by painting the stack below the caller
+ * and checking how much of it the call overwrote. Use as
+ *
+ *   bench_stack_paint();
+ *   call();
+ *   used = bench_stack_used();
+ *
+ * from the same function, so both helpers get the same frame. This works on
+ * native_posix too, where threads run on host stacks that
+ * k_thread_stack_space_get does not see.
+ */
+#define BENCH_STACK_PROBE_LEN 8192
+#define BENCH_STACK_PATTERN 0xa5
+
+static __noinline void bench_stack_paint(void)
+{
+    volatile uint8_t area[BENCH_STACK_PROBE_LEN];
+
+    for (size_t i = 0; i < sizeof(area); i++)
+    {
+        area[i] = BENCH_STACK_PATTERN;
+    }
+}
+
+static __noinline size_t bench_stack_untouched(volatile uint8_t *area, size_t len)
+{
+    size_t untouched = 0;
+
+    /* The stack grows down, so the call used the top of the area */
+    while (untouched < len && area[untouched] == BENCH_STACK_PATTERN)
+    {
+        untouched++;
+    }
+    return untouched;
+}
+
+static __noinline size_t bench_stack_used(void)
+{
+    volatile uint8_t area[BENCH_STACK_PROBE_LEN];
+
+    return sizeof(area) - bench_stack_untouched(area, sizeof(area));
+}
+
+#endif /* _BENCH_H_ */
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <ztest.h>
+#include <string.h>
+#include <sys/util.h>
+#include <sys/byteorder.h>
+#include "crypto_util.h"
+#include "bench.h"
+
+/*
+ * Known answers from the GCM specification (McGrew and Viega), test cases 3
+ * and 4: AES-128 with the key set in prj.conf. Case 4 has additional
+ * authenticated data and a plaintext that is not a multiple of the block.
+ */
+static const uint8_t kat_nonce[CRYPTO_NONCE_LEN] = {
+    0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+};
+
+static const uint8_t kat_plaintext[64] = {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39, 0x1a, 0xaf, 0xd2, 0x55,
+};
+
+static const uint8_t kat_ciphertext[64] = {
+    0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+    0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+    0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+    0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85,
+};
+
+static const uint8_t kat_tag[CRYPTO_TAG_LEN] = {
+    0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6, 0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4,
+};
+
+/* Test case 4 is the first 60 bytes of test case 3 */
+#define KAT_AAD_TEXT_LEN 60
+
+static const uint8_t kat_aad[20] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2,
+};
+
+static const uint8_t kat_aad_tag[CRYPTO_TAG_LEN] = {
+    0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb, 0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47,
+};
+
+/* SHA-256 of "abc", from FIPS 180-2 */
+static const char abc_digest[] = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+
+static void test_read_header(void)
+{
+    uint8_t buf[CRYPTO_HEADER_MAX_LEN] = "SKYE";
+    struct crypto_header header;
+
+    buf[4] = CRYPTO_VERSION;
+    memcpy(&buf[8], kat_nonce, sizeof(kat_nonce));
+    zassert_true(crypto_is_encrypted(buf, sizeof(buf)), NULL);
+    zassert_ok(crypto_read_header(buf, CRYPTO_HEADER_LEN, &header), NULL);
+    zassert_equal(header.header_len, CRYPTO_HEADER_LEN, NULL);
+    zassert_mem_equal(header.nonce, kat_nonce, sizeof(kat_nonce), NULL);
+
+    buf[4] = CRYPTO_VERSION_SPLIT;
+    sys_put_le32(1234, &buf[CRYPTO_HEADER_LEN]);
+    zassert_equal(crypto_read_header(buf, CRYPTO_HEADER_LEN, &header), -EINVAL, NULL);
+    zassert_ok(crypto_read_header(buf, sizeof(buf), &header), NULL);
+    zassert_equal(header.header_len, CRYPTO_HEADER_SPLIT_LEN, NULL);
+    zassert_equal(header.index_len, 1234, NULL);
+
+    buf[4] = CRYPTO_VERSION_SPLIT + 1;
+    zassert_equal(crypto_read_header(buf, sizeof(buf), &header), -ENOTSUP, NULL);
+    zassert_false(crypto_is_encrypted("SKYV", 4), NULL);
+}
+
+static void test_stream_known_answer(void)
+{
+    const size_t chunk_lens[] = {CRYPTO_BLOCK_LEN, 2 * CRYPTO_BLOCK_LEN, sizeof(kat_ciphertext)};
+    struct crypto_stream stream;
+    uint8_t buf[sizeof(kat_ciphertext)];
+    uint8_t tag[CRYPTO_TAG_LEN];
+
+    for (size_t i = 0; i < ARRAY_SIZE(chunk_lens); i++)
+    {
+        memcpy(buf, kat_ciphertext, sizeof(buf));
+        zassert_ok(crypto_stream_start(&stream, kat_nonce), NULL);
+        for (size_t pos = 0; pos < sizeof(buf); pos += chunk_lens[i])
+        {
+            zassert_ok(crypto_stream_update(&stream, &buf[pos], MIN(chunk_lens[i], sizeof(buf) - pos)), NULL);
+        }
+        zassert_ok(crypto_stream_finish(&stream, kat_tag), "Chunks of %zu bytes", chunk_lens[i]);
+        zassert_mem_equal(buf, kat_plaintext, sizeof(buf), NULL);
+    }
+
+    /* A changed tag or ciphertext is not authentic */
+    memcpy(buf, kat_ciphertext, sizeof(buf));
+    memcpy(tag, kat_tag, sizeof(tag));
+    tag[CRYPTO_TAG_LEN - 1] ^= 1;
+    zassert_ok(crypto_stream_start(&stream, kat_nonce), NULL);
+    zassert_ok(crypto_stream_update(&stream, buf, sizeof(buf)), NULL);
+    zassert_equal(crypto_stream_finish(&stream, tag), -EBADMSG, NULL);
+
+    memcpy(buf, kat_ciphertext, sizeof(buf));
+    buf[7] ^= 1;
+    zassert_ok(crypto_stream_start(&stream, kat_nonce), NULL);
+    zassert_ok(crypto_stream_update(&stream, buf, sizeof(buf)), NULL);
+    zassert_equal(crypto_stream_finish(&stream, kat_tag), -EBADMSG, NULL);
+}
+
+static void test_decrypt_at_known_answer(void)
+{
+    /* Whole blocks, the middle of a block and across blocks */
+    const size_t ranges[][2] = {{0, 64}, {16, 16}, {5, 3}, {13, 30}, {47, 17}};
+    uint8_t buf[sizeof(kat_ciphertext)];
+
+    for (size_t i = 0; i < ARRAY_SIZE(ranges); i++)
+    {
+        size_t offset = ranges[i][0];
+        size_t len = ranges[i][1];
+
+        memcpy(buf, &kat_ciphertext[offset], len);
+        zassert_ok(crypto_decrypt_at(kat_nonce, offset, buf, len), NULL);
+        zassert_mem_equal(buf, &kat_plaintext[offset], len, "%zu bytes at %zu", len, offset);
+    }
+}
+
+static void test_decrypt_record_known_answer(void)
+{
+    uint8_t rec[CRYPTO_NONCE_LEN + KAT_AAD_TEXT_LEN + CRYPTO_TAG_LEN];
+    uint8_t *plaintext;
+
+    memcpy(rec, kat_nonce, CRYPTO_NONCE_LEN);
+    memcpy(&rec[CRYPTO_NONCE_LEN], kat_ciphertext, KAT_AAD_TEXT_LEN);
+    memcpy(&rec[CRYPTO_NONCE_LEN + KAT_AAD_TEXT_LEN], kat_aad_tag, CRYPTO_TAG_LEN);
+    zassert_equal(crypto_decrypt_record(rec, sizeof(rec), (const char *)kat_aad, sizeof(kat_aad), &plaintext),
+                  KAT_AAD_TEXT_LEN, NULL);
+    zassert_mem_equal(plaintext, kat_plaintext, KAT_AAD_TEXT_LEN, NULL);
+
+    /* The record of another account */
+    memcpy(&rec[CRYPTO_NONCE_LEN], kat_ciphertext, KAT_AAD_TEXT_LEN);
+    zassert_equal(crypto_decrypt_record(rec, sizeof(rec), (const char *)kat_aad, sizeof(kat_aad) - 1, &plaintext),
+                  -EBADMSG, NULL);
+    zassert_equal(crypto_decrypt_record(rec, CRYPTO_NONCE_LEN + CRYPTO_TAG_LEN - 1, "", 0, &plaintext),
+                  -EINVAL, NULL);
+}
+
+static void test_read_locator(void)
+{
+    uint8_t field[CRYPTO_LOCATOR_LEN];
+    struct crypto_locator locator;
+
+    sys_put_le32(0x12345, field);
+    sys_put_le16(CRYPTO_NONCE_LEN + CRYPTO_TAG_LEN + 8, &field[4]);
+    zassert_ok(crypto_read_locator((const char *)field, sizeof(field), &locator), NULL);
+    zassert_equal(locator.offset, 0x12345, NULL);
+    zassert_equal(locator.len, CRYPTO_NONCE_LEN + CRYPTO_TAG_LEN + 8, NULL);
+    zassert_equal(crypto_read_locator((const char *)field, sizeof(field) - 1, &locator), -EINVAL, NULL);
+    sys_put_le16(CRYPTO_NONCE_LEN + CRYPTO_TAG_LEN - 1, &field[4]);
+    zassert_equal(crypto_read_locator((const char *)field, sizeof(field), &locator), -EINVAL, NULL);
+}
+
+static void test_digest_known_answer(void)
+{
+    uint8_t expected[CRYPTO_DIGEST_LEN];
+    struct crypto_digest digest;
+
+    zassert_ok(crypto_digest_parse(abc_digest, expected), NULL);
+    zassert_ok(crypto_digest_start(&digest), NULL);
+    zassert_ok(crypto_digest_update(&digest, "a", 1), NULL);
+    zassert_ok(crypto_digest_update(&digest, "bc", 2), NULL);
+    zassert_ok(crypto_digest_finish(&digest, expected), NULL);
+
+    zassert_ok(crypto_digest_start(&digest), NULL);
+    zassert_ok(crypto_digest_update(&digest, "abd", 3), NULL);
+    zassert_equal(crypto_digest_finish(&digest, expected), -EBADMSG, NULL);
+
+    zassert_equal(crypto_digest_parse("ba7816bf", expected), -EINVAL, NULL);
+}
+
+//========================================================================================
+/*                                                                                      *
+ *                                     Benchmarks                                       *
+ *                                                                                      */
+//========================================================================================
+
+#define BENCH_VAULT_MAX_LEN (512 * 1024)
+/* Same as the default CONFIG_PASSWORD_READ_WINDOW_SIZE */
+#define READ_WINDOW_LEN 256
+#define RECORD_LEN 48
+
+static uint8_t vault[BENCH_VAULT_MAX_LEN];
+static uint8_t vault_tag[CRYPTO_TAG_LEN];
+
+/**
+ * @brief Encrypt the first len bytes of vault in place, as vault_tool.py does.
+ */
+static void encrypt_vault(size_t len)
+{
+    mbedtls_gcm_context gcm;
+    uint8_t key[16];
+
+    zassert_equal(hex2bin(CONFIG_CRYPTO_UTIL_VAULT_KEY, 2 * sizeof(key), key, sizeof(key)), sizeof(key), NULL);
+    for (size_t i = 0; i < len; i++)
+    {
+        vault[i] = "account\tlogin\tpassword\n"[i % 23];
+    }
+    mbedtls_gcm_init(&gcm);
+    zassert_ok(mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, sizeof(key) * 8), NULL);
+    zassert_ok(mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, len, kat_nonce, CRYPTO_NONCE_LEN, NULL, 0,
+                                         vault, vault, sizeof(vault_tag), vault_tag), NULL);
+    mbedtls_gcm_free(&gcm);
+}
+
+struct bench_decrypt_arg
+{
+    size_t len;
+    int err;
+};
+
+/* Authenticates the vault like the password module loads it: a read window
+ * at a time, decrypted in place. */
+static void bench_stream_fn(struct bench_decrypt_arg *bench)
+{
+    struct crypto_stream stream;
+    uint8_t window[READ_WINDOW_LEN];
+
+    bench->err = crypto_stream_start(&stream, kat_nonce);
+    for (size_t pos = 0; !bench->err && pos < bench->len; pos += sizeof(window))
+    {
+        size_t len = MIN(sizeof(window), bench->len - pos);
+
+        memcpy(window, &vault[pos], len);
+        bench->err = crypto_stream_update(&stream, window, len);
+    }
+    if (!bench->err)
+    {
+        bench->err = crypto_stream_finish(&stream, vault_tag);
+    }
+}
+
+/* Decrypts single records at spread out offsets, as lookups do once the
+ * vault has been authenticated. */
+static void bench_record_fn(struct bench_decrypt_arg *bench)
+{
+    uint8_t record[RECORD_LEN];
+
+    for (size_t i = 0; !bench->err && i < 100; i++)
+    {
+        size_t offset = (bench->len - sizeof(record)) * i / 100;
+
+        memcpy(record, &vault[offset], sizeof(record));
+        bench->err = crypto_decrypt_at(kat_nonce, offset, record, sizeof(record));
+    }
+}
+
+/**
+ * Decrypt throughput against vault size. Cycles are host cycles on
+ * native_posix, compare runs on the same machine only.
+ */
+static void test_bench_decrypt(void)
+{
+    const size_t lens[] = {4 * 1024, 64 * 1024, BENCH_VAULT_MAX_LEN};
+
+    for (size_t i = 0; i < ARRAY_SIZE(lens); i++)
+    {
+        struct bench_decrypt_arg stream = {.len = lens[i]};
+        struct bench_decrypt_arg record = {.len = lens[i]};
+        uint32_t stream_cycles, record_cycles;
+        size_t stream_stack, record_stack;
+        uint64_t start;
+
+        encrypt_vault(lens[i]);
+
+        bench_stack_paint();
+        start = bench_cycles();
+        bench_stream_fn(&stream);
+        stream_cycles = bench_since(start);
+        stream_stack = bench_stack_used();
+        zassert_ok(stream.err, NULL);
+
+        bench_stack_paint();
+        start = bench_cycles();
+        bench_record_fn(&record);
+        record_cycles = bench_since(start);
+        record_stack = bench_stack_used();
+        zassert_ok(record.err, NULL);
+
+        TC_PRINT("%3zu KiB vault: authenticate %3u cycles/byte, stack %4zu bytes; "
+                 "record %5u cycles, stack %4zu bytes\n",
+                 lens[i] / 1024, (uint32_t)(stream_cycles / lens[i]), stream_stack, record_cycles / 100, record_stack);
+    }
+}
+
+void test_main(void)
+{
+    ztest_test_suite(crypto_util,
+                     ztest_unit_test(test_read_header),
+                     ztest_unit_test(test_stream_known_answer),
+                     ztest_unit_test(test_decrypt_at_known_answer),
+                     ztest_unit_test(test_decrypt_record_known_answer),
+                     ztest_unit_test(test_read_locator),
+                     ztest_unit_test(test_digest_known_answer),
+                     ztest_unit_test(test_bench_decrypt));
+    ztest_run_test_suite(crypto_util);
+}
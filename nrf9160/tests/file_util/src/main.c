@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <ztest.h>
+#include <string.h>
+#include <fs/fs.h>
+#include <fs/littlefs.h>
+#include <storage/flash_map.h>
+#include <stats/stats.h>
+#if defined(CONFIG_FILE_UTIL_BACKEND_RAW_FLASH)
+#include <storage/stream_flash.h>
+#endif
+#include "file_util.h"
+#include "bench.h"
+
+#define FILE_LEN (64 * 1024)
+/* Download fragments of the download client */
+#define FRAGMENT_LEN 2048
+/* Bytes read by one lookup of the password module */
+#define RECORD_LEN 64
+#define ACCESSES 100
+
+static uint8_t file_buf[FILE_LEN];
+
+/**
+ * Fills file_buf with pseudo random bytes, different for each seed.
+ */
+static void fill_file(uint32_t seed)
+{
+    uint32_t x = seed;
+
+    for (size_t i = 0; i < sizeof(file_buf); i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        file_buf[i] = x;
+    }
+}
+
+/**
+ * Stores file_buf as the password file, in fragments of frag_len bytes.
+ */
+static void write_file(size_t frag_len)
+{
+    zassert_ok(file_write_start(), NULL);
+    for (size_t pos = 0; pos < FILE_LEN; pos += frag_len)
+    {
+        zassert_ok(file_write(&file_buf[pos], MIN(frag_len, FILE_LEN - pos)), "At %zu", pos);
+    }
+    zassert_ok(file_write_commit(FILE_LEN), NULL);
+}
+
+/**
+ * Checks that the password file holds file_buf.
+ */
+static void check_file(void)
+{
+    struct file_reader reader;
+    uint8_t buf[FRAGMENT_LEN];
+
+    zassert_ok(file_read_start(&reader), NULL);
+    zassert_equal(file_size_get(&reader), FILE_LEN, NULL);
+    for (size_t pos = 0; pos < FILE_LEN; pos += sizeof(buf))
+    {
+        zassert_equal(file_read_at(&reader, pos, buf, sizeof(buf)), sizeof(buf), "At %zu", pos);
+        zassert_mem_equal(buf, &file_buf[pos], sizeof(buf), "At %zu", pos);
+    }
+    zassert_equal(file_read_at(&reader, FILE_LEN, buf, sizeof(buf)), 0, NULL);
+    zassert_ok(file_read_end(&reader), NULL);
+}
+
+/* Counter of the flash simulator looked up by stats_walk */
+struct sim_counter
+{
+    const char *name;
+    uint32_t value;
+};
+
+static int find_counter(struct stats_hdr *hdr, void *arg, const char *name, uint16_t off)
+{
+    struct sim_counter *counter = arg;
+
+    if (strcmp(name, counter->name) == 0)
+    {
+        counter->value = *(uint32_t *)((uint8_t *)hdr + off);
+    }
+    return 0;
+}
+
+/**
+ * Gets a counter of the flash simulator, e.g. flash_read_calls.
+ */
+static uint32_t sim_counter(const char *name)
+{
+    struct sim_counter counter = { .name = name };
+    struct stats_hdr *hdr = stats_group_find("flash_sim_stats");
+
+    zassert_not_null(hdr, "No flash simulator stats");
+    stats_walk(hdr, find_counter, &counter);
+    return counter.value;
+}
+
+/* Offset of the record read by access i, spread over the file */
+static size_t access_offset(int i)
+{
+    return (i * 7919u * RECORD_LEN) % (FILE_LEN - RECORD_LEN);
+}
+
+/**
+ * Reads a record as the password module does, with the file system mounted
+ * once by file_util.
+ */
+static int mounted_read(size_t offset, void *buf, size_t len)
+{
+    struct file_reader reader;
+    int rc;
+
+    rc = file_read_start(&reader);
+    if (rc)
+    {
+        return rc;
+    }
+    rc = file_read_at(&reader, offset, buf, len);
+    file_read_end(&reader);
+    return rc;
+}
+
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+/* Mount of the same partition and file as file_util.c, to read them the way
+ * file_util did before the file system stayed mounted */
+FS_LITTLEFS_DECLARE_DEFAULT_CONFIG(bench_storage);
+static struct fs_mount_t bench_mnt = {
+    .type = FS_LITTLEFS,
+    .fs_data = &bench_storage,
+    .storage_dev = (void *)FLASH_AREA_ID(storage),
+    .mnt_point = "/lfs",
+};
+#define BENCH_PATH "/lfs/my_passwords"
+
+/**
+ * Reads a record with a mount, open, read, close and unmount per access.
+ */
+static int remount_read(size_t offset, void *buf, size_t len)
+{
+    struct fs_file_t file;
+    int rc;
+
+    rc = fs_mount(&bench_mnt);
+    if (rc)
+    {
+        return rc;
+    }
+    fs_file_t_init(&file);
+    rc = fs_open(&file, BENCH_PATH, FS_O_READ);
+    if (!rc)
+    {
+        rc = fs_seek(&file, offset, FS_SEEK_SET);
+        rc = rc ? rc : fs_read(&file, buf, len);
+        fs_close(&file);
+    }
+    fs_unmount(&bench_mnt);
+    return rc;
+}
+
+/**
+ * Stores file_buf through bench_mnt, before file_util has mounted.
+ */
+static void remount_write(void)
+{
+    struct fs_file_t file;
+
+    zassert_ok(fs_mount(&bench_mnt), NULL);
+    fs_file_t_init(&file);
+    zassert_ok(fs_open(&file, BENCH_PATH, FS_O_CREATE | FS_O_WRITE), NULL);
+    zassert_equal(fs_write(&file, file_buf, FILE_LEN), FILE_LEN, NULL);
+    zassert_ok(fs_close(&file), NULL);
+    zassert_ok(fs_unmount(&bench_mnt), NULL);
+}
+#endif
+
+/**
+ * Times ACCESSES record reads through read_fn, and counts the flash reads
+ * they take. The first access is timed apart, it may include the mount.
+ */
+static void bench_access(int (*read_fn)(size_t, void *, size_t), uint32_t *first_cycles,
+                         uint32_t *cycles, uint32_t *flash_reads)
+{
+    uint8_t buf[RECORD_LEN];
+    uint32_t reads = sim_counter("flash_read_calls");
+    uint64_t start = bench_cycles();
+
+    for (int i = 0; i < ACCESSES; i++)
+    {
+        size_t offset = access_offset(i);
+
+        zassert_equal(read_fn(offset, buf, sizeof(buf)), sizeof(buf), "Access %d", i);
+        zassert_mem_equal(buf, &file_buf[offset], sizeof(buf), "Access %d", i);
+        if (i == 0)
+        {
+            *first_cycles = bench_since(start);
+            start = bench_cycles();
+        }
+    }
+    *cycles = bench_since(start) / (ACCESSES - 1);
+    *flash_reads = (sim_counter("flash_read_calls") - reads) / ACCESSES;
+}
+
+/**
+ * Compares the latency of reading a record with the file system mounted
+ * once against mounting it for every access. Runs first, before anything
+ * else mounts the storage partition.
+ */
+static void test_bench_read_latency(void)
+{
+    struct file_stats stats;
+    uint32_t first_cycles, cycles, flash_reads;
+
+    fill_file(1);
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+    remount_write();
+    bench_access(remount_read, &first_cycles, &cycles, &flash_reads);
+    TC_PRINT("mount per access:  first %8u cycles, then %8u cycles, %4u flash reads per access\n",
+             first_cycles, cycles, flash_reads);
+#else
+    write_file(FRAGMENT_LEN);
+#endif
+    bench_access(mounted_read, &first_cycles, &cycles, &flash_reads);
+    TC_PRINT("mounted once:      first %8u cycles, then %8u cycles, %4u flash reads per access\n",
+             first_cycles, cycles, flash_reads);
+
+    file_stats_get(&stats);
+    zassert_equal(stats.mounts, 1, "Mounted %u times", stats.mounts);
+}
+
+static void test_commit_replaces_file(void)
+{
+    struct file_reader reader;
+    uint32_t generation;
+
+    fill_file(2);
+    write_file(FRAGMENT_LEN);
+    check_file();
+    zassert_ok(file_read_start(&reader), NULL);
+    generation = reader.generation;
+    zassert_ok(file_read_end(&reader), NULL);
+
+    /* Fragments of any size make the same file */
+    fill_file(3);
+    write_file(1000);
+    check_file();
+    zassert_not_equal(file_generation(), generation, NULL);
+
+    /* The replaced file is the backup */
+    generation = file_generation();
+    zassert_ok(file_restore_backup(), NULL);
+    zassert_not_equal(file_generation(), generation, NULL);
+    fill_file(2);
+    check_file();
+}
+
+static void test_abort_keeps_file(void)
+{
+    fill_file(4);
+    write_file(FRAGMENT_LEN);
+
+    zassert_ok(file_write_start(), NULL);
+    zassert_ok(file_write(file_buf, FRAGMENT_LEN), NULL);
+    zassert_ok(file_write_abort(), NULL);
+    check_file();
+
+    /* A file of the wrong length is not committed */
+    zassert_ok(file_write_start(), NULL);
+    zassert_ok(file_write(file_buf, FRAGMENT_LEN), NULL);
+    zassert_not_equal(file_write_commit(FILE_LEN), 0, NULL);
+    check_file();
+}
+
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+/* fs_rename is wrapped at link time. The rename_fail_at-th rename from now
+ * on fails, 0 for none. */
+static int rename_fail_at;
+
+int __real_fs_rename(const char *from, const char *to);
+
+int __wrap_fs_rename(const char *from, const char *to)
+{
+    if (rename_fail_at > 0 && --rename_fail_at == 0)
+    {
+        return -EIO;
+    }
+    return __real_fs_rename(from, to);
+}
+#endif
+
+static void test_failed_commit_keeps_file(void)
+{
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+    fill_file(8);
+    write_file(FRAGMENT_LEN);
+
+    /* The live file is moved to the backup, then the staging file fails to
+     * take its place */
+    fill_file(9);
+    zassert_ok(file_write_start(), NULL);
+    zassert_ok(file_write(file_buf, FILE_LEN), NULL);
+    rename_fail_at = 2;
+    zassert_equal(file_write_commit(FILE_LEN), -EIO, NULL);
+    zassert_equal(rename_fail_at, 0, NULL);
+    fill_file(8);
+    check_file();
+
+    /* The next download commits as usual */
+    fill_file(10);
+    write_file(FRAGMENT_LEN);
+    check_file();
+    zassert_ok(file_restore_backup(), NULL);
+    fill_file(8);
+    check_file();
+#else
+    /* The raw flash backend commits by writing a trailer, without renames */
+    ztest_test_skip();
+#endif
+}
+
+static struct k_thread reader_thread;
+static K_THREAD_STACK_DEFINE(reader_stack, 4096);
+static int reader_rc;
+
+static void reader_fn(void *p1, void *p2, void *p3)
+{
+    uint8_t buf[RECORD_LEN];
+
+    reader_rc = mounted_read(0, buf, sizeof(buf));
+    if (reader_rc == sizeof(buf))
+    {
+        reader_rc = memcmp(buf, file_buf, sizeof(buf)) ? -EIO : 0;
+    }
+}
+
+static void test_readers_own_handles(void)
+{
+    struct file_reader reader;
+    uint8_t buf[RECORD_LEN];
+
+    fill_file(5);
+    write_file(FRAGMENT_LEN);
+
+    zassert_ok(file_read_start(&reader), NULL);
+    /* A second reader gets in while the first one reads */
+    k_thread_create(&reader_thread, reader_stack, K_THREAD_STACK_SIZEOF(reader_stack),
+                    reader_fn, NULL, NULL, NULL, K_PRIO_PREEMPT(0), 0, K_NO_WAIT);
+    zassert_ok(k_thread_join(&reader_thread, K_SECONDS(1)), "Second reader was blocked");
+    zassert_ok(reader_rc, NULL);
+
+    /* and ending it leaves the handle of the first one open */
+    zassert_equal(file_read_at(&reader, FILE_LEN - RECORD_LEN, buf, sizeof(buf)), RECORD_LEN, NULL);
+    zassert_mem_equal(buf, &file_buf[FILE_LEN - RECORD_LEN], RECORD_LEN, NULL);
+    zassert_ok(file_read_end(&reader), NULL);
+}
+
+/**
+ * Looks up a record by copying it out of the file, as with littlefs.
+ */
+static int copied_lookup(size_t offset)
+{
+    struct file_reader reader;
+    uint8_t buf[RECORD_LEN];
+    int rc;
+
+    rc = file_read_start(&reader);
+    if (rc)
+    {
+        return rc;
+    }
+    rc = file_read_at(&reader, offset, buf, sizeof(buf));
+    if (rc == sizeof(buf))
+    {
+        rc = memcmp(buf, &file_buf[offset], sizeof(buf)) ? -EIO : 0;
+    }
+    file_read_end(&reader);
+    return rc;
+}
+
+/**
+ * Looks up a record in place, as the password module does on the raw flash
+ * backend.
+ */
+static int mapped_lookup(size_t offset)
+{
+    struct file_reader reader;
+    const void *record;
+    int rc;
+
+    rc = file_read_start(&reader);
+    if (rc)
+    {
+        return rc;
+    }
+    rc = file_read_map(&reader, offset, RECORD_LEN, &record);
+    if (!rc)
+    {
+        rc = memcmp(record, &file_buf[offset], RECORD_LEN) ? -EIO : 0;
+    }
+    file_read_end(&reader);
+    return rc;
+}
+
+static void bench_lookup(int (*lookup_fn)(size_t), uint32_t *cycles, size_t *stack)
+{
+    uint64_t start;
+
+    bench_stack_paint();
+    start = bench_cycles();
+    for (int i = 0; i < ACCESSES; i++)
+    {
+        zassert_ok(lookup_fn(access_offset(i)), "Access %d", i);
+    }
+    *cycles = bench_since(start) / ACCESSES;
+    *stack = bench_stack_used();
+}
+
+/**
+ * Compares looking up records by copy against in place, and prints the RAM
+ * the backend takes. The two backends are built as separate test cases, so
+ * compare the numbers of both.
+ */
+static void test_bench_map_read(void)
+{
+    struct file_reader reader;
+    const void *record;
+    uint32_t cycles;
+    size_t stack;
+    int rc;
+
+    fill_file(6);
+    write_file(FRAGMENT_LEN);
+
+    bench_lookup(copied_lookup, &cycles, &stack);
+    TC_PRINT("copied lookup: %6u cycles, stack %4zu bytes\n", cycles, stack);
+
+    zassert_ok(file_read_start(&reader), NULL);
+    rc = file_read_map(&reader, 0, RECORD_LEN, &record);
+#if defined(CONFIG_FILE_UTIL_BACKEND_RAW_FLASH)
+    zassert_ok(rc, NULL);
+    zassert_equal(file_read_map(&reader, FILE_LEN - RECORD_LEN + 1, RECORD_LEN, &record), -EINVAL, NULL);
+    zassert_ok(file_read_end(&reader), NULL);
+
+    bench_lookup(mapped_lookup, &cycles, &stack);
+    TC_PRINT("mapped lookup: %6u cycles, stack %4zu bytes\n", cycles, stack);
+    /* stream_flash and its buffer, nothing per reader */
+    TC_PRINT("raw flash RAM: %4zu bytes, %3zu bytes per reader\n",
+             sizeof(struct stream_flash_ctx) + CONFIG_FILE_UTIL_RAW_FLASH_BUF_SIZE,
+             sizeof(struct file_reader));
+#else
+    zassert_equal(rc, -ENOTSUP, NULL);
+    zassert_ok(file_read_end(&reader), NULL);
+    /* The mount with its read and program caches and lookahead buffer, the
+     * write buffer, and an lfs_file with its cache per reader */
+    TC_PRINT("littlefs RAM:  %4zu bytes, %3zu bytes per reader\n",
+             sizeof(struct fs_littlefs) + 2 * CONFIG_FS_LITTLEFS_CACHE_SIZE +
+             CONFIG_FS_LITTLEFS_LOOKAHEAD_SIZE + CONFIG_FILE_UTIL_WRITE_BUF_SIZE,
+             sizeof(struct file_reader) + sizeof(struct lfs_file) + CONFIG_FS_LITTLEFS_CACHE_SIZE);
+#endif
+}
+
+/* Fragment sizes of a download: the first one, then the others in turn */
+struct fragment_profile
+{
+    const char *name;
+    size_t first;
+    size_t next[4];
+};
+
+static const struct fragment_profile profiles[] = {
+    /* The download client fills its 2 KiB buffer, the first fragment is
+     * what is left after the HTTP header */
+    { "http, 2 KiB buffer", 1711, { 2048 } },
+    /* CoAP block-wise transfer */
+    { "coap, 512 B blocks", 512, { 512 } },
+    /* TLS records as the modem hands them over */
+    { "tls, uneven records", 1211, { 1460, 837, 2048, 305 } },
+};
+
+/**
+ * Passes file_buf to write_fn in the fragments of a profile.
+ * @return Number of fragments.
+ */
+static uint32_t write_fragments(const struct fragment_profile *profile,
+                                int (*write_fn)(const void *, size_t))
+{
+    size_t pos = 0;
+    size_t len = profile->first;
+    int next = 0;
+    uint32_t count = 0;
+
+    while (pos < FILE_LEN)
+    {
+        len = MIN(len, FILE_LEN - pos);
+        zassert_ok(write_fn(&file_buf[pos], len), "At %zu", pos);
+        pos += len;
+        count++;
+        len = profile->next[next];
+        next = next + 1 < ARRAY_SIZE(profile->next) && profile->next[next + 1] ? next + 1 : 0;
+    }
+    return count;
+}
+
+/* Flash operations counted by the simulator */
+struct flash_ops
+{
+    uint32_t programs;
+    uint32_t erases;
+};
+
+static void flash_ops_start(struct flash_ops *ops)
+{
+    ops->programs = sim_counter("flash_write_calls");
+    ops->erases = sim_counter("flash_erase_calls");
+}
+
+static void flash_ops_since(struct flash_ops *ops)
+{
+    ops->programs = sim_counter("flash_write_calls") - ops->programs;
+    ops->erases = sim_counter("flash_erase_calls") - ops->erases;
+}
+
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+static struct fs_file_t unbuffered_file;
+
+/**
+ * Writes a fragment straight to littlefs, as file_write did before it
+ * collected fragments in its write buffer.
+ */
+static int unbuffered_write(const void *fragment, size_t len)
+{
+    ssize_t rc = fs_write(&unbuffered_file, fragment, len);
+
+    return rc == len ? 0 : rc < 0 ? rc : -ENOSPC;
+}
+#endif
+
+/**
+ * Counts the writes and the flash programs and erases a download takes with
+ * realistic fragment sizes. On littlefs it compares the write buffer of
+ * file_write against passing every fragment to fs_write. The buffered
+ * download includes the commit, with its renames, the unbuffered one only
+ * closes its file.
+ */
+static void test_bench_program_ops(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(profiles); i++)
+    {
+        struct file_stats before, after;
+        struct flash_ops ops;
+        uint32_t fragments;
+
+        fill_file(7 + i);
+        file_stats_get(&before);
+        flash_ops_start(&ops);
+        zassert_ok(file_write_start(), NULL);
+        fragments = write_fragments(&profiles[i], file_write);
+        zassert_ok(file_write_commit(FILE_LEN), NULL);
+        flash_ops_since(&ops);
+        file_stats_get(&after);
+        check_file();
+        TC_PRINT("%-19s %3u fragments: buffered   %3u writes, %4u programs, %3u erases\n",
+                 profiles[i].name, fragments, after.writes - before.writes, ops.programs, ops.erases);
+
+#if defined(CONFIG_FILE_UTIL_BACKEND_LITTLEFS)
+        /* Only whole write buffers are written, and the tail on commit */
+        zassert_true(after.writes - before.writes <= DIV_ROUND_UP(FILE_LEN, file_write_block_size()),
+                     "%u writes", after.writes - before.writes);
+
+        flash_ops_start(&ops);
+        fs_file_t_init(&unbuffered_file);
+        zassert_ok(fs_open(&unbuffered_file, "/lfs/unbuffered", FS_O_CREATE | FS_O_WRITE), NULL);
+        write_fragments(&profiles[i], unbuffered_write);
+        zassert_ok(fs_close(&unbuffered_file), NULL);
+        flash_ops_since(&ops);
+        zassert_ok(fs_unlink("/lfs/unbuffered"), NULL);
+        TC_PRINT("%-19s %3u fragments: unbuffered %3u writes, %4u programs, %3u erases\n",
+                 profiles[i].name, fragments, fragments, ops.programs, ops.erases);
+#endif
+    }
+}
+
+void test_main(void)
+{
+    ztest_test_suite(file_util,
+                     ztest_unit_test(test_bench_read_latency),
+                     ztest_unit_test(test_commit_replaces_file),
+                     ztest_unit_test(test_abort_keeps_file),
+                     ztest_unit_test(test_failed_commit_keeps_file),
+                     ztest_unit_test(test_readers_own_handles),
+                     ztest_unit_test(test_bench_map_read),
+                     ztest_unit_test(test_bench_program_ops));
+    ztest_run_test_suite(file_util);
+}
@@ -0,0 +1,898 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <ztest.h>
+#include <string.h>
+#include <sys/byteorder.h>
+#include "parse_util.h"
+#include "vault_gen.h"
+#include "bench.h"
+
+/* Fits 10k records with 32 character names in either format */
+#define VAULT_BUF_LEN (1024 * 1024)
+#define INDEX_MAX 10000
+/* Same as the default CONFIG_PASSWORD_READ_WINDOW_SIZE */
+#define READ_WINDOW_LEN 256
+
+static uint8_t vault_buf[VAULT_BUF_LEN];
+static size_t vault_len;
+static struct entry_index_item entry_index[INDEX_MAX];
+static size_t index_count;
+static uint8_t record_buf[CONFIG_PARSE_UTIL_RECORD_MAX_LEN];
+static struct parse_stream stream;
+
+/* Reads of the vault through buf_read, to tell how much a search touches */
+static uint32_t read_calls;
+static size_t read_bytes;
+
+static int buf_read(size_t offset, void *buf, size_t len)
+{
+    if (offset > vault_len)
+    {
+        return -EINVAL;
+    }
+    len = MIN(len, vault_len - offset);
+    memcpy(buf, &vault_buf[offset], len);
+    read_calls++;
+    read_bytes += len;
+    return len;
+}
+
+/* Checks every record the stream parser reports against the generator */
+struct stream_check
+{
+    const struct vault_gen_params *params;
+    enum vault_format format;
+    uint32_t count;
+    bool index;
+};
+
+static int check_record(const struct vault_record_view *view, size_t offset, void *user_data)
+{
+    struct stream_check *check = user_data;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+
+    vault_gen_name(check->params, check->count, name);
+    vault_gen_password(check->count, password);
+    zassert_equal(view->field_len[ENTRY_ACCOUNT], strlen(name), "Record %d", check->count);
+    zassert_mem_equal(view->field[ENTRY_ACCOUNT], name, strlen(name), "Record %d", check->count);
+    zassert_equal(view->field_len[ENTRY_PASSWORD], strlen(password), "Record %d", check->count);
+    zassert_mem_equal(view->field[ENTRY_PASSWORD], password, strlen(password), "Record %d", check->count);
+    if (check->format == VAULT_FORMAT_BINARY)
+    {
+        zassert_equal(offset, sys_get_le32(&vault_buf[VAULT_HEADER_LEN + check->count * sizeof(uint32_t)]),
+                      "Record %d", check->count);
+    }
+    else
+    {
+        zassert_mem_equal(&vault_buf[offset], name, strlen(name), "Record %d", check->count);
+    }
+    if (check->index)
+    {
+        zassert_ok(parse_index_add(entry_index, &index_count, INDEX_MAX, view, offset), NULL);
+    }
+    check->count++;
+    return 0;
+}
+
+/* Counts records only, so benchmarks time the parser and not the checks */
+static int count_record(const struct vault_record_view *view, size_t offset, void *user_data)
+{
+    struct stream_check *check = user_data;
+
+    if (check->index && parse_index_add(entry_index, &index_count, INDEX_MAX, view, offset))
+    {
+        return -ENOBUFS;
+    }
+    check->count++;
+    return 0;
+}
+
+static int stream_vault(enum vault_format format, size_t chunk_len, parse_record_cb_t cb,
+                        struct stream_check *check)
+{
+    size_t start = 0;
+    int err = 0;
+
+    if (format == VAULT_FORMAT_BINARY)
+    {
+        struct vault_bin vault;
+
+        zassert_ok(parse_bin_read_header(vault_buf, vault_len, &vault), NULL);
+        start = parse_bin_records_start(&vault);
+    }
+    index_count = 0;
+    parse_stream_init(&stream, format, start, cb, check);
+    for (size_t pos = start; !err && pos < vault_len; pos += chunk_len)
+    {
+        err = parse_stream_feed(&stream, &vault_buf[pos], MIN(chunk_len, vault_len - pos));
+    }
+    if (!err)
+    {
+        err = parse_stream_finish(&stream);
+    }
+    if (!err && check->index)
+    {
+        parse_index_sort(entry_index, index_count);
+    }
+    return err;
+}
+
+static void test_detect_format(void)
+{
+    uint8_t header[VAULT_HEADER_LEN] = "SKYV";
+
+    header[4] = VAULT_VERSION;
+    zassert_equal(parse_detect_format(header, sizeof(header)), VAULT_FORMAT_BINARY, NULL);
+    zassert_equal(parse_detect_format(header, 4), VAULT_FORMAT_UNSUPPORTED, NULL);
+    header[4] = VAULT_VERSION + 1;
+    zassert_equal(parse_detect_format(header, sizeof(header)), VAULT_FORMAT_UNSUPPORTED, NULL);
+    zassert_equal(parse_detect_format("acc\tlogin\tpw\n", 13), VAULT_FORMAT_TSV, NULL);
+    zassert_equal(parse_detect_format("SKY", 3), VAULT_FORMAT_TSV, NULL);
+}
+
+static void test_read_header_rejects_malformed(void)
+{
+    struct vault_gen_params params = {.count = 10, .name_len = 8, .folders = 2};
+    struct vault_bin vault;
+    uint8_t header[VAULT_HEADER_MAX_LEN];
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_true(vault_len > 0, NULL);
+    zassert_ok(parse_bin_read_header(vault_buf, vault_len, &vault), NULL);
+    zassert_equal(vault.count, 10, NULL);
+    zassert_equal(vault.folder_count, 2, NULL);
+
+    /* An offset table past the 32-bit offsets */
+    memcpy(header, vault_buf, sizeof(header));
+    sys_put_le32(UINT32_MAX / sizeof(uint32_t), &header[8]);
+    zassert_equal(parse_bin_read_header(header, sizeof(header), &vault), -EINVAL, NULL);
+
+    /* Records starting inside the offset tables */
+    memcpy(header, vault_buf, sizeof(header));
+    sys_put_le32(VAULT_HEADER_FOLDERS_LEN, &header[16]);
+    zassert_equal(parse_bin_read_header(header, sizeof(header), &vault), -EINVAL, NULL);
+
+    /* A folder table past the 32-bit offsets */
+    memcpy(header, vault_buf, sizeof(header));
+    sys_put_le32(UINT32_MAX, &header[12]);
+    zassert_equal(parse_bin_read_header(header, sizeof(header), &vault), -EINVAL, NULL);
+
+    /* A header too short for its flags */
+    memcpy(header, vault_buf, sizeof(header));
+    sys_put_le16(VAULT_HEADER_LEN, &header[6]);
+    zassert_equal(parse_bin_read_header(header, sizeof(header), &vault), -EINVAL, NULL);
+
+    /* An offset table longer than the vault */
+    params.folders = 0;
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_equal(parse_bin_open(vault_buf, VAULT_HEADER_LEN + 8, &vault), -EINVAL, NULL);
+
+    header[4] = VAULT_VERSION + 1;
+    zassert_equal(parse_bin_read_header(header, sizeof(header), &vault), -ENOTSUP, NULL);
+}
+
+static void test_stream_binary_any_chunk_size(void)
+{
+    const size_t chunk_lens[] = {1, 7, 64, READ_WINDOW_LEN, VAULT_BUF_LEN};
+    struct vault_gen_params params = {.count = 500, .name_len = 20};
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_true(vault_len > 0, NULL);
+    for (size_t i = 0; i < ARRAY_SIZE(chunk_lens); i++)
+    {
+        struct stream_check check = {.params = &params, .format = VAULT_FORMAT_BINARY};
+
+        zassert_ok(stream_vault(VAULT_FORMAT_BINARY, chunk_lens[i], check_record, &check), NULL);
+        zassert_equal(check.count, params.count, "Chunks of %zu bytes", chunk_lens[i]);
+    }
+}
+
+static void test_stream_tsv_skips_malformed(void)
+{
+    struct vault_gen_params params = {.count = 200, .name_len = 12, .malformed_every = 7};
+    struct stream_check check = {.params = &params, .format = VAULT_FORMAT_TSV};
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+    char *end;
+
+    vault_len = vault_gen_tsv(&params, (char *)vault_buf, sizeof(vault_buf));
+    zassert_true(vault_len > 0, NULL);
+    /* Empty lines, a record longer than the stream buffer and a last record
+     * without a newline */
+    end = (char *)&vault_buf[vault_len];
+    end += sprintf(end, "\n\r\n");
+    memset(end, 'x', CONFIG_PARSE_UTIL_RECORD_MAX_LEN + 1);
+    end += CONFIG_PARSE_UTIL_RECORD_MAX_LEN + 1;
+    end += sprintf(end, "\tlogin\tpassword\n");
+    vault_gen_name(&params, params.count, name);
+    vault_gen_password(params.count, password);
+    end += sprintf(end, "%s\t%s\t%s", name, VAULT_GEN_LOGIN, password);
+    vault_len = (uint8_t *)end - vault_buf;
+    params.count++;
+
+    zassert_ok(stream_vault(VAULT_FORMAT_TSV, 13, check_record, &check), NULL);
+    zassert_equal(check.count, params.count, NULL);
+}
+
+static void test_find_read_every_record(void)
+{
+    struct vault_gen_params params = {.count = 300, .name_len = 10};
+    struct vault_record_view view;
+    struct vault_bin vault;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_ok(parse_bin_read_header(vault_buf, vault_len, &vault), NULL);
+    for (uint32_t i = 0; i < params.count; i++)
+    {
+        vault_gen_name(&params, i, name);
+        zassert_ok(parse_bin_find_read(buf_read, &vault, name, record_buf, sizeof(record_buf), &view), "%s", name);
+        zassert_mem_equal(view.field[ENTRY_ACCOUNT], name, strlen(name), NULL);
+    }
+    zassert_equal(parse_bin_find_read(buf_read, &vault, "", record_buf, sizeof(record_buf), &view), -ENOENT, NULL);
+    zassert_equal(parse_bin_find_read(buf_read, &vault, "zzz", record_buf, sizeof(record_buf), &view), -ENOENT, NULL);
+    name[strlen(name) - 1] = '\0';
+    zassert_equal(parse_bin_find_read(buf_read, &vault, name, record_buf, sizeof(record_buf), &view), -ENOENT, NULL);
+
+    /* The same, with the vault in memory */
+    zassert_ok(parse_bin_open(vault_buf, vault_len, &vault), NULL);
+    vault_gen_name(&params, params.count - 1, name);
+    zassert_ok(parse_bin_find(&vault, name, &view), NULL);
+    zassert_equal(parse_bin_find(&vault, "zzz", &view), -ENOENT, NULL);
+}
+
+static void test_get_record_out_of_bounds(void)
+{
+    struct vault_gen_params params = {.count = 10, .name_len = 8};
+    struct vault_record_view view;
+    struct vault_bin vault;
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_ok(parse_bin_open(vault_buf, vault_len, &vault), NULL);
+    zassert_equal(parse_bin_get_record(&vault, params.count, &view), -ENOENT, NULL);
+    sys_put_le32(vault_len, &vault_buf[VAULT_HEADER_LEN]);
+    zassert_equal(parse_bin_get_record(&vault, 0, &view), -EINVAL, NULL);
+    /* A record running past the end of the vault */
+    sys_put_le32(vault_len - 2, &vault_buf[VAULT_HEADER_LEN]);
+    zassert_equal(parse_bin_get_record(&vault, 0, &view), -EINVAL, NULL);
+    zassert_equal(parse_bin_get_record_read(buf_read, &vault, 0, record_buf, sizeof(record_buf), &view),
+                  -EINVAL, NULL);
+}
+
+static void test_index_lookup_every_record(void)
+{
+    struct vault_gen_params params = {.count = 1000, .name_len = 16, .malformed_every = 100};
+    struct stream_check check = {.params = &params, .format = VAULT_FORMAT_TSV, .index = true};
+    struct vault_record_view view;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+
+    vault_len = vault_gen_tsv(&params, (char *)vault_buf, sizeof(vault_buf));
+    zassert_ok(stream_vault(VAULT_FORMAT_TSV, READ_WINDOW_LEN, check_record, &check), NULL);
+    zassert_equal(index_count, params.count, NULL);
+    for (uint32_t i = 0; i < params.count; i++)
+    {
+        vault_gen_name(&params, i, name);
+        vault_gen_password(i, password);
+        zassert_ok(parse_index_lookup(buf_read, entry_index, index_count, name, (char *)record_buf,
+                                      sizeof(record_buf), &view),
+                   "%s", name);
+        zassert_ok(parse_view_get_field(&view, ENTRY_PASSWORD, name, sizeof(name)), NULL);
+        zassert_equal(strcmp(name, password), 0, NULL);
+    }
+    zassert_equal(parse_index_lookup(buf_read, entry_index, index_count, "zzz", (char *)record_buf,
+                                     sizeof(record_buf), &view), -ENOENT, NULL);
+}
+
+/* Default CONFIG_PASSWORD_INDEX_MAX_NUM of the password module */
+#define SMALL_INDEX_MAX 128
+
+/* Indexes records as the password module does, until the index is full */
+struct overflow_check
+{
+    uint32_t count;
+    bool full;
+    size_t unindexed_start;
+};
+
+static int index_until_full(const struct vault_record_view *view, size_t offset, void *user_data)
+{
+    struct overflow_check *check = user_data;
+
+    if (!check->full && parse_index_add(entry_index, &index_count, SMALL_INDEX_MAX, view, offset))
+    {
+        check->full = true;
+        check->unindexed_start = offset;
+    }
+    check->count++;
+    return 0;
+}
+
+static void test_index_overflow_scans(void)
+{
+    struct vault_gen_params params = {.count = 1000, .name_len = 16, .malformed_every = 100};
+    struct overflow_check check = {0};
+    struct vault_record_view view;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+    uint8_t chunk[READ_WINDOW_LEN];
+    uint32_t scanned = 0;
+
+    vault_len = vault_gen_tsv(&params, (char *)vault_buf, sizeof(vault_buf));
+    index_count = 0;
+    parse_stream_init(&stream, VAULT_FORMAT_TSV, 0, index_until_full, &check);
+    for (size_t pos = 0; pos < vault_len; pos += READ_WINDOW_LEN)
+    {
+        zassert_ok(parse_stream_feed(&stream, &vault_buf[pos], MIN(READ_WINDOW_LEN, vault_len - pos)), NULL);
+    }
+    zassert_ok(parse_stream_finish(&stream), NULL);
+    parse_index_sort(entry_index, index_count);
+    zassert_true(check.full, NULL);
+    zassert_equal(index_count, SMALL_INDEX_MAX, NULL);
+    zassert_equal(check.count, params.count, NULL);
+
+    /* Records that are not in the index are found by the scan */
+    for (uint32_t i = 0; i < params.count; i++)
+    {
+        vault_gen_name(&params, i, name);
+        vault_gen_password(i, password);
+        int err = parse_index_lookup(buf_read, entry_index, index_count, name, (char *)record_buf,
+                                     sizeof(record_buf), &view);
+        if (err == -ENOENT)
+        {
+            scanned++;
+            err = parse_stream_find(buf_read, &stream, VAULT_FORMAT_TSV, check.unindexed_start, name,
+                                    chunk, sizeof(chunk), (char *)record_buf, sizeof(record_buf), &view);
+        }
+        zassert_ok(err, "%s", name);
+        zassert_ok(parse_view_get_field(&view, ENTRY_PASSWORD, name, sizeof(name)), NULL);
+        zassert_equal(strcmp(name, password), 0, NULL);
+    }
+    zassert_equal(scanned, params.count - SMALL_INDEX_MAX, NULL);
+    for (size_t i = 0; i < sizeof(stream.buf); i++)
+    {
+        zassert_equal(stream.buf[i], 0, "Record left in the stream buffer");
+    }
+
+    zassert_equal(parse_stream_find(buf_read, &stream, VAULT_FORMAT_TSV, check.unindexed_start, "zzz",
+                                    chunk, sizeof(chunk), (char *)record_buf, sizeof(record_buf), &view),
+                  -ENOENT, NULL);
+    vault_gen_name(&params, params.count - 1, name);
+    zassert_equal(parse_stream_find(buf_read, &stream, VAULT_FORMAT_TSV, check.unindexed_start, name,
+                                    chunk, sizeof(chunk), (char *)record_buf, 8, &view),
+                  -ENOBUFS, NULL);
+}
+
+static void test_append_entry_truncates(void)
+{
+    char entries[32];
+    size_t len = 0;
+
+    zassert_ok(parse_append_entry(entries, sizeof(entries), &len, "short", 5), NULL);
+    /* Longer than ENTRY_MAX_LEN, which is 10 without the password module */
+    zassert_ok(parse_append_entry(entries, sizeof(entries), &len, "abcdefghijkl", 12), NULL);
+    zassert_equal(len, 17, NULL);
+    zassert_mem_equal(entries, "short\tabcdefg...\t", len, NULL);
+    zassert_ok(parse_append_entry(entries, sizeof(entries), &len, "0123456789", 10), NULL);
+    zassert_equal(parse_append_entry(entries, sizeof(entries), &len, "0123456789", 10), -ENOBUFS, NULL);
+    zassert_equal(len, 28, NULL);
+}
+
+static void test_folders(void)
+{
+    struct vault_gen_params params = {.count = 1000, .name_len = 10, .folders = 7};
+    struct vault_record_view view;
+    struct vault_folder folder;
+    struct vault_bin vault;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char key[12];
+    uint32_t first = 0;
+    uint32_t pos;
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_ok(parse_bin_read_header(vault_buf, vault_len, &vault), NULL);
+    zassert_equal(vault.folder_count, params.folders, NULL);
+    for (uint32_t f = 0; f < params.folders; f++)
+    {
+        zassert_ok(parse_bin_get_folder_read(buf_read, &vault, f, record_buf, sizeof(record_buf), &folder), NULL);
+        snprintf(key, sizeof(key), "f%02u", (unsigned int)f);
+        zassert_equal(folder.name_len, strlen(key), NULL);
+        zassert_mem_equal(folder.name, key, folder.name_len, NULL);
+        zassert_equal(folder.first, first, "Folder %d", f);
+        zassert_true(folder.count > 0, NULL);
+        zassert_equal(vault_gen_folder_of(&params, folder.first + folder.count - 1), f, NULL);
+        first += folder.count;
+
+        /* Every record of the folder is named after it */
+        for (uint32_t i = folder.first; i < folder.first + folder.count; i++)
+        {
+            zassert_ok(parse_bin_get_record_read(buf_read, &vault, i, record_buf, sizeof(record_buf), &view), NULL);
+            zassert_mem_equal(view.field[ENTRY_ACCOUNT], key, folder.name_len, NULL);
+            zassert_equal(view.field[ENTRY_ACCOUNT][folder.name_len], VAULT_FOLDER_SEPARATOR, NULL);
+        }
+    }
+    zassert_equal(first, params.count, NULL);
+    zassert_equal(parse_bin_get_folder_read(buf_read, &vault, params.folders, record_buf, sizeof(record_buf),
+                                            &folder), -ENOENT, NULL);
+
+    /* Opening a folder reads its entry only */
+    read_calls = 0;
+    zassert_ok(parse_bin_find_folder_read(buf_read, &vault, "f05", record_buf, sizeof(record_buf), &folder), NULL);
+    zassert_mem_equal(folder.name, "f05", 3, NULL);
+    TC_PRINT("Opening 1 of %u folders took %u reads\n", params.folders, read_calls);
+    zassert_equal(parse_bin_find_folder_read(buf_read, &vault, "f0", record_buf, sizeof(record_buf), &folder),
+                  -ENOENT, NULL);
+    zassert_equal(parse_bin_find_folder_read(buf_read, &vault, "f99", record_buf, sizeof(record_buf), &folder),
+                  -ENOENT, NULL);
+
+    /* Searches stay within the folder */
+    zassert_ok(parse_bin_find_folder_read(buf_read, &vault, "f03", record_buf, sizeof(record_buf), &folder), NULL);
+    vault_gen_name(&params, folder.first + 2, name);
+    zassert_ok(parse_bin_lower_bound_read(buf_read, &vault, folder.first, folder.count, name, strlen(name),
+                                          record_buf, sizeof(record_buf), &pos), NULL);
+    zassert_equal(pos, folder.first + 2, NULL);
+    zassert_ok(parse_bin_lower_bound_read(buf_read, &vault, folder.first, folder.count, "f04", 3,
+                                          record_buf, sizeof(record_buf), &pos), NULL);
+    zassert_equal(pos, folder.first + folder.count, NULL);
+}
+
+static void test_folders_malformed(void)
+{
+    struct vault_gen_params params = {.count = 20, .name_len = 8, .folders = 2};
+    size_t folder_at = VAULT_HEADER_FOLDERS_LEN + (params.count + params.folders) * sizeof(uint32_t);
+    struct vault_folder folder;
+    struct vault_bin vault;
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_ok(parse_bin_read_header(vault_buf, vault_len, &vault), NULL);
+    zassert_equal(sys_get_le32(&vault_buf[VAULT_HEADER_FOLDERS_LEN + params.count * sizeof(uint32_t)]), folder_at,
+                  NULL);
+
+    /* Records past the end of the vault */
+    sys_put_le32(params.count + 1, &vault_buf[folder_at + 4]);
+    zassert_equal(parse_bin_get_folder_read(buf_read, &vault, 0, record_buf, sizeof(record_buf), &folder),
+                  -EINVAL, NULL);
+    sys_put_le32(1, &vault_buf[folder_at + 4]);
+    sys_put_le32(params.count, &vault_buf[folder_at]);
+    zassert_equal(parse_bin_get_folder_read(buf_read, &vault, 0, record_buf, sizeof(record_buf), &folder),
+                  -EINVAL, NULL);
+
+    /* A name longer than the read */
+    sys_put_le32(0, &vault_buf[folder_at]);
+    zassert_ok(parse_bin_get_folder_read(buf_read, &vault, 0, record_buf, sizeof(record_buf), &folder), NULL);
+    zassert_equal(parse_bin_get_folder_read(buf_read, &vault, 0, record_buf, 2 * sizeof(uint32_t) + 2, &folder),
+                  -EINVAL, NULL);
+}
+
+//========================================================================================
+/*                                                                                      *
+ *                                     Benchmarks                                       *
+ *                                                                                      */
+//========================================================================================
+
+static const uint32_t bench_counts[] = {100, 1000, 10000};
+static const uint8_t bench_name_lens[] = {8, 32};
+
+struct bench_stream_arg
+{
+    enum vault_format format;
+    struct stream_check check;
+    int err;
+};
+
+static void bench_stream_fn(void *arg)
+{
+    struct bench_stream_arg *bench = arg;
+
+    bench->err = stream_vault(bench->format, READ_WINDOW_LEN, count_record, &bench->check);
+}
+
+struct bench_lookup_arg
+{
+    const struct vault_gen_params *params;
+    enum vault_format format;
+    struct vault_bin vault;
+    uint32_t lookups;
+    int err;
+};
+
+static void bench_lookup_fn(void *arg)
+{
+    struct bench_lookup_arg *bench = arg;
+    struct vault_record_view view;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    uint32_t step = MAX(bench->params->count / 100, 1);
+
+    for (uint32_t i = 0; !bench->err && i < bench->params->count; i += step)
+    {
+        vault_gen_name(bench->params, i, name);
+        if (bench->format == VAULT_FORMAT_BINARY)
+        {
+            bench->err = parse_bin_find_read(buf_read, &bench->vault, name, record_buf, sizeof(record_buf), &view);
+        }
+        else
+        {
+            bench->err = parse_index_lookup(buf_read, entry_index, index_count, name, (char *)record_buf,
+                                            sizeof(record_buf), &view);
+        }
+        bench->lookups++;
+    }
+}
+
+/**
+ * @brief Run fn once, measuring the cycles it takes and its peak stack use.
+ */
+static void bench_run(void (*fn)(void *), void *arg, uint32_t *cycles, size_t *stack)
+{
+    uint64_t start;
+
+    bench_stack_paint();
+    start = bench_cycles();
+    fn(arg);
+    *cycles = bench_since(start);
+    *stack = bench_stack_used();
+}
+
+static const char *format_name(enum vault_format format)
+{
+    return format == VAULT_FORMAT_BINARY ? "binary" : "tsv";
+}
+
+static void bench_vault(const struct vault_gen_params *params, enum vault_format format)
+{
+    struct bench_stream_arg load = {
+        .format = format,
+        .check = {.params = params, .format = format, .index = format == VAULT_FORMAT_TSV},
+    };
+    struct bench_lookup_arg lookup = {.params = params, .format = format};
+    uint32_t cycles;
+    size_t stack;
+
+    vault_len = format == VAULT_FORMAT_BINARY ? vault_gen_bin(params, vault_buf, sizeof(vault_buf)) :
+                                                vault_gen_tsv(params, (char *)vault_buf, sizeof(vault_buf));
+    zassert_true(vault_len > 0, NULL);
+
+    bench_run(bench_stream_fn, &load, &cycles, &stack);
+    zassert_ok(load.err, NULL);
+    zassert_equal(load.check.count, params->count, NULL);
+    TC_PRINT("%-6s %5u records, %2u char names, %7zu bytes: load %5u cycles/record, stack %4zu bytes\n",
+             format_name(format), params->count, params->name_len, vault_len, cycles / params->count, stack);
+
+    if (format == VAULT_FORMAT_BINARY)
+    {
+        zassert_ok(parse_bin_read_header(vault_buf, vault_len, &lookup.vault), NULL);
+    }
+    read_calls = 0;
+    read_bytes = 0;
+    bench_run(bench_lookup_fn, &lookup, &cycles, &stack);
+    zassert_ok(lookup.err, NULL);
+    TC_PRINT("%-6s %5u records, %2u char names: lookup %5u cycles, %2u reads, %4zu bytes read, stack %4zu bytes\n",
+             format_name(format), params->count, params->name_len, cycles / lookup.lookups,
+             read_calls / lookup.lookups, read_bytes / lookup.lookups, stack);
+}
+
+/**
+ * Loading a vault streams it through the parser in read windows, a lookup
+ * searches it through the read callback. Cycles are host cycles on
+ * native_posix, compare runs on the same machine only.
+ */
+static void test_bench_parse(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(bench_counts); i++)
+    {
+        for (size_t j = 0; j < ARRAY_SIZE(bench_name_lens); j++)
+        {
+            struct vault_gen_params params = {
+                .count = bench_counts[i],
+                .name_len = bench_name_lens[j],
+            };
+
+            bench_vault(&params, VAULT_FORMAT_BINARY);
+            params.malformed_every = 50;
+            bench_vault(&params, VAULT_FORMAT_TSV);
+        }
+    }
+}
+
+/* The lookup parse_util had before the index: every call copies the vault,
+ * since strtok_r writes into it, and tokenizes all of it. */
+static char scan_buf[VAULT_BUF_LEN + 1];
+
+static int scan_get_password(const char *platform, char *pw_buf, size_t pw_len)
+{
+    char *rest = scan_buf;
+    char *line;
+    char *entry;
+    int err = -ENOENT;
+
+    memcpy(scan_buf, vault_buf, vault_len);
+    scan_buf[vault_len] = '\0';
+    line = strtok_r(rest, "\n", &rest);
+    while (line != NULL)
+    {
+        entry = strtok_r(line, "\t", &line);
+        if (!strcmp(entry, platform))
+        {
+            strtok_r(NULL, "\t", &line);
+            entry = strtok_r(NULL, "\t\n", &line);
+            err = strlen(entry) < pw_len ? 0 : -ERANGE;
+            if (!err)
+            {
+                strcpy(pw_buf, entry);
+            }
+        }
+        line = strtok_r(rest, "\n", &rest);
+    }
+    return err;
+}
+
+struct bench_index_arg
+{
+    const struct vault_gen_params *params;
+    bool scan;
+    uint32_t lookups;
+    int err;
+};
+
+static void bench_index_fn(void *arg)
+{
+    struct bench_index_arg *bench = arg;
+    struct vault_record_view view;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+    uint32_t step = MAX(bench->params->count / 100, 1);
+
+    for (uint32_t i = step / 2; !bench->err && i < bench->params->count; i += step)
+    {
+        vault_gen_name(bench->params, i, name);
+        if (bench->scan)
+        {
+            bench->err = scan_get_password(name, password, sizeof(password));
+        }
+        else
+        {
+            bench->err = parse_index_lookup(buf_read, entry_index, index_count, name, (char *)record_buf,
+                                            sizeof(record_buf), &view);
+            if (!bench->err)
+            {
+                bench->err = parse_view_get_field(&view, ENTRY_PASSWORD, password, sizeof(password));
+            }
+        }
+        bench->lookups++;
+    }
+}
+
+/**
+ * Password lookups in TSV vaults through the offset index, built once when
+ * the vault is loaded, against a scan of the whole vault per lookup.
+ */
+static void test_bench_index(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(bench_counts); i++)
+    {
+        struct vault_gen_params params = {.count = bench_counts[i], .name_len = 16};
+        struct bench_stream_arg load = {
+            .format = VAULT_FORMAT_TSV,
+            .check = {.params = &params, .format = VAULT_FORMAT_TSV, .index = true},
+        };
+        struct bench_index_arg indexed = {.params = &params};
+        struct bench_index_arg scanned = {.params = &params, .scan = true};
+        uint32_t build_cycles, index_cycles, scan_cycles;
+        size_t stack;
+
+        vault_len = vault_gen_tsv(&params, (char *)vault_buf, sizeof(vault_buf));
+        zassert_true(vault_len > 0, NULL);
+        bench_run(bench_stream_fn, &load, &build_cycles, &stack);
+        zassert_ok(load.err, NULL);
+        bench_run(bench_index_fn, &indexed, &index_cycles, &stack);
+        zassert_ok(indexed.err, NULL);
+        bench_run(bench_index_fn, &scanned, &scan_cycles, &stack);
+        zassert_ok(scanned.err, NULL);
+        index_cycles /= indexed.lookups;
+        scan_cycles /= scanned.lookups;
+        TC_PRINT("%5u records: index built in %8u cycles (%3zu KiB), lookup %6u cycles, scan %9u cycles, %ux\n",
+                 params.count, build_cycles, index_count * sizeof(entry_index[0]) / 1024, index_cycles,
+                 scan_cycles, scan_cycles / MAX(index_cycles, 1));
+    }
+}
+
+struct bench_open_arg
+{
+    struct vault_bin vault;
+    int err;
+};
+
+static void bench_open_fn(void *arg)
+{
+    struct bench_open_arg *bench = arg;
+
+    bench->err = parse_bin_open(vault_buf, vault_len, &bench->vault);
+}
+
+static void bench_scan_fn(void *arg)
+{
+    char password[16];
+    int *err = arg;
+
+    /* No account matches, so the whole vault is tokenized */
+    *err = scan_get_password("", password, sizeof(password));
+}
+
+/**
+ * Loading a vault of 10k entries: the TSV scan that parse_util did before,
+ * which needs a copy of the vault, the TSV stream with the offset index,
+ * and the binary format, which is searched in place.
+ */
+static void test_bench_binary_format(void)
+{
+    struct vault_gen_params params = {.count = 10000, .name_len = 16};
+    struct bench_stream_arg load = {
+        .format = VAULT_FORMAT_TSV,
+        .check = {.params = &params, .format = VAULT_FORMAT_TSV, .index = true},
+    };
+    struct bench_open_arg open = {0};
+    uint32_t scan_cycles, tsv_cycles, bin_cycles;
+    size_t scan_ram, tsv_ram, bin_ram;
+    size_t stack;
+    int err;
+
+    vault_len = vault_gen_tsv(&params, (char *)vault_buf, sizeof(vault_buf));
+    zassert_true(vault_len > 0, NULL);
+    bench_run(bench_scan_fn, &err, &scan_cycles, &stack);
+    zassert_equal(err, -ENOENT, NULL);
+    scan_ram = vault_len + 1;
+    bench_run(bench_stream_fn, &load, &tsv_cycles, &stack);
+    zassert_ok(load.err, NULL);
+    tsv_ram = index_count * sizeof(entry_index[0]) + sizeof(stream);
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_true(vault_len > 0, NULL);
+    bench_run(bench_open_fn, &open, &bin_cycles, &stack);
+    zassert_ok(open.err, NULL);
+    bin_ram = sizeof(open.vault);
+
+    TC_PRINT("10k entries, tsv scan:  %9u cycles, %6zu bytes of RAM\n", scan_cycles, scan_ram);
+    TC_PRINT("10k entries, tsv index: %9u cycles, %6zu bytes of RAM\n", tsv_cycles, tsv_ram);
+    TC_PRINT("10k entries, binary:    %9u cycles, %6zu bytes of RAM\n", bin_cycles, bin_ram);
+    /* Cycles vary with the host, RAM does not */
+    zassert_true(bin_ram * 10 <= tsv_ram, NULL);
+}
+
+struct bench_jump_arg
+{
+    const struct vault_gen_params *params;
+    struct vault_bin vault;
+    bool scan;
+    uint32_t jumps;
+    int err;
+};
+
+/* First record whose name does not start with the letter of record `from`,
+ * found by stepping through the records like scrolling the list does. */
+static int scan_next_letter(struct bench_jump_arg *bench, uint32_t from, uint32_t *pos)
+{
+    struct vault_record_view view;
+    char letter;
+    int err;
+
+    err = parse_bin_get_record_read(buf_read, &bench->vault, from, record_buf, sizeof(record_buf), &view);
+    if (err)
+    {
+        return err;
+    }
+    letter = view.field[ENTRY_ACCOUNT][0];
+    for (*pos = from + 1; !err && *pos < bench->vault.count; (*pos)++)
+    {
+        err = parse_bin_get_record_read(buf_read, &bench->vault, *pos, record_buf, sizeof(record_buf), &view);
+        if (!err && view.field[ENTRY_ACCOUNT][0] != letter)
+        {
+            break;
+        }
+    }
+    return err;
+}
+
+static void bench_jump_fn(void *arg)
+{
+    struct bench_jump_arg *bench = arg;
+    uint32_t step = bench->params->count / 100;
+    struct vault_record_view view;
+    uint32_t pos;
+    char key;
+
+    for (uint32_t from = step / 2; !bench->err && from < bench->params->count; from += step)
+    {
+        if (bench->scan)
+        {
+            bench->err = scan_next_letter(bench, from, &pos);
+        }
+        else
+        {
+            bench->err = parse_bin_get_record_read(buf_read, &bench->vault, from, record_buf,
+                                                   sizeof(record_buf), &view);
+            if (!bench->err)
+            {
+                key = view.field[ENTRY_ACCOUNT][0] + 1;
+                bench->err = parse_bin_lower_bound_read(buf_read, &bench->vault, 0, bench->vault.count, &key, 1,
+                                                        record_buf, sizeof(record_buf), &pos);
+            }
+        }
+        bench->jumps++;
+    }
+}
+
+/**
+ * Jumping to the next first letter in a list of 10k names, as the display
+ * does, with a binary search against stepping through the records.
+ */
+static void test_bench_prefix_jump(void)
+{
+    struct vault_gen_params params = {.count = 10000, .name_len = 16, .a_to_z = true};
+    struct bench_jump_arg search = {.params = &params};
+    struct bench_jump_arg scan = {.params = &params, .scan = true};
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    uint32_t search_cycles, scan_cycles, search_reads, scan_reads;
+    uint32_t expected = 0;
+    size_t stack;
+
+    vault_len = vault_gen_bin(&params, vault_buf, sizeof(vault_buf));
+    zassert_ok(parse_bin_read_header(vault_buf, vault_len, &search.vault), NULL);
+    scan.vault = search.vault;
+
+    /* Every letter lands on the first name starting with it */
+    for (char letter = 'a'; letter <= 'z'; letter++)
+    {
+        uint32_t pos;
+
+        while (expected < params.count)
+        {
+            vault_gen_name(&params, expected, name);
+            if (name[0] >= letter)
+            {
+                break;
+            }
+            expected++;
+        }
+        zassert_ok(parse_bin_lower_bound_read(buf_read, &search.vault, 0, search.vault.count, &letter, 1,
+                                              record_buf, sizeof(record_buf), &pos), NULL);
+        zassert_equal(pos, expected, "Letter %c", letter);
+    }
+
+    read_calls = 0;
+    bench_run(bench_jump_fn, &search, &search_cycles, &stack);
+    zassert_ok(search.err, NULL);
+    search_reads = read_calls;
+    read_calls = 0;
+    bench_run(bench_jump_fn, &scan, &scan_cycles, &stack);
+    zassert_ok(scan.err, NULL);
+    scan_reads = read_calls;
+    TC_PRINT("10k names, next letter: search %6u cycles, %3u reads; scan %8u cycles, %4u reads per jump\n",
+             search_cycles / search.jumps, search_reads / search.jumps, scan_cycles / scan.jumps,
+             scan_reads / scan.jumps);
+}
+
+void test_main(void)
+{
+    ztest_test_suite(parse_util,
+                     ztest_unit_test(test_detect_format),
+                     ztest_unit_test(test_read_header_rejects_malformed),
+                     ztest_unit_test(test_stream_binary_any_chunk_size),
+                     ztest_unit_test(test_stream_tsv_skips_malformed),
+                     ztest_unit_test(test_find_read_every_record),
+                     ztest_unit_test(test_get_record_out_of_bounds),
+                     ztest_unit_test(test_index_lookup_every_record),
+                     ztest_unit_test(test_index_overflow_scans),
+                     ztest_unit_test(test_append_entry_truncates),
+                     ztest_unit_test(test_folders),
+                     ztest_unit_test(test_folders_malformed),
+                     ztest_unit_test(test_bench_parse),
+                     ztest_unit_test(test_bench_index),
+                     ztest_unit_test(test_bench_binary_format),
+                     ztest_unit_test(test_bench_prefix_jump));
+    ztest_run_test_suite(parse_util);
+}
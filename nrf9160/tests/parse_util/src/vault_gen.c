@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/byteorder.h>
+#include "parse_util.h"
+#include "vault_gen.h"
+
+#define FOLDER_NAME_LEN 3
+
+/**
+ * @brief Name part of the account of record i, NULL terminated. Digits of i
+ * padded to name_len, after the first letter with a_to_z.
+ */
+static void name_part(const struct vault_gen_params *params, uint32_t i, char *name)
+{
+    if (params->a_to_z)
+    {
+        name[0] = 'a' + (uint64_t)i * 26 / params->count;
+        snprintf(name + 1, params->name_len, "%0*u", params->name_len - 1, (unsigned int)i);
+    }
+    else
+    {
+        snprintf(name, params->name_len + 1, "%0*u", params->name_len, (unsigned int)i);
+    }
+}
+
+uint32_t vault_gen_folder_of(const struct vault_gen_params *params, uint32_t i)
+{
+    return (uint64_t)i * params->folders / params->count;
+}
+
+/**
+ * @brief Account name of record i, NULL terminated. At most
+ * VAULT_GEN_NAME_MAX_LEN characters.
+ */
+void vault_gen_name(const struct vault_gen_params *params, uint32_t i, char *name)
+{
+    __ASSERT(params->name_len >= 6 && params->name_len + FOLDER_NAME_LEN + 1 <= VAULT_GEN_NAME_MAX_LEN,
+             "Unsupported name length");
+    if (params->folders > 0)
+    {
+        sprintf(name, "f%02u%c", (unsigned int)vault_gen_folder_of(params, i), VAULT_FOLDER_SEPARATOR);
+        name += FOLDER_NAME_LEN + 1;
+    }
+    name_part(params, i, name);
+}
+
+void vault_gen_password(uint32_t i, char *password)
+{
+    sprintf(password, "p%07u", (unsigned int)i);
+}
+
+/**
+ * @brief Write the vault as TSV, one line per record. Malformed lines have
+ * no tabs and are added on top of the records.
+ *
+ * @return Length of the vault, 0 if it does not fit in buf.
+ */
+size_t vault_gen_tsv(const struct vault_gen_params *params, char *buf, size_t len)
+{
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+    size_t pos = 0;
+
+    for (uint32_t i = 0; i < params->count; i++)
+    {
+        int n;
+
+        if (params->malformed_every && i % params->malformed_every == 0)
+        {
+            n = snprintf(buf + pos, len - pos, "malformed line %u\n", (unsigned int)i);
+            if (n < 0 || (size_t)n >= len - pos)
+            {
+                return 0;
+            }
+            pos += n;
+        }
+        vault_gen_name(params, i, name);
+        vault_gen_password(i, password);
+        n = snprintf(buf + pos, len - pos, "%s\t%s\t%s\n", name, VAULT_GEN_LOGIN, password);
+        if (n < 0 || (size_t)n >= len - pos)
+        {
+            return 0;
+        }
+        pos += n;
+    }
+    return pos;
+}
+
+static size_t put_field(uint8_t *buf, const char *field)
+{
+    size_t len = strlen(field);
+
+    buf[0] = len;
+    memcpy(&buf[1], field, len);
+    return 1 + len;
+}
+
+/**
+ * @brief Write the vault in the binary format of parse_util.h.
+ *
+ * @return Length of the vault, 0 if it does not fit in buf.
+ */
+size_t vault_gen_bin(const struct vault_gen_params *params, uint8_t *buf, size_t len)
+{
+    const size_t folder_entry_len = 2 * sizeof(uint32_t) + 1 + FOLDER_NAME_LEN;
+    uint16_t header_len = params->folders ? VAULT_HEADER_FOLDERS_LEN : VAULT_HEADER_LEN;
+    size_t folders_at = header_len + (params->count + params->folders) * sizeof(uint32_t);
+    size_t pos = folders_at + params->folders * folder_entry_len;
+    char name[VAULT_GEN_NAME_MAX_LEN + 1];
+    char password[16];
+
+    if (pos > len)
+    {
+        return 0;
+    }
+    memcpy(buf, VAULT_MAGIC, sizeof(VAULT_MAGIC) - 1);
+    buf[4] = VAULT_VERSION;
+    buf[5] = params->folders ? VAULT_FLAG_FOLDERS : 0;
+    sys_put_le16(header_len, &buf[6]);
+    sys_put_le32(params->count, &buf[8]);
+    if (params->folders)
+    {
+        sys_put_le32(params->folders, &buf[12]);
+        sys_put_le32(pos, &buf[16]);
+    }
+
+    uint32_t first = 0;
+    for (uint32_t f = 0; f < params->folders; f++)
+    {
+        uint8_t *entry = &buf[folders_at + f * folder_entry_len];
+        uint32_t end = first;
+
+        while (end < params->count && vault_gen_folder_of(params, end) == f)
+        {
+            end++;
+        }
+        sys_put_le32(entry - buf, &buf[header_len + (params->count + f) * sizeof(uint32_t)]);
+        sys_put_le32(first, entry);
+        sys_put_le32(end - first, &entry[4]);
+        entry[8] = FOLDER_NAME_LEN;
+        snprintf(name, sizeof(name), "f%02u", (unsigned int)f);
+        memcpy(&entry[9], name, FOLDER_NAME_LEN);
+        first = end;
+    }
+
+    for (uint32_t i = 0; i < params->count; i++)
+    {
+        vault_gen_name(params, i, name);
+        vault_gen_password(i, password);
+        if (pos + 3 + strlen(name) + strlen(VAULT_GEN_LOGIN) + strlen(password) > len)
+        {
+            return 0;
+        }
+        sys_put_le32(pos, &buf[header_len + i * sizeof(uint32_t)]);
+        pos += put_field(&buf[pos], name);
+        pos += put_field(&buf[pos], VAULT_GEN_LOGIN);
+        pos += put_field(&buf[pos], password);
+    }
+    return pos;
+}
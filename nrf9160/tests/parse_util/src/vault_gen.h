@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef _VAULT_GEN_H_
+#define _VAULT_GEN_H_
+
+#include <zephyr.h>
+
+/*
+ * Synthetic password vaults. Record i has the account name from
+ * vault_gen_name, names are sorted in record order. With a_to_z the names
+ * start with a letter spread over a-z, so vaults have 26 distinct first
+ * letters. With folders the records are split evenly over folders named
+ * "f00", "f01", ..., and every account name is "fNN/name".
+ */
+struct vault_gen_params
+{
+    uint32_t count;
+    uint8_t name_len;           /* Length of the name part, at least 6 */
+    bool a_to_z;
+    uint32_t folders;           /* 0 for a flat vault */
+    uint32_t malformed_every;   /* TSV only: every n-th line is malformed, 0 for none */
+};
+
+#define VAULT_GEN_LOGIN "user@example.com"
+#define VAULT_GEN_NAME_MAX_LEN 64
+
+void vault_gen_name(const struct vault_gen_params *params, uint32_t i, char *name);
+void vault_gen_password(uint32_t i, char *password);
+uint32_t vault_gen_folder_of(const struct vault_gen_params *params, uint32_t i);
+size_t vault_gen_tsv(const struct vault_gen_params *params, char *buf, size_t len);
+size_t vault_gen_bin(const struct vault_gen_params *params, uint8_t *buf, size_t len);
+
+#endif /* _VAULT_GEN_H_ */